@@ -0,0 +1,49 @@
+/// Detector acceptance cuts on a single stable charged particle
+/// Applied in this order:
+/// 	|cos(theta)| < max_abs_costheta
+/// 	p > min_p (GeV)
+/// 	pT > min_pt (GeV)
+/// Shared by the acceptance pre-filter of the generator (AcceptanceFilter.h) and the offline selection (EventSelection.h), so that a sample skimmed with the same cuts is the same as the one generated with them
+
+#ifndef GENERATOR_ACCEPTANCECUTS_H
+#define GENERATOR_ACCEPTANCECUTS_H
+
+// STL
+#include <cmath>
+
+struct AcceptanceCuts {
+	enum Cut {
+		CosTheta,
+		P,
+		Pt,
+		ncuts
+	};
+
+	double max_abs_costheta = 1.; // 1 disables the cut
+	double min_p = 0.; // GeV, 0 disables the cut
+	double min_pt = 0.; // GeV, 0 disables the cut
+
+	bool enabled() const {return max_abs_costheta < 1. || min_p > 0. || min_pt > 0.;}
+
+	// index of the first cut failed by a particle with the given momentum (GeV), ncuts if it passes all of them
+	int first_failed_cut(double px, double py, double pz) const {
+		return first_failed_cut_pt_p(std::sqrt(px * px + py * py), std::sqrt(px * px + py * py + pz * pz), pz);
+	}
+
+	// same from the transverse and absolute momenta computed beforehand, e.g. for a whole event by the kernels of ParticleBatch.h. The overload above computes them the same way, so both give the same decisions
+	int first_failed_cut_pt_p(double pt, double p, double pz) const {
+		if(max_abs_costheta < 1. && !(p > 0. && std::abs(pz) < max_abs_costheta * p)) {
+			return CosTheta;
+		}
+		if(min_p > 0. && p <= min_p) {
+			return P;
+		}
+		if(min_pt > 0. && pt <= min_pt) {
+			return Pt;
+		}
+
+		return ncuts;
+	}
+};
+
+#endif // GENERATOR_ACCEPTANCECUTS_H
@@ -0,0 +1,148 @@
+/// Detector acceptance pre-filter
+/// Evaluated on the PYTHIA event record right after the decays, so events whose signal can't be reconstructed are dropped before the (much more expensive) HepMC conversion and storing
+/// A key particle is accepted if all stable charged particles of its decay tree pass the cuts (see AcceptanceCuts.h)
+/// An event is accepted if at least one of its key particles is accepted. Events without key particles are left to the caller
+/// A rejected event is attributed to the cut that stopped the key particle that got furthest through the list
+/// The transverse and absolute momenta of the whole event are computed in one go with the kernels of ParticleBatch.h as soon as the first key particle is found, and the decay tree walk only looks them up
+
+#ifndef GENERATOR_ACCEPTANCEFILTER_H
+#define GENERATOR_ACCEPTANCEFILTER_H
+
+// Common utilities
+#include "AcceptanceCuts.h"
+#include "ParticleBatch.h"
+
+// PYTHIA
+#include "Pythia8/Pythia.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <vector>
+#include <ostream>
+
+class AcceptanceFilter {
+public:
+	AcceptanceFilter(int key_pdg, AcceptanceCuts const & cuts) : m_key_pdg(key_pdg), m_cuts(cuts), m_accepted(0), m_no_key(0) {
+		m_rejected.fill(0);
+	}
+
+	bool enabled() const {return m_cuts.enabled();}
+
+	// true if the event should be processed further. Always true if no cut is set
+	bool accept(Pythia8::Event const & event) {
+		if(!enabled()) {
+			return true;
+		}
+
+		int furthest = -1; // index of the first failed cut of the key particle that got furthest, AcceptanceCuts::ncuts if one passed all of them
+		for(int i = 0; i < event.size() && furthest < AcceptanceCuts::ncuts; ++i) {
+			if(is_key_at_production(event, i)) {
+				if(furthest < 0) {
+					fill_batch(m_batch, event);
+					compute_pt(m_batch, m_pt);
+					compute_p(m_batch, m_p);
+				}
+				furthest = std::max(furthest, first_failed_cut(event, i));
+			}
+		}
+
+		if(furthest < 0) {
+			++m_no_key;
+			return true;
+		}
+		if(furthest == AcceptanceCuts::ncuts) {
+			++m_accepted;
+			return true;
+		}
+
+		++m_rejected[static_cast<std::size_t>(furthest)];
+		return false;
+	}
+
+	std::size_t accepted() const {return m_accepted;} // events with an accepted key particle
+	std::size_t rejected() const {
+		std::size_t total = 0;
+		for(auto count : m_rejected) {
+			total += count;
+		}
+		return total;
+	}
+	std::size_t rejected(AcceptanceCuts::Cut cut) const {return m_rejected[static_cast<std::size_t>(cut)];}
+
+	// run summary: cuts and rejection counts
+	void print(std::ostream & os) const {
+		os << "Acceptance filter: " << m_accepted << " events accepted, " << rejected() << " rejected (" << m_no_key << " without key particle passed through)" << std::endl;
+		if(m_cuts.max_abs_costheta < 1.) {
+			os << "\t|cos(theta)| < " << m_cuts.max_abs_costheta << ": " << rejected(AcceptanceCuts::CosTheta) << " rejected" << std::endl;
+		}
+		if(m_cuts.min_p > 0.) {
+			os << "\tp > " << m_cuts.min_p << " GeV: " << rejected(AcceptanceCuts::P) << " rejected" << std::endl;
+		}
+		if(m_cuts.min_pt > 0.) {
+			os << "\tpT > " << m_cuts.min_pt << " GeV: " << rejected(AcceptanceCuts::Pt) << " rejected" << std::endl;
+		}
+	}
+
+private:
+	// key particle that is not the result of an oscillation (EvtGen inserts the oscillated particle as the only daughter of the original one)
+	bool is_key_at_production(Pythia8::Event const & event, int i) const {
+		auto const & ptc = event[i];
+		if(std::abs(ptc.id()) != m_key_pdg) {
+			return false;
+		}
+
+		auto mother = ptc.mother1();
+		return !(mother > 0 && ptc.mother2() == 0 && event[mother].id() == -ptc.id());
+	}
+
+	// index of the first cut failed by a stable charged descendant of the particle, AcceptanceCuts::ncuts if there is none
+	int first_failed_cut(Pythia8::Event const & event, int key) {
+		int failed = AcceptanceCuts::ncuts;
+
+		m_stack.clear();
+		m_stack.push_back(key);
+		while(!m_stack.empty() && failed > 0) {
+			auto const index = static_cast<std::size_t>(m_stack.back());
+			auto const & ptc = event[m_stack.back()];
+			m_stack.pop_back();
+
+			if(ptc.isFinal()) {
+				if(ptc.isCharged()) {
+					failed = std::min(failed, m_cuts.first_failed_cut_pt_p(m_pt[index], m_p[index], m_batch.pz[index]));
+				}
+				continue;
+			}
+
+			// daughters are either a range or (in rare cases) two unrelated entries
+			auto d1 = ptc.daughter1(), d2 = ptc.daughter2();
+			if(d1 > 0 && d2 >= d1) {
+				for(auto d = d1; d <= d2; ++d) {
+					m_stack.push_back(d);
+				}
+			} else {
+				if(d1 > 0) {
+					m_stack.push_back(d1);
+				}
+				if(d2 > 0) {
+					m_stack.push_back(d2);
+				}
+			}
+		}
+
+		return failed;
+	}
+
+	int m_key_pdg;
+	AcceptanceCuts m_cuts;
+	std::size_t m_accepted;
+	std::size_t m_no_key; // events without key particle
+	std::array<std::size_t, AcceptanceCuts::ncuts> m_rejected; // rejected events by cut
+	std::vector<int> m_stack; // decay tree walk. Kept between events to avoid reallocations, like the batch
+	ParticleBatch m_batch; // the event record, index i is entry i
+	std::vector<double> m_pt, m_p; // GeV, by batch index
+};
+
+#endif // GENERATOR_ACCEPTANCEFILTER_H
@@ -0,0 +1,75 @@
+/// Replacement of the global operator new/delete that counts allocations. See AllocationCounter.h
+
+#include "AllocationCounter.h"
+
+// STL
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	// relaxed atomics: we only need the totals to be exact, not ordered with respect to anything else
+	std::atomic<std::size_t> allocation_count(0);
+	std::atomic<std::size_t> allocated_bytes(0);
+}
+
+std::size_t heap_allocation_count() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+
+std::size_t heap_allocated_bytes() {
+	return allocated_bytes.load(std::memory_order_relaxed);
+}
+
+void * operator new(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+	if(void * ptr = std::malloc(size > 0 ? size : 1)) {
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void * operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+// the nothrow forms are replaced too, otherwise the allocations made through them would not be counted
+void * operator new(std::size_t size, std::nothrow_t const &) noexcept {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void * operator new[](std::size_t size, std::nothrow_t const & nothrow) noexcept {
+	return ::operator new(size, nothrow);
+}
+
+void operator delete(void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void * ptr, std::nothrow_t const &) noexcept {
+	std::free(ptr);
+}
+
+void operator delete[](void * ptr, std::nothrow_t const &) noexcept {
+	std::free(ptr);
+}
+
+// sized deallocation (C++14 and later) must go to free as well, whatever the compiler defaults to
+#ifdef __cpp_sized_deallocation
+	void operator delete(void * ptr, std::size_t) noexcept {
+		std::free(ptr);
+	}
+
+	void operator delete[](void * ptr, std::size_t) noexcept {
+		std::free(ptr);
+	}
+#endif
@@ -0,0 +1,14 @@
+/// Global heap allocation counters
+/// AllocationCounter.cpp replaces the global operator new/delete with thin wrappers around malloc/free that count every request, so the executables can report how often the event loop still goes to the global heap
+/// The counters are only meaningful if AllocationCounter.cpp is compiled into the executable (see src/generator/CMakeLists.txt)
+
+#ifndef GENERATOR_ALLOCATIONCOUNTER_H
+#define GENERATOR_ALLOCATIONCOUNTER_H
+
+// STL
+#include <cstddef>
+
+std::size_t heap_allocation_count(); // number of calls to the global operator new so far
+std::size_t heap_allocated_bytes(); // number of bytes requested from the global operator new so far
+
+#endif // GENERATOR_ALLOCATIONCOUNTER_H
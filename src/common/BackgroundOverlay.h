@@ -0,0 +1,252 @@
+/// Overlay of background events from a pre-generated library
+/// The library is a generator output (podio ROOT file) or an event stream written to a file with --stream (see EventStream.h), e.g. Z -> q qbar or gamma gamma -> hadrons events generated once. It is read into memory when the job starts: the vertices and particles of all the events in two flat arrays, with the first vertex and particle of every event
+/// For every signal event a number of library events (Poisson distributed around the mean, or fixed) is picked at random, moved to a primary vertex drawn from the Gaussian luminous region and appended to the GenVertex and GenParticle collections of the signal event
+/// The background of an event is drawn once (sample) and can then be appended to several copies of the event (append), e.g. one per key particle sample, which all get the same background. The random numbers come from a generator of the overlay's own, seeded for every event from the seed of the event: the overlay is reproduced with the event, and turning it on doesn't change the random numbers PYTHIA and EvtGen draw for the following events
+/// Provenance of the overlaid particles in Core().Bits (signal particles keep 0):
+/// 	bit 31 - the particle comes from the background overlay
+/// 	bits 24-30 - number of the overlaid event within the signal event, from 1 (at most 127)
+/// 	bits 0-23 - entry of the overlaid event in the library (modulo 2^24)
+
+#ifndef GENERATOR_BACKGROUNDOVERLAY_H
+#define GENERATOR_BACKGROUNDOVERLAY_H
+
+// Common utilities
+#include "EventStream.h"
+
+// PYTHIA
+#include "Pythia8/Pythia.h"
+
+// PODIO
+#include "podio/EventStore.h"
+#include "podio/ROOTReader.h"
+
+// Data model
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+#include "datamodel/GenVertexCollection.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace overlay {
+	std::uint32_t const background_bit = 1u << 31;
+	std::uint32_t const max_events = 127; // overlaid events per signal event, bits 24-30
+
+	inline std::uint32_t provenance_bits(std::size_t entry, std::uint32_t number) {
+		return background_bit | (number << 24) | static_cast<std::uint32_t>(entry & 0xffffff);
+	}
+
+	inline bool is_background(std::uint32_t bits) {return (bits & background_bit) != 0;}
+}
+
+class BackgroundLibrary {
+public:
+	// reads the whole library. The format is recognized by the magic of the event stream
+	explicit BackgroundLibrary(std::string const & filename) : m_filename(filename) {
+		std::ifstream file(filename, std::ios::binary);
+		if(!file) {
+			throw std::runtime_error("Unable to open background library \"" + filename + "\"");
+		}
+		char magic[sizeof(event_stream::magic)] = {};
+		file.read(magic, sizeof(magic));
+		file.close();
+
+		if(std::memcmp(magic, event_stream::magic, sizeof(magic)) == 0) {
+			read_stream(filename);
+		} else {
+			read_podio(filename);
+		}
+
+		if(events() == 0) {
+			throw std::runtime_error("Background library \"" + filename + "\" has no events");
+		}
+	}
+
+	BackgroundLibrary(BackgroundLibrary const &) = delete;
+	BackgroundLibrary & operator=(BackgroundLibrary const &) = delete;
+
+	std::size_t events() const {return m_first_particle.size() - 1;}
+	std::size_t particles() const {return m_particles.size();}
+	std::string const & filename() const {return m_filename;}
+
+	// vertices and particles of event i. Vertex indices of the particles are relative to the first vertex of the event
+	StreamVertex const * vertices_begin(std::size_t i) const {return m_vertices.data() + m_first_vertex[i];}
+	StreamVertex const * vertices_end(std::size_t i) const {return m_vertices.data() + m_first_vertex[i + 1];}
+	StreamParticle const * particles_begin(std::size_t i) const {return m_particles.data() + m_first_particle[i];}
+	StreamParticle const * particles_end(std::size_t i) const {return m_particles.data() + m_first_particle[i + 1];}
+
+	std::size_t bytes() const {return m_vertices.capacity() * sizeof(StreamVertex) + m_particles.capacity() * sizeof(StreamParticle) + (m_first_vertex.capacity() + m_first_particle.capacity()) * sizeof(std::size_t);}
+
+private:
+	void add(StreamEvent const & event) {
+		m_vertices.insert(m_vertices.end(), event.vertices.begin(), event.vertices.end());
+		m_particles.insert(m_particles.end(), event.particles.begin(), event.particles.end());
+		m_first_vertex.push_back(m_vertices.size());
+		m_first_particle.push_back(m_particles.size());
+	}
+
+	void read_stream(std::string const & filename) {
+		EventStreamReader reader(filename);
+		StreamEvent event;
+		while(reader.next(event)) {
+			add(event);
+		}
+	}
+
+	void read_podio(std::string const & filename) {
+		podio::ROOTReader reader;
+		podio::EventStore store;
+		reader.openFile(filename);
+		store.setReader(&reader);
+
+		StreamEvent event;
+		for(unsigned i = 0, nentries = reader.getEntries(); i < nentries; ++i) {
+			fcc::MCParticleCollection const * pcoll = nullptr;
+			fcc::GenVertexCollection const * vcoll = nullptr;
+			if(!store.get("GenParticle", pcoll) || !store.get("GenVertex", vcoll)) {
+				throw std::runtime_error("Entry " + std::to_string(i) + " of background library \"" + filename + "\" has no GenParticle and GenVertex collections");
+			}
+			fill_stream_event(static_cast<int>(i), *pcoll, *vcoll, event);
+			add(event);
+
+			store.clear();
+			reader.endOfEvent();
+		}
+		reader.closeFile();
+	}
+
+	std::string m_filename;
+	std::vector<StreamVertex> m_vertices;
+	std::vector<StreamParticle> m_particles;
+	std::vector<std::size_t> m_first_vertex = {0}; // one more than the events, so that event i ends where event i + 1 begins
+	std::vector<std::size_t> m_first_particle = {0};
+};
+
+// luminous region the overlaid events are moved to. Sigmas in mm
+struct OverlayVertexSpread {
+	double sigma_x = 0.;
+	double sigma_y = 0.;
+	double sigma_z = 0.;
+};
+
+class BackgroundOverlay {
+public:
+	// "mean" background events per signal event, Poisson distributed unless "fixed"
+	BackgroundOverlay(BackgroundLibrary const & library, double mean, bool fixed, OverlayVertexSpread const & spread) : m_library(library), m_mean(mean), m_fixed(fixed), m_spread(spread), m_signal_events(0), m_overlaid_events(0), m_overlaid_particles(0) {
+		if(!(mean >= 0.) || (fixed ? std::round(mean) : mean + 5. * std::sqrt(mean)) > overlay::max_events) {
+			throw std::invalid_argument("The mean number of overlaid events must be between 0 and " + std::to_string(overlay::max_events) + (fixed ? "" : " (including its Poisson fluctuations)"));
+		}
+	}
+
+	// draws the background of the next signal event with the generator seeded by "seed" (1 to 900000000). Returns the number of background events
+	std::uint32_t sample(int seed) {
+		m_rndm.init(seed);
+		auto const n = std::min(m_fixed ? static_cast<std::uint32_t>(std::round(m_mean)) : poisson(m_rndm), overlay::max_events);
+		m_picks.clear();
+		for(std::uint32_t number = 1; number <= n; ++number) {
+			auto const entry = std::min(static_cast<std::size_t>(m_rndm.flat() * static_cast<double>(m_library.events())), m_library.events() - 1);
+			auto const dx = m_spread.sigma_x * m_rndm.gauss();
+			auto const dy = m_spread.sigma_y * m_rndm.gauss();
+			auto const dz = m_spread.sigma_z * m_rndm.gauss();
+			m_picks.push_back(Pick{entry, dx, dy, dz});
+			m_overlaid_particles += static_cast<std::size_t>(m_library.particles_end(entry) - m_library.particles_begin(entry));
+		}
+		++m_signal_events;
+		m_overlaid_events += n;
+
+		return n;
+	}
+
+	// appends the background drawn by the last sample() to the collections of the signal event, after its particles
+	void append(fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll) {
+		for(std::size_t i = 0; i < m_picks.size(); ++i) {
+			auto const & pick = m_picks[i];
+			auto const entry = pick.entry;
+			auto const number = static_cast<std::uint32_t>(i + 1);
+
+			m_vertices.clear();
+			for(auto v = m_library.vertices_begin(entry), end = m_library.vertices_end(entry); v != end; ++v) {
+				auto vtx = fcc::GenVertex();
+				vtx.Position().X = v->x + pick.dx;
+				vtx.Position().Y = v->y + pick.dy;
+				vtx.Position().Z = v->z + pick.dz;
+				vtx.Ctau(static_cast<float>(v->ctau));
+				vcoll.push_back(vtx);
+				m_vertices.push_back(vtx);
+			}
+
+			auto const bits = overlay::provenance_bits(entry, number);
+			for(auto p = m_library.particles_begin(entry), end = m_library.particles_end(entry); p != end; ++p) {
+				auto ptc = fcc::MCParticle();
+				auto & core = ptc.Core();
+				core.Type = p->pdg;
+				core.Status = p->status;
+				core.Charge = p->charge;
+				core.Bits = bits;
+				core.P4.Px = p->px;
+				core.P4.Py = p->py;
+				core.P4.Pz = p->pz;
+				core.P4.Mass = p->mass;
+
+				if(p->start_vertex >= 0 && static_cast<std::size_t>(p->start_vertex) < m_vertices.size()) {
+					ptc.StartVertex(m_vertices[static_cast<std::size_t>(p->start_vertex)]);
+				}
+				if(p->end_vertex >= 0 && static_cast<std::size_t>(p->end_vertex) < m_vertices.size()) {
+					ptc.EndVertex(m_vertices[static_cast<std::size_t>(p->end_vertex)]);
+				}
+				pcoll.push_back(ptc);
+			}
+		}
+	}
+
+	std::size_t overlaid_events() const {return m_overlaid_events;}
+	std::size_t overlaid_particles() const {return m_overlaid_particles;}
+
+	// counts events once, however many copies of them the background was appended to
+	void print(std::ostream & os) const {
+		os << "Overlaid " << m_overlaid_events << " background events (" << m_overlaid_particles << " particles, " << static_cast<double>(m_overlaid_events) / static_cast<double>(std::max<std::size_t>(m_signal_events, 1)) << " per stored event) from the " << m_library.events() << " events of \"" << m_library.filename() << "\"" << std::endl;
+	}
+
+private:
+	// Knuth's multiplication method, fine for the means allowed here
+	std::uint32_t poisson(Pythia8::Rndm & rndm) const {
+		auto const limit = std::exp(-m_mean);
+		std::uint32_t k = 0;
+		for(auto p = rndm.flat(); p > limit; p *= rndm.flat()) {
+			++k;
+		}
+
+		return k;
+	}
+
+	BackgroundLibrary const & m_library;
+	double m_mean;
+	bool m_fixed;
+	OverlayVertexSpread m_spread;
+	// library event and vertex shift of an overlaid event
+	struct Pick {
+		std::size_t entry;
+		double dx;
+		double dy;
+		double dz;
+	};
+
+	Pythia8::Rndm m_rndm;
+	std::vector<Pick> m_picks; // background of the current signal event
+	std::vector<fcc::GenVertex> m_vertices; // vertices of the event being overlaid, for the particle links. Kept to reuse its memory
+	std::size_t m_signal_events;
+	std::size_t m_overlaid_events;
+	std::size_t m_overlaid_particles;
+};
+
+#endif // GENERATOR_BACKGROUNDOVERLAY_H
@@ -0,0 +1,177 @@
+/// Cutflow of an event selection
+/// Every selection step is registered by name and every evaluation of it is recorded with its outcome and the time it took. The table printed at the end of the run shows for every step how many candidates it tested and passed, its efficiency, the cumulative efficiency of the selection up to it and its cost. The number of candidates rejected per millisecond of the step tells which steps should come first: cheap steps that reject a lot
+/// Counters are kept per thread (taken on the first record() of a thread), so parallel selections don't share cache lines or take locks while counting. When a thread ends its counters are handed to the next new thread, which keeps adding to them, so tools starting threads per chunk don't pile up counters. They are added up when the table is printed, which must happen after the selecting threads are done
+
+#ifndef GENERATOR_CUTFLOW_H
+#define GENERATOR_CUTFLOW_H
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+
+class Cutflow {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// "unit" names what the steps are tested on, e.g. "events" or "candidates"
+	explicit Cutflow(std::string const & name, std::string const & unit = "events") : m_name(name), m_unit(unit), m_id(next_id()), m_state(std::make_shared<State>()) {}
+
+	Cutflow(Cutflow const &) = delete;
+	Cutflow & operator=(Cutflow const &) = delete;
+
+	// registers a step and returns its index. Steps are printed in the order they are registered
+	std::size_t add(std::string const & step) {
+		m_steps.push_back(step);
+		return m_steps.size() - 1;
+	}
+
+	// records one evaluation of the step that started at "start". Returns the current time, so that consecutive steps can be timed in a chain
+	Clock::time_point record(std::size_t step, bool passed, Clock::time_point start) {
+		auto const now = Clock::now();
+		auto & counters = local();
+		if(step >= counters.size()) {
+			counters.resize(m_steps.size());
+		}
+
+		auto & counter = counters[step];
+		++counter.tested;
+		if(passed) {
+			++counter.passed;
+		}
+		counter.ns += static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count());
+
+		return now;
+	}
+
+	// evaluates the cut (a callable returning bool) and records it
+	template<typename Cut>
+	bool apply(std::size_t step, Cut cut) {
+		auto const start = Clock::now();
+		bool const passed = cut();
+		record(step, passed, start);
+
+		return passed;
+	}
+
+	std::size_t tested(std::size_t step) const {return total(step).tested;}
+	std::size_t passed(std::size_t step) const {return total(step).passed;}
+
+	void print(std::ostream & os) const {
+		os << "Cutflow of " << m_name << " (" << m_unit << "):" << std::endl;
+		os << "\t" << std::left << std::setw(28) << "step" << std::right << std::setw(14) << "tested" << std::setw(14) << "passed" << std::setw(10) << "eff %" << std::setw(10) << "cumul %" << std::setw(12) << "time s" << std::setw(12) << "us / test" << std::setw(14) << "rejected / ms" << std::endl;
+
+		std::size_t first_tested = 0; // tested by the first step in use, the base of the cumulative efficiency
+		for(std::size_t i = 0; i < m_steps.size(); ++i) {
+			auto const counter = total(i);
+			if(first_tested == 0) {
+				first_tested = counter.tested;
+			}
+
+			auto const seconds = static_cast<double>(counter.ns) * 1e-9;
+			auto const efficiency = counter.tested > 0 ? 100. * static_cast<double>(counter.passed) / static_cast<double>(counter.tested) : 0.;
+			auto const cumulative = first_tested > 0 ? 100. * static_cast<double>(counter.passed) / static_cast<double>(first_tested) : 0.;
+			auto const per_test = counter.tested > 0 ? seconds * 1e6 / static_cast<double>(counter.tested) : 0.;
+			auto const rejection_rate = counter.ns > 0 ? static_cast<double>(counter.tested - counter.passed) / (seconds * 1e3) : 0.;
+
+			os << "\t" << std::left << std::setw(28) << m_steps[i] << std::right << std::setw(14) << counter.tested << std::setw(14) << counter.passed << std::setw(10) << std::setprecision(4) << efficiency << std::setw(10) << cumulative << std::setw(12) << seconds << std::setw(12) << per_test << std::setw(14) << rejection_rate << std::setprecision(6) << std::endl;
+		}
+	}
+
+private:
+	struct Counter {
+		std::size_t tested = 0;
+		std::size_t passed = 0;
+		std::uint64_t ns = 0; // time spent in the step
+	};
+
+	typedef std::vector<Counter> Counters;
+
+	// counters of all the threads that have recorded. Shared with the threads, which give their counters back when they end
+	struct State {
+		std::mutex mutex; // guards the lists, not the counters
+		std::vector<std::unique_ptr<Counters>> counters;
+		std::vector<Counters *> released; // counters of threads that have ended
+	};
+
+	// counters of the calling thread per cutflow. Looked up by the id of the cutflow, not its address, which may be reused
+	struct ThreadCounters {
+		struct Entry {
+			std::uint64_t id;
+			std::weak_ptr<State> state;
+			Counters * counters;
+		};
+
+		~ThreadCounters() {
+			for(auto const & entry : entries) {
+				if(auto state = entry.state.lock()) {
+					std::lock_guard<std::mutex> lock(state->mutex);
+					state->released.push_back(entry.counters);
+				}
+			}
+		}
+
+		std::vector<Entry> entries;
+	};
+
+	static std::uint64_t next_id() {
+		static std::atomic<std::uint64_t> id(0);
+		return ++id;
+	}
+
+	Counters & local() {
+		thread_local ThreadCounters thread_counters;
+		auto & entries = thread_counters.entries;
+		for(auto const & entry : entries) {
+			if(entry.id == m_id) {
+				return *entry.counters;
+			}
+		}
+
+		// first record of the thread: dropping the entries of destroyed cutflows and taking counters
+		entries.erase(std::remove_if(entries.begin(), entries.end(), [](ThreadCounters::Entry const & entry) {return entry.state.expired();}), entries.end());
+
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		Counters * counters = nullptr;
+		if(m_state->released.empty()) {
+			m_state->counters.emplace_back(new Counters(m_steps.size()));
+			counters = m_state->counters.back().get();
+		} else {
+			counters = m_state->released.back();
+			m_state->released.pop_back();
+		}
+		entries.push_back(ThreadCounters::Entry{m_id, m_state, counters});
+
+		return *counters;
+	}
+
+	Counter total(std::size_t step) const {
+		Counter sum;
+		std::lock_guard<std::mutex> lock(m_state->mutex);
+		for(auto const & counters : m_state->counters) {
+			if(step < counters->size()) {
+				sum.tested += (*counters)[step].tested;
+				sum.passed += (*counters)[step].passed;
+				sum.ns += (*counters)[step].ns;
+			}
+		}
+
+		return sum;
+	}
+
+	std::string m_name;
+	std::string m_unit;
+	std::uint64_t m_id;
+	std::vector<std::string> m_steps;
+	std::shared_ptr<State> m_state;
+};
+
+#endif // GENERATOR_CUTFLOW_H
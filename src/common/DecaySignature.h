@@ -0,0 +1,74 @@
+/// Decay signatures of key particles and index records of HepMC events
+/// The signature of a particle is its PDG ID if it doesn't decay, or "(ID -> daughter signatures)" with the daughter signatures sorted, so the same decay chain always gives the same string regardless of the order the generator produced the daughters in. Photons are left out of decays with other daughters, so a decay mode keeps its signature whatever the number of radiated (PHOTOS) photons
+/// The signature of an event is the sorted signatures of all its key particles joined with " ; ", e.g. "(511 -> (313 -> -211 321) -15 15)" for B0 -> K*0 tau tau with the taus left undecayed
+/// Signatures are looked up by their hash (signature_hash in EventIndex.h)
+
+#ifndef GENERATOR_DECAYSIGNATURE_H
+#define GENERATOR_DECAYSIGNATURE_H
+
+// Common utilities
+#include "EventIndex.h"
+#include "ParticleTable.h"
+
+// PYTHIA and HepMC
+#include "Pythia8/Pythia.h"
+#include "HepMC/GenEvent.h"
+
+// STL
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+inline std::string decay_signature(HepMC::GenParticle const * ptc) {
+	auto endvtx = ptc->end_vertex();
+	if(!endvtx || endvtx->particles_out_size() == 0) {
+		return std::to_string(ptc->pdg_id());
+	}
+
+	std::vector<std::string> daughters;
+	for(auto idaugh = endvtx->particles_out_const_begin(), endd = endvtx->particles_out_const_end(); idaugh != endd; ++idaugh) {
+		if((*idaugh)->pdg_id() != 22 || endvtx->particles_out_size() == 1) {
+			daughters.push_back(decay_signature(*idaugh));
+		}
+	}
+	std::sort(daughters.begin(), daughters.end());
+
+	std::string signature = "(" + std::to_string(ptc->pdg_id()) + " ->";
+	for(auto const & daughter : daughters) {
+		signature += " " + daughter;
+	}
+
+	return signature + ")";
+}
+
+// fills the key particle count, signature and multiplicities of the record. "signature" receives the signature the hash was computed from
+template<typename KeyPredicate>
+void fill_index_record(IndexRecord & record, std::string & signature, HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, KeyPredicate is_key) {
+	std::vector<std::string> keys;
+	record.multiplicity = 0;
+	record.charged_multiplicity = 0;
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		if(is_key(*ip)) {
+			keys.push_back(decay_signature(*ip));
+		}
+		if((*ip)->status() == 1) {
+			++record.multiplicity;
+			if(particles.is_charged((*ip)->pdg_id())) {
+				++record.charged_multiplicity;
+			}
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+
+	signature.clear();
+	for(auto const & key : keys) {
+		signature += (signature.empty() ? "" : " ; ") + key;
+	}
+
+	record.key_count = static_cast<std::uint32_t>(keys.size());
+	record.signature = signature.empty() ? 0 : signature_hash(signature);
+}
+
+#endif // GENERATOR_DECAYSIGNATURE_H
@@ -0,0 +1,115 @@
+/// Per-event memory arena
+/// Hands out memory from a list of big blocks that survive between events. Deallocation is a no-op and the whole arena is rewound at the end of each event in O(1), so once the blocks are warmed up the per-event scratch containers never touch the global heap
+/// Everything allocated from the arena must be destroyed before reset() is called
+
+#ifndef GENERATOR_EVENTARENA_H
+#define GENERATOR_EVENTARENA_H
+
+// STL
+#include <cstddef>
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <new>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <utility>
+
+class EventArena {
+public:
+	explicit EventArena(std::size_t block_size = 64 * 1024) : m_block_size(block_size), m_current(0), m_offset(0), m_upstream_allocations(0) {}
+
+	EventArena(EventArena const &) = delete;
+	EventArena & operator=(EventArena const &) = delete;
+
+	~EventArena() {
+		for(auto & block : m_blocks) {
+			::operator delete(block.data);
+		}
+	}
+
+	// returns a chunk of at least "size" bytes aligned to "alignment" (which must be a power of 2)
+	void * allocate(std::size_t size, std::size_t alignment) {
+		while(m_current < m_blocks.size()) {
+			auto & block = m_blocks[m_current];
+			auto begin = reinterpret_cast<std::uintptr_t>(block.data);
+			auto aligned = (begin + m_offset + alignment - 1) & ~(static_cast<std::uintptr_t>(alignment) - 1);
+			if(aligned + size <= begin + block.size) {
+				m_offset = aligned + size - begin;
+				return reinterpret_cast<void *>(aligned);
+			}
+
+			// the current block is exhausted, moving on to the next one that was kept from previous events
+			++m_current;
+			m_offset = 0;
+		}
+
+		// no block is big enough, so we have to go to the global heap. This should only happen during the first few events
+		auto block_size = std::max(m_block_size, size + alignment);
+		m_blocks.push_back(Block{static_cast<char *>(::operator new(block_size)), block_size});
+		++m_upstream_allocations;
+
+		return allocate(size, alignment);
+	}
+
+	// rewinds the arena. Blocks are kept for the next event
+	void reset() {
+		m_current = 0;
+		m_offset = 0;
+	}
+
+	std::size_t capacity() const {
+		std::size_t total = 0;
+		for(auto const & block : m_blocks) {
+			total += block.size;
+		}
+		return total;
+	}
+
+	std::size_t upstream_allocations() const {return m_upstream_allocations;} // number of blocks requested from the global heap so far
+
+private:
+	struct Block {
+		char * data;
+		std::size_t size;
+	};
+
+	std::size_t m_block_size; // default size of a newly allocated block
+	std::vector<Block> m_blocks;
+	std::size_t m_current; // index of the block we are currently allocating from
+	std::size_t m_offset; // offset of the first free byte in the current block
+	std::size_t m_upstream_allocations;
+};
+
+// STL-compatible allocator drawing from an EventArena. Implicitly constructible from the arena so that containers can be created as "container(arena)"
+template<typename T>
+class ArenaAllocator {
+public:
+	typedef T value_type;
+	template<typename U> struct rebind {typedef ArenaAllocator<U> other;}; // older libstdc++ versions don't go through std::allocator_traits for this
+
+	ArenaAllocator(EventArena & arena) : m_arena(&arena) {}
+	template<typename U> ArenaAllocator(ArenaAllocator<U> const & other) : m_arena(other.arena()) {}
+
+	T * allocate(std::size_t n) {return static_cast<T *>(m_arena->allocate(n * sizeof(T), alignof(T)));}
+	void deallocate(T *, std::size_t) {} // memory is reclaimed all at once by EventArena::reset()
+
+	EventArena * arena() const {return m_arena;}
+
+private:
+	EventArena * m_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(ArenaAllocator<T> const & lhs, ArenaAllocator<U> const & rhs) {return lhs.arena() == rhs.arena();}
+template<typename T, typename U>
+inline bool operator!=(ArenaAllocator<T> const & lhs, ArenaAllocator<U> const & rhs) {return lhs.arena() != rhs.arena();}
+
+// per-event scratch containers
+template<typename T>
+using ArenaUnorderedSet = std::unordered_set<T, std::hash<T>, std::equal_to<T>, ArenaAllocator<T>>;
+template<typename K, typename V>
+using ArenaUnorderedMap = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, ArenaAllocator<std::pair<K const, V>>>;
+
+#endif // GENERATOR_EVENTARENA_H
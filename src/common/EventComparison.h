@@ -0,0 +1,220 @@
+/// Event by event comparison of stored events
+/// Used by the validation harness to check that an optimized path stores the same content as the reference one. Events are compared as plain events (see EventStream.h), so both sides can come from the collections, the stream or a file
+/// Integer fields (event number, PDG ID, status, charge, bits, vertex links) and the numbers of particles and vertices must match exactly. Momenta, masses, vertex positions and ctau must match within |value - reference| <= absolute + relative * |reference|; a zero tolerance asks for identical values
+/// The distributions of particle momenta, vertex displacements and multiplicities over the whole sample are compared as well (Kolmogorov-Smirnov distance), which catches a bias that is small enough to pass the per-event tolerance
+
+#ifndef GENERATOR_EVENTCOMPARISON_H
+#define GENERATOR_EVENTCOMPARISON_H
+
+// Common utilities
+#include "EventStream.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <ostream>
+#include <algorithm>
+
+struct Tolerance {
+	double absolute = 0.;
+	double relative = 0.;
+
+	bool accepts(double value, double reference) const {
+		return std::abs(value - reference) <= absolute + relative * std::abs(reference);
+	}
+};
+
+// values of one quantity over the sample
+class SampleDistribution {
+public:
+	void add(double value) {
+		m_values.push_back(value);
+		m_sorted = false;
+	}
+
+	std::size_t size() const {return m_values.size();}
+
+	double mean() const {
+		double sum = 0.;
+		for(auto value : m_values) {
+			sum += value;
+		}
+
+		return m_values.empty() ? 0. : sum / static_cast<double>(m_values.size());
+	}
+
+	double rms() const {
+		auto const average = mean();
+		double sum = 0.;
+		for(auto value : m_values) {
+			sum += (value - average) * (value - average);
+		}
+
+		return m_values.empty() ? 0. : std::sqrt(sum / static_cast<double>(m_values.size()));
+	}
+
+	// largest difference between the empirical cumulative distributions
+	static double ks_distance(SampleDistribution & a, SampleDistribution & b) {
+		a.sort();
+		b.sort();
+		if(a.m_values.empty() || b.m_values.empty()) {
+			return a.m_values.size() == b.m_values.size() ? 0. : 1.;
+		}
+
+		auto const na = static_cast<double>(a.m_values.size()), nb = static_cast<double>(b.m_values.size());
+		std::size_t ia = 0, ib = 0;
+		double distance = 0.;
+		while(ia < a.m_values.size() && ib < b.m_values.size()) {
+			auto const x = std::min(a.m_values[ia], b.m_values[ib]);
+			while(ia < a.m_values.size() && !(a.m_values[ia] > x)) {
+				++ia;
+			}
+			while(ib < b.m_values.size() && !(b.m_values[ib] > x)) {
+				++ib;
+			}
+			distance = std::max(distance, std::abs(static_cast<double>(ia) / na - static_cast<double>(ib) / nb));
+		}
+
+		return distance;
+	}
+
+private:
+	void sort() {
+		if(!m_sorted) {
+			std::sort(m_values.begin(), m_values.end());
+			m_sorted = true;
+		}
+	}
+
+	std::vector<double> m_values;
+	bool m_sorted = true;
+};
+
+class EventComparison {
+public:
+	// "max_reports" is the number of mismatches kept for the summary
+	EventComparison(std::string const & name, Tolerance const & momentum, Tolerance const & position, std::size_t max_reports = 10) : m_name(name), m_momentum(momentum), m_position(position), m_max_reports(max_reports), m_events(0), m_mismatched(0), m_max_momentum_deviation(0.), m_max_position_deviation(0.) {}
+
+	// false if the candidate doesn't match the reference
+	bool compare(StreamEvent const & reference, StreamEvent const & candidate) {
+		++m_events;
+		fill(reference, m_reference);
+		fill(candidate, m_candidate);
+
+		std::string mismatch;
+		if(candidate.number != reference.number) {
+			mismatch = "event number " + std::to_string(candidate.number);
+		} else if(candidate.vertices.size() != reference.vertices.size()) {
+			mismatch = std::to_string(candidate.vertices.size()) + " vertices instead of " + std::to_string(reference.vertices.size());
+		} else if(candidate.particles.size() != reference.particles.size()) {
+			mismatch = std::to_string(candidate.particles.size()) + " particles instead of " + std::to_string(reference.particles.size());
+		}
+
+		for(std::size_t i = 0; i < reference.vertices.size() && mismatch.empty(); ++i) {
+			auto const & r = reference.vertices[i];
+			auto const & c = candidate.vertices[i];
+			if(!position_matches(c.x, r.x) || !position_matches(c.y, r.y) || !position_matches(c.z, r.z) || !position_matches(c.ctau, r.ctau)) {
+				std::ostringstream message;
+				message.precision(17);
+				message << "vertex " << i << " at (" << c.x << ", " << c.y << ", " << c.z << ", " << c.ctau << ") instead of (" << r.x << ", " << r.y << ", " << r.z << ", " << r.ctau << ")";
+				mismatch = message.str();
+			}
+		}
+
+		for(std::size_t i = 0; i < reference.particles.size() && mismatch.empty(); ++i) {
+			auto const & r = reference.particles[i];
+			auto const & c = candidate.particles[i];
+			if(c.pdg != r.pdg || c.status != r.status || c.charge != r.charge || c.bits != r.bits || c.start_vertex != r.start_vertex || c.end_vertex != r.end_vertex) {
+				std::ostringstream message;
+				message << "particle " << i << ": PDG ID " << c.pdg << ", status " << c.status << ", charge " << c.charge << ", bits " << c.bits << ", vertices " << c.start_vertex << " -> " << c.end_vertex
+				        << " instead of " << r.pdg << ", " << r.status << ", " << r.charge << ", " << r.bits << ", " << r.start_vertex << " -> " << r.end_vertex;
+				mismatch = message.str();
+			} else if(!momentum_matches(c.px, r.px) || !momentum_matches(c.py, r.py) || !momentum_matches(c.pz, r.pz) || !momentum_matches(c.mass, r.mass)) {
+				std::ostringstream message;
+				message.precision(17);
+				message << "particle " << i << " (" << r.pdg << ") with (" << c.px << ", " << c.py << ", " << c.pz << ", " << c.mass << ") instead of (" << r.px << ", " << r.py << ", " << r.pz << ", " << r.mass << ")";
+				mismatch = message.str();
+			}
+		}
+
+		if(mismatch.empty()) {
+			return true;
+		}
+
+		++m_mismatched;
+		if(m_reports.size() < m_max_reports) {
+			m_reports.push_back("event " + std::to_string(reference.number) + ": " + mismatch);
+		}
+		return false;
+	}
+
+	std::string const & name() const {return m_name;}
+	std::size_t events() const {return m_events;}
+	std::size_t mismatched() const {return m_mismatched;}
+
+	// largest Kolmogorov-Smirnov distance of the sample distributions
+	double ks_distance() {
+		return std::max({SampleDistribution::ks_distance(m_reference.momentum, m_candidate.momentum), SampleDistribution::ks_distance(m_reference.displacement, m_candidate.displacement), SampleDistribution::ks_distance(m_reference.multiplicity, m_candidate.multiplicity)});
+	}
+
+	void print(std::ostream & os) {
+		os << m_name << ": " << m_events - m_mismatched << " of " << m_events << " events match. Largest deviation: momentum " << m_max_momentum_deviation << " GeV, position " << m_max_position_deviation << " mm" << std::endl;
+		print(os, "momentum", "GeV", m_reference.momentum, m_candidate.momentum);
+		print(os, "vertex displacement", "mm", m_reference.displacement, m_candidate.displacement);
+		print(os, "multiplicity", "", m_reference.multiplicity, m_candidate.multiplicity);
+		for(auto const & report : m_reports) {
+			os << "\t" << report << std::endl;
+		}
+		if(m_mismatched > m_reports.size()) {
+			os << "\t... and " << m_mismatched - m_reports.size() << " more" << std::endl;
+		}
+	}
+
+private:
+	struct Distributions {
+		SampleDistribution momentum; // GeV, per particle
+		SampleDistribution displacement; // mm, per vertex
+		SampleDistribution multiplicity; // per event
+	};
+
+	static void fill(StreamEvent const & event, Distributions & distributions) {
+		for(auto const & ptc : event.particles) {
+			distributions.momentum.add(std::sqrt(ptc.px * ptc.px + ptc.py * ptc.py + ptc.pz * ptc.pz));
+		}
+		for(auto const & vtx : event.vertices) {
+			distributions.displacement.add(std::sqrt(vtx.x * vtx.x + vtx.y * vtx.y + vtx.z * vtx.z));
+		}
+		distributions.multiplicity.add(static_cast<double>(event.particles.size()));
+	}
+
+	static void print(std::ostream & os, std::string const & quantity, std::string const & unit, SampleDistribution & reference, SampleDistribution & candidate) {
+		os << "\t" << quantity << ": mean " << candidate.mean() << " (reference " << reference.mean() << ")" << (unit.empty() ? "" : " " + unit) << ", rms " << candidate.rms() << " (reference " << reference.rms() << "), KS distance " << SampleDistribution::ks_distance(reference, candidate) << std::endl;
+	}
+
+	bool momentum_matches(double value, double reference) {
+		m_max_momentum_deviation = std::max(m_max_momentum_deviation, std::abs(value - reference));
+		return m_momentum.accepts(value, reference);
+	}
+
+	bool position_matches(double value, double reference) {
+		m_max_position_deviation = std::max(m_max_position_deviation, std::abs(value - reference));
+		return m_position.accepts(value, reference);
+	}
+
+	std::string m_name;
+	Tolerance m_momentum; // momenta and masses, GeV
+	Tolerance m_position; // positions and ctau, mm
+	std::size_t m_max_reports;
+	std::size_t m_events;
+	std::size_t m_mismatched;
+	double m_max_momentum_deviation;
+	double m_max_position_deviation;
+	std::vector<std::string> m_reports;
+	Distributions m_reference;
+	Distributions m_candidate;
+};
+
+#endif // GENERATOR_EVENTCOMPARISON_H
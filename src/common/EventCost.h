@@ -0,0 +1,197 @@
+/// CPU cost of every event and capture of slow events
+/// EventCost measures the CPU time of the event loop thread (CLOCK_THREAD_CPUTIME_ID, so the status reporter and ROOT's threads don't count) spent in every stage of the current event, and passes the wall time of the stages on to the job status (see StatusReporter.h)
+/// LatencyHistogram keeps the distribution of the total CPU time per event with 10 logarithmic bins per decade between 1 us and 1000 s, from which percentiles are estimated (to the upper edge of their bin, at most the slowest event)
+/// SlowEventLog writes the events above a percentile of the distribution so far, with the seed they were generated with. With per-event seeding (event_seed) every event starts from its own random state, so a slow event can be regenerated and profiled on its own from its seed
+
+#ifndef GENERATOR_EVENTCOST_H
+#define GENERATOR_EVENTCOST_H
+
+// Common utilities
+#include "StatusReporter.h"
+#include "Histogram.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <ostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+// POSIX
+#include <time.h>
+
+// CPU time of the calling thread in seconds
+inline double thread_cpu_seconds() {
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+	return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) * 1e-9;
+}
+
+// seed of event "index" of a run with seed "run_seed", in the range PYTHIA accepts (1 to 900000000). Neighbouring indices give unrelated seeds (splitmix64 mixing)
+inline int event_seed(int run_seed, std::uint64_t index) {
+	auto x = (static_cast<std::uint64_t>(run_seed) << 32) + index + 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+
+	return static_cast<int>(x % 900000000ULL) + 1;
+}
+
+class EventCost {
+public:
+	explicit EventCost(JobStatus & status) : m_status(status), m_cpu(0.) {
+		for(int stage = 0; stage < JobStatus::nstages; ++stage) {
+			m_stage_cpu[stage] = 0.;
+			m_run_cpu[stage] = 0.;
+		}
+	}
+
+	// called at the beginning of every event
+	void start() {
+		m_wall = JobStatus::Clock::now();
+		m_wall_start = m_wall;
+		m_cpu = thread_cpu_seconds();
+		for(auto & cpu : m_stage_cpu) {
+			cpu = 0.;
+		}
+	}
+
+	// ends the stage: its CPU time goes to the event, its wall time to the job status
+	void lap(JobStatus::Stage stage) {
+		m_wall = m_status.add_time(stage, m_wall);
+		auto const cpu = thread_cpu_seconds();
+		m_stage_cpu[stage] += cpu - m_cpu;
+		m_run_cpu[stage] += cpu - m_cpu;
+		m_cpu = cpu;
+	}
+
+	double cpu(JobStatus::Stage stage) const {return m_stage_cpu[stage];} // CPU time of the stage in the current event
+	double run_cpu(JobStatus::Stage stage) const {return m_run_cpu[stage];} // CPU time of the stage in the whole run
+
+	// wall time of the current event up to the end of its last stage
+	double wall() const {return std::chrono::duration<double>(m_wall - m_wall_start).count();}
+
+	// CPU time of the current event
+	double total() const {
+		double sum = 0.;
+		for(auto cpu : m_stage_cpu) {
+			sum += cpu;
+		}
+
+		return sum;
+	}
+
+private:
+	JobStatus & m_status;
+	JobStatus::Clock::time_point m_wall_start; // beginning of the event
+	JobStatus::Clock::time_point m_wall; // end of the last stage
+	double m_cpu; // CPU time at the end of the last stage
+	double m_stage_cpu[JobStatus::nstages];
+	double m_run_cpu[JobStatus::nstages];
+};
+
+class LatencyHistogram {
+public:
+	LatencyHistogram() : m_histogram("log10(cpu seconds)", 90, -6., 3.), m_max(0.) {}
+
+	void fill(double seconds) {
+		m_histogram.fill(std::log10(std::max(seconds, 1e-9)));
+		m_max = std::max(m_max, seconds);
+	}
+
+	std::size_t entries() const {return m_histogram.entries();}
+	double max() const {return m_max;}
+
+	// upper edge of the bin holding the quantile q (0 to 1) of the filled times, in seconds
+	double quantile(double q) const {
+		auto const target = q * m_histogram.sum_weights();
+		auto sum = m_histogram.underflow();
+		if(!(sum < target) && sum > 0.) {
+			return std::pow(10., m_histogram.low());
+		}
+		for(std::size_t i = 0; i < m_histogram.nbins(); ++i) {
+			sum += m_histogram.content(i);
+			if(!(sum < target)) {
+				return std::min(std::pow(10., m_histogram.bin_low(i + 1)), m_max);
+			}
+		}
+
+		return m_max;
+	}
+
+	// percentiles and the non empty bins with the cumulative fraction of events
+	void print(std::ostream & os) const {
+		os << "CPU time per event: " << entries() << " events, median " << quantile(0.5) << " s, 90% " << quantile(0.9) << " s, 99% " << quantile(0.99) << " s, max " << m_max << " s" << std::endl;
+
+		auto const total = m_histogram.sum_weights();
+		auto sum = m_histogram.underflow();
+		if(sum > 0.) {
+			os << "\t" << std::setw(10) << "< 1e-06 s " << std::setw(12) << sum << std::endl;
+		}
+		for(std::size_t i = 0; i < m_histogram.nbins(); ++i) {
+			if(m_histogram.content(i) > 0.) {
+				sum += m_histogram.content(i);
+				os << "\t" << std::setw(10) << std::pow(10., m_histogram.bin_low(i + 1)) << " s " << std::setw(12) << m_histogram.content(i) << " (" << std::setprecision(4) << 100. * sum / total << std::setprecision(6) << "% below)" << std::endl;
+			}
+		}
+		if(m_histogram.overflow() > 0.) {
+			os << "\t" << std::setw(10) << ">= 1000 s " << std::setw(12) << m_histogram.overflow() << std::endl;
+		}
+	}
+
+private:
+	Histogram m_histogram; // log10 of the time in seconds
+	double m_max;
+};
+
+class SlowEventLog {
+public:
+	// events above "percentile" (0 to 100) of the distribution are logged once "warmup" events have been measured
+	SlowEventLog(std::string const & filename, double percentile, std::size_t warmup = 100) : m_file(filename), m_filename(filename), m_quantile(percentile / 100.), m_warmup(warmup), m_events(0) {
+		if(!m_file) {
+			throw std::runtime_error("Unable to open slow event log \"" + filename + "\"");
+		}
+		if(!(percentile > 0.) || percentile > 100.) {
+			throw std::invalid_argument("The slow event percentile must be between 0 and 100");
+		}
+
+		m_file << "# index seed cpu_seconds";
+		for(int stage = 0; stage < JobStatus::nstages; ++stage) {
+			m_file << ' ' << JobStatus::stage_name(static_cast<JobStatus::Stage>(stage));
+		}
+		m_file << " stored_event" << std::endl;
+	}
+
+	// logs the event if it is slow. "index" is the index of the generation attempt, "stored_event" the number of the stored event or 0
+	bool check(std::size_t index, int seed, EventCost const & cost, LatencyHistogram const & latency, std::size_t stored_event) {
+		if(latency.entries() < m_warmup || !(cost.total() > latency.quantile(m_quantile))) {
+			return false;
+		}
+
+		m_file << index << ' ' << seed << ' ' << cost.total();
+		for(int stage = 0; stage < JobStatus::nstages; ++stage) {
+			m_file << ' ' << cost.cpu(static_cast<JobStatus::Stage>(stage));
+		}
+		m_file << ' ' << stored_event << '\n';
+		++m_events;
+
+		return true;
+	}
+
+	std::string const & filename() const {return m_filename;}
+	std::size_t events() const {return m_events;}
+
+private:
+	std::ofstream m_file;
+	std::string m_filename;
+	double m_quantile;
+	std::size_t m_warmup;
+	std::size_t m_events;
+};
+
+#endif // GENERATOR_EVENTCOST_H
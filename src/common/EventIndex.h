@@ -0,0 +1,183 @@
+/// Sidecar index of the stored events
+/// One fixed size record per stored event, so that a sub-sample can be selected (by key particle, decay signature or multiplicity) without reading the event data. Written next to the output as stem.index, with a text dictionary stem.signatures mapping signature hashes to the decay signatures they were computed from (see DecaySignature.h)
+/// Signature hashes are written and given on the command line in hexadecimal with a 0x prefix, so that they can't be mistaken for a signature made of digits only (a key particle that doesn't decay, e.g. "511")
+/// Format (native byte order): 8 byte magic "FCCGIDX1", uint32 record size, uint32 reserved, then the records as laid out in IndexRecord
+/// Uses the standard library only, so that the query tool doesn't depend on the generator stack
+
+#ifndef GENERATOR_EVENTINDEX_H
+#define GENERATOR_EVENTINDEX_H
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+
+// 8 byte fields first, so that the layout has no padding
+struct IndexRecord {
+	std::uint64_t entry; // entry in the shard (ROOT output) or event number in the stream
+	std::uint64_t signature; // hash of the decay signature of the key particles, 0 if there is none
+	std::uint64_t bytes_before; // output written before the event. Stream: byte offset of the frame, which can be seeked to. ROOT output: uncompressed bytes of the preceding entries of the shard, a measure of the data to skip but not a file position (entries are compressed in baskets), so the event is read by its entry
+	std::int32_t event_number; // EventInfo number
+	std::uint32_t shard; // index of the output file, see the shard manifest. Always 0 if the output is not sharded
+	std::int32_t key_pdg; // PDG ID of the key particle
+	std::uint32_t key_count; // number of key particles in the event
+	std::uint32_t multiplicity; // number of stable particles
+	std::uint32_t charged_multiplicity; // number of stable charged particles
+};
+
+static_assert(sizeof(IndexRecord) == 48, "IndexRecord must have no padding");
+
+namespace event_index {
+	char const magic[8] = {'F', 'C', 'C', 'G', 'I', 'D', 'X', '1'};
+
+	// index and signature dictionary file names for the given output file name
+	inline std::string stem(std::string const & filename) {
+		auto dot = filename.rfind('.');
+		auto slash = filename.rfind('/');
+		if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			dot = filename.size();
+		}
+
+		return filename.substr(0, dot);
+	}
+	inline std::string index_filename(std::string const & filename) {return stem(filename) + ".index";}
+	inline std::string signatures_filename(std::string const & filename) {return stem(filename) + ".signatures";}
+}
+
+// 64 bit FNV-1a hash of a decay signature
+inline std::uint64_t signature_hash(std::string const & signature) {
+	std::uint64_t hash = 14695981039346656037ull;
+	for(auto c : signature) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+// a signature hash as it is listed: hexadecimal with a 0x prefix
+inline std::string format_signature_hash(std::uint64_t hash) {
+	char text[19];
+	std::snprintf(text, sizeof(text), "0x%llx", static_cast<unsigned long long>(hash));
+
+	return text;
+}
+
+// a signature as given on the command line: a hash with a 0x prefix, or the signature text
+inline std::uint64_t parse_signature(std::string const & signature) {
+	if(signature.size() > 2 && signature[0] == '0' && (signature[1] == 'x' || signature[1] == 'X')) {
+		auto const digits = signature.substr(2);
+		if(digits.size() > 16 || digits.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos) {
+			throw std::invalid_argument("Invalid signature hash \"" + signature + "\", expected 0x followed by up to 16 hexadecimal digits");
+		}
+
+		return std::stoull(digits, nullptr, 16);
+	}
+
+	return signature_hash(signature);
+}
+
+class EventIndexWriter {
+public:
+	// "filename" is the output file name, the index files are named after it
+	explicit EventIndexWriter(std::string const & filename) : m_index_filename(event_index::index_filename(filename)), m_signatures_filename(event_index::signatures_filename(filename)), m_file(std::fopen(m_index_filename.c_str(), "wb")), m_records(0) {
+		if(!m_file) {
+			throw std::runtime_error("Unable to open index file " + m_index_filename);
+		}
+
+		std::uint32_t const header[2] = {sizeof(IndexRecord), 0};
+		if(std::fwrite(event_index::magic, sizeof(event_index::magic), 1, m_file) != 1 || std::fwrite(header, sizeof(header), 1, m_file) != 1) {
+			throw std::runtime_error("Unable to write index file " + m_index_filename);
+		}
+	}
+
+	EventIndexWriter(EventIndexWriter const &) = delete;
+	EventIndexWriter & operator=(EventIndexWriter const &) = delete;
+
+	~EventIndexWriter() {
+		close();
+	}
+
+	void add(IndexRecord const & record, std::string const & signature) {
+		if(std::fwrite(&record, sizeof(record), 1, m_file) != 1) {
+			throw std::runtime_error("Unable to write index file " + m_index_filename);
+		}
+		if(record.signature != 0) {
+			m_signatures.emplace(record.signature, signature);
+		}
+		++m_records;
+	}
+
+	// closes the index and writes the signature dictionary
+	void close() {
+		if(!m_file) {
+			return;
+		}
+
+		std::fclose(m_file);
+		m_file = nullptr;
+
+		std::ofstream signatures(m_signatures_filename);
+		signatures << "# hash signature" << std::endl;
+		for(auto const & signature : m_signatures) {
+			signatures << format_signature_hash(signature.first) << ' ' << signature.second << std::endl;
+		}
+	}
+
+	std::size_t records() const {return m_records;}
+	std::string const & index_filename() const {return m_index_filename;}
+
+private:
+	std::string m_index_filename;
+	std::string m_signatures_filename;
+	std::FILE * m_file;
+	std::size_t m_records;
+	std::unordered_map<std::uint64_t, std::string> m_signatures;
+};
+
+// reads the whole index. The records are small, a million events take 48 MB
+inline std::vector<IndexRecord> read_index(std::string const & index_filename) {
+	std::ifstream file(index_filename, std::ios::binary);
+	char magic[sizeof(event_index::magic)];
+	std::uint32_t header[2] = {0, 0};
+	if(!file.read(magic, sizeof(magic)) || std::memcmp(magic, event_index::magic, sizeof(magic)) != 0 || !file.read(reinterpret_cast<char *>(header), sizeof(header))) {
+		throw std::runtime_error(index_filename + " is not an event index");
+	}
+	if(header[0] != sizeof(IndexRecord)) {
+		throw std::runtime_error(index_filename + " was written with a different record layout");
+	}
+
+	std::vector<IndexRecord> records;
+	IndexRecord record;
+	while(file.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+		records.push_back(record);
+	}
+
+	return records;
+}
+
+// reads the signature dictionary: hash -> signature
+inline std::unordered_map<std::uint64_t, std::string> read_signatures(std::string const & signatures_filename) {
+	std::unordered_map<std::uint64_t, std::string> signatures;
+
+	std::ifstream file(signatures_filename);
+	std::string line;
+	while(std::getline(file, line)) {
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		auto space = line.find(' ');
+		signatures.emplace(std::stoull(line.substr(0, space), nullptr, 16), space == std::string::npos ? "" : line.substr(space + 1)); // with or without the 0x prefix, as older dictionaries
+	}
+
+	return signatures;
+}
+
+#endif // GENERATOR_EVENTINDEX_H
@@ -0,0 +1,252 @@
+/// Offline selection of stored events
+/// Works on the plain event structures of EventStream.h, which the skim tool decodes the GenParticle and GenVertex collections into, and applies the same logic as the generators:
+/// 	key particle: a particle with the key PDG ID (either charge) that is not the result of an oscillation, i.e. not the only particle produced in the decay of its antiparticle
+/// 	decay signature of the event, as defined in DecaySignature.h, so the hashes listed by index-query can be used directly
+/// 	minimum number of charged tracks (pions, kaons, protons, electrons and muons) among the stable descendants of a key particle, as counted by generator-inclusive
+/// 	acceptance cuts on the stable charged descendants of a key particle, as applied by the acceptance pre-filter of the generator
+/// An event is selected if its signature matches and at least one of its key particles passes the track and acceptance cuts
+/// The acceptance cuts look up the transverse and absolute momenta that EventTopology computes for the whole event with the kernels of ParticleBatch.h
+/// EventSelection keeps no state between events, so a single instance is shared by all the threads of the skim; each thread brings its own EventTopology
+/// With a Cutflow, the steps in use (key particle, charged tracks and acceptance, signature) are recorded in it. Its counters are per thread, so the sharing threads don't contend on them
+
+#ifndef GENERATOR_EVENTSELECTION_H
+#define GENERATOR_EVENTSELECTION_H
+
+// Common utilities
+#include "AcceptanceCuts.h"
+#include "EventIndex.h"
+#include "EventStream.h"
+#include "Cutflow.h"
+#include "ParticleTable.h"
+#include "ParticleBatch.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// particles entering and leaving each vertex of an event. The stored collections only link particles to vertices, so this is what makes walking a decay tree cheap. Kept between events to avoid reallocations
+class EventTopology {
+public:
+	void build(StreamEvent const & event) {
+		auto const nvertices = event.vertices.size();
+		resize(m_incoming, nvertices);
+		resize(m_outgoing, nvertices);
+
+		for(std::size_t i = 0; i < event.particles.size(); ++i) {
+			auto const & ptc = event.particles[i];
+			if(ptc.start_vertex >= 0 && static_cast<std::size_t>(ptc.start_vertex) < nvertices) {
+				m_outgoing[static_cast<std::size_t>(ptc.start_vertex)].push_back(i);
+			}
+			if(ptc.end_vertex >= 0 && static_cast<std::size_t>(ptc.end_vertex) < nvertices) {
+				m_incoming[static_cast<std::size_t>(ptc.end_vertex)].push_back(i);
+			}
+		}
+	}
+
+	// particles produced in the decay of the particle
+	std::vector<std::size_t> const & daughters(StreamParticle const & ptc) const {return ptc.end_vertex >= 0 && static_cast<std::size_t>(ptc.end_vertex) < m_outgoing.size() ? m_outgoing[static_cast<std::size_t>(ptc.end_vertex)] : m_none;}
+	// particles whose decay produced the particle
+	std::vector<std::size_t> const & mothers(StreamParticle const & ptc) const {return ptc.start_vertex >= 0 && static_cast<std::size_t>(ptc.start_vertex) < m_incoming.size() ? m_incoming[static_cast<std::size_t>(ptc.start_vertex)] : m_none;}
+
+	std::vector<std::size_t> & stack() {return m_stack;}
+
+	// transverse and absolute momenta of all the particles of the event, for the acceptance cuts
+	void compute_kinematics(StreamEvent const & event) {
+		fill_batch(m_batch, event);
+		compute_pt(m_batch, m_pt);
+		compute_p(m_batch, m_p);
+	}
+
+	double pt(std::size_t i) const {return m_pt[i];} // GeV, valid after compute_kinematics
+	double p(std::size_t i) const {return m_p[i];}
+
+private:
+	// clears the lists without giving their memory back
+	static void resize(std::vector<std::vector<std::size_t>> & lists, std::size_t size) {
+		if(lists.size() < size) {
+			lists.resize(size);
+		}
+		for(auto & list : lists) {
+			list.clear();
+		}
+	}
+
+	std::vector<std::vector<std::size_t>> m_incoming; // by vertex
+	std::vector<std::vector<std::size_t>> m_outgoing; // by vertex
+	std::vector<std::size_t> m_none;
+	std::vector<std::size_t> m_stack; // decay tree walk
+	ParticleBatch m_batch;
+	std::vector<double> m_pt, m_p; // by particle
+};
+
+// same convention as decay_signature in DecaySignature.h
+inline std::string decay_signature(StreamEvent const & event, EventTopology const & topology, std::size_t i) {
+	auto const & ptc = event.particles[i];
+	auto const & products = topology.daughters(ptc);
+	if(products.empty()) {
+		return std::to_string(ptc.pdg);
+	}
+
+	std::vector<std::string> daughters;
+	for(auto d : products) {
+		if(event.particles[d].pdg != 22 || products.size() == 1) {
+			daughters.push_back(decay_signature(event, topology, d));
+		}
+	}
+	std::sort(daughters.begin(), daughters.end());
+
+	std::string signature = "(" + std::to_string(ptc.pdg) + " ->";
+	for(auto const & daughter : daughters) {
+		signature += " " + daughter;
+	}
+
+	return signature + ")";
+}
+
+// key particle that is not the result of an oscillation. Same as isBAtProduction of the generators for B0 and Bs, and extended to every key particle like the acceptance filter does
+inline bool is_key_at_production(StreamEvent const & event, EventTopology const & topology, std::size_t i, int key_pdg) {
+	auto const & ptc = event.particles[i];
+	if(std::abs(ptc.pdg) != key_pdg) {
+		return false;
+	}
+
+	auto const & mothers = topology.mothers(ptc);
+	return !(mothers.size() == 1 && event.particles[mothers.front()].pdg == -ptc.pdg && topology.daughters(event.particles[mothers.front()]).size() == 1);
+}
+
+// signature of the event: sorted signatures of its key particles joined with " ; ", as written to the event index. The topology must be built for the event
+inline std::string event_signature(StreamEvent const & event, EventTopology const & topology, int key_pdg) {
+	std::vector<std::string> keys;
+	for(std::size_t i = 0; i < event.particles.size(); ++i) {
+		if(is_key_at_production(event, topology, i, key_pdg)) {
+			keys.push_back(decay_signature(event, topology, i));
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+
+	std::string signature;
+	for(auto const & key : keys) {
+		signature += (signature.empty() ? "" : " ; ") + key;
+	}
+
+	return signature;
+}
+
+struct SelectionCuts {
+	int key_pdg = 0; // 0 selects every event
+	std::uint64_t signature = 0; // hash of the required event signature, 0 means any
+	std::size_t min_charged_tracks = 0;
+	AcceptanceCuts acceptance;
+};
+
+class EventSelection {
+public:
+	// the steps are registered in "cutflow" (if any), which has to outlive the selection
+	explicit EventSelection(SelectionCuts const & cuts, Cutflow * cutflow = nullptr) : m_cuts(cuts), m_cutflow(cutflow), m_key_step(0), m_tracks_step(0), m_signature_step(0) {
+		if(m_cutflow && m_cuts.key_pdg != 0) {
+			m_key_step = m_cutflow->add("key particle");
+			if(has_track_cuts()) {
+				m_tracks_step = m_cutflow->add("charged tracks, acceptance");
+			}
+			if(m_cuts.signature != 0) {
+				m_signature_step = m_cutflow->add("signature");
+			}
+		}
+	}
+
+	bool select(StreamEvent const & event, EventTopology & topology) const {
+		if(m_cuts.key_pdg == 0) {
+			return true;
+		}
+
+		auto start = Cutflow::Clock::now();
+		topology.build(event);
+
+		auto first_key = event.particles.size();
+		for(std::size_t i = 0; i < event.particles.size(); ++i) {
+			if(is_key_at_production(event, topology, i, m_cuts.key_pdg)) {
+				first_key = i;
+				break;
+			}
+		}
+		if(!step(m_key_step, first_key < event.particles.size(), start)) {
+			return false;
+		}
+
+		if(has_track_cuts()) {
+			if(m_cuts.acceptance.enabled()) {
+				topology.compute_kinematics(event);
+			}
+
+			bool key_passed = false;
+			for(auto i = first_key; i < event.particles.size() && !key_passed; ++i) {
+				key_passed = is_key_at_production(event, topology, i, m_cuts.key_pdg) && passes(event, topology, i);
+			}
+			if(!step(m_tracks_step, key_passed, start)) {
+				return false;
+			}
+		}
+
+		return m_cuts.signature == 0 || step(m_signature_step, signature_hash(event_signature(event, topology, m_cuts.key_pdg)) == m_cuts.signature, start);
+	}
+
+	SelectionCuts const & cuts() const {return m_cuts;}
+
+private:
+	// the skim has no PYTHIA, so only the properties that follow from the PDG ID are known
+	static ParticleTable const & particles() {
+		static ParticleTable const table;
+		return table;
+	}
+
+	bool has_track_cuts() const {return m_cuts.min_charged_tracks > 0 || m_cuts.acceptance.enabled();}
+
+	// records the step in the cutflow, if any. "start" moves on to the end of the step
+	bool step(std::size_t id, bool passed, Cutflow::Clock::time_point & start) const {
+		if(m_cutflow) {
+			start = m_cutflow->record(id, passed, start);
+		}
+
+		return passed;
+	}
+
+	// charged track and acceptance cuts on the stable descendants of the key particle
+	bool passes(StreamEvent const & event, EventTopology & topology, std::size_t key) const {
+		std::size_t tracks = 0;
+		auto & stack = topology.stack();
+		stack.clear();
+		stack.push_back(key);
+		while(!stack.empty()) {
+			auto const index = stack.back();
+			auto const & ptc = event.particles[index];
+			stack.pop_back();
+
+			if(ptc.status == 1) {
+				if(particles().is_charged_track(ptc.pdg)) {
+					++tracks;
+				}
+				if(ptc.charge != 0 && m_cuts.acceptance.enabled() && m_cuts.acceptance.first_failed_cut_pt_p(topology.pt(index), topology.p(index), ptc.pz) != AcceptanceCuts::ncuts) {
+					return false;
+				}
+				continue;
+			}
+
+			auto const & daughters = topology.daughters(ptc);
+			stack.insert(stack.end(), daughters.begin(), daughters.end());
+		}
+
+		return tracks >= m_cuts.min_charged_tracks;
+	}
+
+	SelectionCuts m_cuts;
+	Cutflow * m_cutflow;
+	std::size_t m_key_step;
+	std::size_t m_tracks_step;
+	std::size_t m_signature_step;
+};
+
+#endif // GENERATOR_EVENTSELECTION_H
@@ -0,0 +1,363 @@
+/// Streaming output of stored events to a pipe, a FIFO or a Unix domain socket, and the matching reader
+/// Lets a downstream consumer (e.g. the fast simulation) process events while they are generated, without an intermediate ROOT file
+/// Destinations and sources:
+/// 	"-" - standard output (writer) or standard input (reader). The writer moves the original standard output to a private descriptor and points descriptor 1 to standard error, so that the log output of the generator, PYTHIA and EvtGen can't end up in the stream
+/// 	"unix:PATH" - Unix domain socket. The reader listens on PATH and accepts a single producer, the writer connects to it
+/// 	anything else - a file or a FIFO
+/// Writes are blocking, so a slow consumer slows the generation down instead of events piling up in memory
+/// Format (native byte order, the stream is meant for consumers on the same node):
+/// 	header: 8 byte magic "FCCGEVS1", uint32 byte order mark 0x01020304
+/// 	frame: uint32 payload size, then the payload
+/// 	payload: int32 event number, uint32 number of vertices, uint32 number of particles, vertices, particles
+/// 	vertex: double x, y, z (mm), ctau (mm)
+/// 	particle: int32 PDG ID, status, charge, uint32 bits, double px, py, pz, mass (GeV), int32 indices of production and decay vertices (-1 if there is none)
+
+#ifndef GENERATOR_EVENTSTREAM_H
+#define GENERATOR_EVENTSTREAM_H
+
+// Data model
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+#include "datamodel/GenVertexCollection.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+
+// POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace event_stream {
+	char const magic[8] = {'F', 'C', 'C', 'G', 'E', 'V', 'S', '1'};
+	std::uint32_t const byte_order_mark = 0x01020304;
+
+	std::size_t const vertex_bytes = 4 * sizeof(double);
+	std::size_t const particle_bytes = 4 * sizeof(std::int32_t) + 4 * sizeof(double) + 2 * sizeof(std::int32_t);
+
+	inline std::runtime_error system_error(std::string const & what) {
+		return std::runtime_error(what + ": " + std::strerror(errno));
+	}
+
+	// connects to (or, if "listen" is set, creates and accepts a single connection on) the Unix domain socket
+	inline int open_socket(std::string const & path, bool listen) {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(address.sun_path)) {
+			throw std::invalid_argument("Socket path \"" + path + "\" is too long");
+		}
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0) {
+			throw system_error("Unable to create socket");
+		}
+
+		if(listen) {
+			::unlink(path.c_str()); // a socket left behind by a previous run
+			if(::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || ::listen(fd, 1) < 0) {
+				::close(fd);
+				throw system_error("Unable to listen on socket \"" + path + "\"");
+			}
+
+			int connection = ::accept(fd, nullptr, nullptr);
+			::close(fd);
+			::unlink(path.c_str());
+			if(connection < 0) {
+				throw system_error("Unable to accept connection on socket \"" + path + "\"");
+			}
+
+			return connection;
+		}
+
+		if(::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0) {
+			::close(fd);
+			throw system_error("Unable to connect to socket \"" + path + "\"");
+		}
+
+		return fd;
+	}
+
+	inline bool is_socket(std::string const & name) {return name.compare(0, 5, "unix:") == 0;}
+
+	template<typename T>
+	void put(std::vector<char> & buffer, T value) {
+		auto size = buffer.size();
+		buffer.resize(size + sizeof(T));
+		std::memcpy(buffer.data() + size, &value, sizeof(T));
+	}
+
+	template<typename T>
+	T get(std::vector<char> const & buffer, std::size_t & offset) {
+		if(offset + sizeof(T) > buffer.size()) {
+			throw std::runtime_error("Malformed event stream frame");
+		}
+
+		T value;
+		std::memcpy(&value, buffer.data() + offset, sizeof(T));
+		offset += sizeof(T);
+
+		return value;
+	}
+}
+
+class EventStreamWriter {
+public:
+	explicit EventStreamWriter(std::string const & destination) : m_fd(-1), m_events(0), m_bytes(0) {
+		std::signal(SIGPIPE, SIG_IGN); // a consumer that went away is reported as an error of write() instead of killing the process
+
+		if(destination == "-") {
+			std::cout.flush();
+			m_fd = ::dup(STDOUT_FILENO);
+			if(m_fd < 0 || ::dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+				throw event_stream::system_error("Unable to redirect standard output");
+			}
+		} else if(event_stream::is_socket(destination)) {
+			m_fd = event_stream::open_socket(destination.substr(5), false);
+		} else {
+			m_fd = ::open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644); // blocks until a reader opens the FIFO
+			if(m_fd < 0) {
+				throw event_stream::system_error("Unable to open \"" + destination + "\"");
+			}
+		}
+
+		m_buffer.assign(event_stream::magic, event_stream::magic + sizeof(event_stream::magic));
+		event_stream::put(m_buffer, event_stream::byte_order_mark);
+		write_buffer();
+	}
+
+	EventStreamWriter(EventStreamWriter const &) = delete;
+	EventStreamWriter & operator=(EventStreamWriter const &) = delete;
+
+	~EventStreamWriter() {
+		close();
+	}
+
+	// serializes the event and sends it. Returns once the whole frame has been handed over to the consumer (or the pipe buffer)
+	void write_event(int number, fcc::MCParticleCollection const & pcoll, fcc::GenVertexCollection const & vcoll) {
+		m_buffer.clear();
+		event_stream::put<std::uint32_t>(m_buffer, 0); // payload size, filled in below
+		event_stream::put<std::int32_t>(m_buffer, number);
+		event_stream::put(m_buffer, static_cast<std::uint32_t>(vcoll.size()));
+		event_stream::put(m_buffer, static_cast<std::uint32_t>(pcoll.size()));
+
+		for(auto const & vtx : vcoll) {
+			auto const & pos = vtx.Position();
+			event_stream::put(m_buffer, static_cast<double>(pos.X));
+			event_stream::put(m_buffer, static_cast<double>(pos.Y));
+			event_stream::put(m_buffer, static_cast<double>(pos.Z));
+			event_stream::put(m_buffer, static_cast<double>(vtx.Ctau()));
+		}
+
+		for(auto const & ptc : pcoll) {
+			auto const & core = ptc.Core();
+			event_stream::put<std::int32_t>(m_buffer, core.Type);
+			event_stream::put<std::int32_t>(m_buffer, core.Status);
+			event_stream::put<std::int32_t>(m_buffer, core.Charge);
+			event_stream::put<std::uint32_t>(m_buffer, core.Bits);
+			event_stream::put(m_buffer, static_cast<double>(core.P4.Px));
+			event_stream::put(m_buffer, static_cast<double>(core.P4.Py));
+			event_stream::put(m_buffer, static_cast<double>(core.P4.Pz));
+			event_stream::put(m_buffer, static_cast<double>(core.P4.Mass));
+			// vertices are stored in the order of the collection, so the index in the collection is the index in the frame
+			event_stream::put<std::int32_t>(m_buffer, ptc.StartVertex().isAvailable() ? ptc.StartVertex().getObjectID().index : -1);
+			event_stream::put<std::int32_t>(m_buffer, ptc.EndVertex().isAvailable() ? ptc.EndVertex().getObjectID().index : -1);
+		}
+
+		std::uint32_t const payload = static_cast<std::uint32_t>(m_buffer.size() - sizeof(std::uint32_t));
+		std::memcpy(m_buffer.data(), &payload, sizeof(payload));
+
+		write_buffer();
+		++m_events;
+	}
+
+	void close() {
+		if(m_fd >= 0) {
+			::close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+	std::size_t events() const {return m_events;}
+	std::size_t bytes() const {return m_bytes;}
+
+private:
+	void write_buffer() {
+		std::size_t written = 0;
+		while(written < m_buffer.size()) {
+			auto n = ::write(m_fd, m_buffer.data() + written, m_buffer.size() - written);
+			if(n < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw event_stream::system_error("Unable to write event stream");
+			}
+			written += static_cast<std::size_t>(n);
+		}
+		m_bytes += written;
+	}
+
+	int m_fd;
+	std::vector<char> m_buffer; // frame being written. Kept between events to avoid reallocations
+	std::size_t m_events;
+	std::size_t m_bytes;
+};
+
+// events as read from the stream
+struct StreamVertex {
+	double x, y, z, ctau;
+};
+
+struct StreamParticle {
+	int pdg, status, charge;
+	unsigned bits;
+	double px, py, pz, mass;
+	int start_vertex, end_vertex; // indices in StreamEvent::vertices, -1 if there is no vertex
+};
+
+struct StreamEvent {
+	int number;
+	std::vector<StreamVertex> vertices;
+	std::vector<StreamParticle> particles;
+};
+
+// the same event taken straight from the collections, without going through the stream
+inline void fill_stream_event(int number, fcc::MCParticleCollection const & pcoll, fcc::GenVertexCollection const & vcoll, StreamEvent & event) {
+	event.number = number;
+
+	event.vertices.clear();
+	event.vertices.reserve(vcoll.size());
+	for(auto const & vtx : vcoll) {
+		auto const & pos = vtx.Position();
+		event.vertices.push_back(StreamVertex{pos.X, pos.Y, pos.Z, vtx.Ctau()});
+	}
+
+	event.particles.clear();
+	event.particles.reserve(pcoll.size());
+	for(auto const & ptc : pcoll) {
+		auto const & core = ptc.Core();
+		// vertices are stored in the order of the collection, so the index in the collection is the index in the event
+		event.particles.push_back(StreamParticle{core.Type, core.Status, core.Charge, core.Bits, core.P4.Px, core.P4.Py, core.P4.Pz, core.P4.Mass,
+		                                         ptc.StartVertex().isAvailable() ? ptc.StartVertex().getObjectID().index : -1,
+		                                         ptc.EndVertex().isAvailable() ? ptc.EndVertex().getObjectID().index : -1});
+	}
+}
+
+class EventStreamReader {
+public:
+	explicit EventStreamReader(std::string const & source) : m_fd(-1) {
+		if(source == "-") {
+			m_fd = ::dup(STDIN_FILENO);
+		} else if(event_stream::is_socket(source)) {
+			m_fd = event_stream::open_socket(source.substr(5), true); // blocks until the producer connects
+		} else {
+			m_fd = ::open(source.c_str(), O_RDONLY);
+		}
+		if(m_fd < 0) {
+			throw event_stream::system_error("Unable to open \"" + source + "\"");
+		}
+
+		char magic[sizeof(event_stream::magic)];
+		std::uint32_t byte_order_mark = 0;
+		if(!read_exactly(magic, sizeof(magic)) || std::memcmp(magic, event_stream::magic, sizeof(magic)) != 0 || !read_exactly(&byte_order_mark, sizeof(byte_order_mark))) {
+			throw std::runtime_error("\"" + source + "\" is not an event stream");
+		}
+		if(byte_order_mark != event_stream::byte_order_mark) {
+			throw std::runtime_error("Event stream \"" + source + "\" was written with a different byte order");
+		}
+	}
+
+	EventStreamReader(EventStreamReader const &) = delete;
+	EventStreamReader & operator=(EventStreamReader const &) = delete;
+
+	~EventStreamReader() {
+		if(m_fd >= 0) {
+			::close(m_fd);
+		}
+	}
+
+	// reads the next event. Returns false at the end of the stream
+	bool next(StreamEvent & event) {
+		std::uint32_t payload = 0;
+		if(!read_exactly(&payload, sizeof(payload))) {
+			return false;
+		}
+
+		m_buffer.resize(payload);
+		if(!read_exactly(m_buffer.data(), payload)) {
+			throw std::runtime_error("Event stream ended in the middle of an event");
+		}
+
+		std::size_t offset = 0;
+		event.number = event_stream::get<std::int32_t>(m_buffer, offset);
+		auto nvertices = event_stream::get<std::uint32_t>(m_buffer, offset);
+		auto nparticles = event_stream::get<std::uint32_t>(m_buffer, offset);
+		if(offset + nvertices * event_stream::vertex_bytes + nparticles * event_stream::particle_bytes != payload) {
+			throw std::runtime_error("Malformed event stream frame");
+		}
+
+		event.vertices.resize(nvertices);
+		for(auto & vtx : event.vertices) {
+			vtx.x = event_stream::get<double>(m_buffer, offset);
+			vtx.y = event_stream::get<double>(m_buffer, offset);
+			vtx.z = event_stream::get<double>(m_buffer, offset);
+			vtx.ctau = event_stream::get<double>(m_buffer, offset);
+		}
+
+		event.particles.resize(nparticles);
+		for(auto & ptc : event.particles) {
+			ptc.pdg = event_stream::get<std::int32_t>(m_buffer, offset);
+			ptc.status = event_stream::get<std::int32_t>(m_buffer, offset);
+			ptc.charge = event_stream::get<std::int32_t>(m_buffer, offset);
+			ptc.bits = event_stream::get<std::uint32_t>(m_buffer, offset);
+			ptc.px = event_stream::get<double>(m_buffer, offset);
+			ptc.py = event_stream::get<double>(m_buffer, offset);
+			ptc.pz = event_stream::get<double>(m_buffer, offset);
+			ptc.mass = event_stream::get<double>(m_buffer, offset);
+			ptc.start_vertex = event_stream::get<std::int32_t>(m_buffer, offset);
+			ptc.end_vertex = event_stream::get<std::int32_t>(m_buffer, offset);
+		}
+
+		return true;
+	}
+
+private:
+	// false if the stream ends before the first byte. Ending after it is an error
+	bool read_exactly(void * data, std::size_t size) {
+		std::size_t done = 0;
+		while(done < size) {
+			auto n = ::read(m_fd, static_cast<char *>(data) + done, size - done);
+			if(n < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				throw event_stream::system_error("Unable to read event stream");
+			}
+			if(n == 0) {
+				if(done == 0) {
+					return false;
+				}
+				throw std::runtime_error("Event stream ended in the middle of a frame");
+			}
+			done += static_cast<std::size_t>(n);
+		}
+
+		return true;
+	}
+
+	int m_fd;
+	std::vector<char> m_buffer; // payload of the frame being read
+};
+
+#endif // GENERATOR_EVENTSTREAM_H
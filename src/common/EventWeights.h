@@ -0,0 +1,85 @@
+/// Weighted event generation
+/// Two ways to get more events in the tails of a distribution:
+/// 	PYTHIA phase space biasing (PhaseSpace:bias2Selection, set from the command line or in the PYTHIA config file). PYTHIA samples the hard process with a bias and returns the compensating weight in Info::weight()
+/// 	momentum enhancement: events without a key particle above a momentum threshold are kept with probability 1 / factor and get weight factor. Applied to the hadronized event before the EvtGen decays, so the dropped events cost neither decays nor conversion nor storage. PYTHIA's own biasing and user hooks act before hadronization and can't see the key particle, which is why this one works on the event record
+/// WeightSummary accumulates the weights of the stored events for the run summary
+
+#ifndef GENERATOR_EVENTWEIGHTS_H
+#define GENERATOR_EVENTWEIGHTS_H
+
+// PYTHIA
+#include "Pythia8/Pythia.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <ostream>
+
+class MomentumEnhancement {
+public:
+	// factor <= 1 disables the enhancement
+	MomentumEnhancement(int key_pdg, double min_p, double factor) : m_key_pdg(key_pdg), m_min_p(min_p), m_factor(factor), m_weight(1.), m_prescaled(0) {}
+
+	bool enabled() const {return m_factor > 1.;}
+
+	// false if the event is dropped. "rndm" is the PYTHIA random number generator, so that runs stay reproducible with a fixed seed
+	bool accept(Pythia8::Event const & event, Pythia8::Rndm & rndm) {
+		m_weight = 1.;
+		if(!enabled()) {
+			return true;
+		}
+
+		for(int i = 0; i < event.size(); ++i) {
+			if(std::abs(event[i].id()) == m_key_pdg && event[i].pAbs() > m_min_p) {
+				return true;
+			}
+		}
+
+		if(rndm.flat() * m_factor < 1.) {
+			m_weight = m_factor;
+			return true;
+		}
+
+		++m_prescaled;
+		return false;
+	}
+
+	double weight() const {return m_weight;} // enhancement weight of the last accepted event
+	std::size_t prescaled() const {return m_prescaled;} // number of dropped events
+
+private:
+	int m_key_pdg;
+	double m_min_p; // GeV
+	double m_factor;
+	double m_weight;
+	std::size_t m_prescaled;
+};
+
+class WeightSummary {
+public:
+	WeightSummary() : m_entries(0), m_sum(0.), m_sum2(0.) {}
+
+	void add(double weight) {
+		++m_entries;
+		m_sum += weight;
+		m_sum2 += weight * weight;
+	}
+
+	std::size_t entries() const {return m_entries;}
+	double sum() const {return m_sum;}
+	double sum2() const {return m_sum2;}
+	double effective_entries() const {return m_sum2 > 0. ? m_sum * m_sum / m_sum2 : 0.;} // number of unweighted events with the same statistical power
+
+	// prints the weight statistics and the cross section estimate of PYTHIA (in mb)
+	void print(std::ostream & os, double sigma, double sigma_error) const {
+		os << "Event weights: sum = " << m_sum << ", sum of squares = " << m_sum2 << ", effective number of events = " << effective_entries() << " (" << m_entries << " stored)" << std::endl;
+		os << "Cross section: " << sigma << " +- " << sigma_error << " mb" << std::endl;
+	}
+
+private:
+	std::size_t m_entries;
+	double m_sum;
+	double m_sum2;
+};
+
+#endif // GENERATOR_EVENTWEIGHTS_H
@@ -0,0 +1,259 @@
+/// Conversion of a HepMC event into FCC-ee data model collections
+/// The persistence policy decides which particles are written:
+/// 	full - every particle and vertex of the HepMC event (partons, shower history, ...)
+/// 	signal-tree+stable - the signal particles with all their descendants plus all stable (status 1) particles
+/// 	stable-only - stable particles only
+/// 	signal-tree-only - the signal particles with all their descendants only
+/// With any policy but "full" only the vertices that are a production or decay vertex of a stored particle are written, so the vertex links of the stored particles stay consistent
+/// Kinematics and positions are passed through a Quantizer (see Quantization.h) on their way into the collections
+/// The conversion is compiled separately for every persistence policy and storage precision. EventConverter picks the right variant once, so the loops over particles and vertices don't check the configuration
+/// The same loops are also compiled with the configuration read at run time (generic_convert_event), which is what the specialization is benchmarked against (validate --benchmark)
+
+#ifndef GENERATOR_HEPMCCONVERTER_H
+#define GENERATOR_HEPMCCONVERTER_H
+
+// Common utilities
+#include "EventArena.h"
+#include "Quantization.h"
+#include "ParticleTable.h"
+
+// Data model
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+#include "datamodel/GenVertexCollection.h"
+
+// PYTHIA and HepMC
+#include "Pythia8/Pythia.h"
+#include "HepMC/GenEvent.h"
+
+// STL
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+enum class PersistencePolicy {
+	Full,
+	SignalTreeAndStable,
+	StableOnly,
+	SignalTreeOnly
+};
+
+inline PersistencePolicy parse_persistence_policy(std::string const & name) {
+	if(name == "full") {
+		return PersistencePolicy::Full;
+	}
+	if(name == "signal-tree+stable") {
+		return PersistencePolicy::SignalTreeAndStable;
+	}
+	if(name == "stable-only") {
+		return PersistencePolicy::StableOnly;
+	}
+	if(name == "signal-tree-only") {
+		return PersistencePolicy::SignalTreeOnly;
+	}
+
+	throw std::invalid_argument("Unknown persistence policy \"" + name + "\". Possible values: full, signal-tree+stable, stable-only, signal-tree-only");
+}
+
+inline std::string to_string(PersistencePolicy policy) {
+	switch(policy) {
+		case PersistencePolicy::Full: return "full";
+		case PersistencePolicy::SignalTreeAndStable: return "signal-tree+stable";
+		case PersistencePolicy::StableOnly: return "stable-only";
+		case PersistencePolicy::SignalTreeOnly: return "signal-tree-only";
+	}
+
+	return "unknown";
+}
+
+// configuration of the conversion fixed at compile time. Precision must be the precision of the quantizer
+template<PersistencePolicy Policy, StoragePrecision Precision>
+struct StaticConversion {
+	Quantizer const & quantizer;
+
+	PersistencePolicy policy() const {return Policy;}
+	double momentum(double value) const {return quantizer.momentum<Precision>(value);}
+	double position(double value) const {return quantizer.position<Precision>(value);}
+};
+
+// configuration of the conversion read at run time, for every particle and value
+struct RuntimeConversion {
+	PersistencePolicy persistence_policy;
+	Quantizer const & quantizer;
+
+	PersistencePolicy policy() const {return persistence_policy;}
+	double momentum(double value) const {return quantizer.momentum(value);}
+	double position(double value) const {return quantizer.position(value);}
+};
+
+// fills particle and vertex collections from the HepMC event according to the persistence policy and storage precision of "config" (StaticConversion or RuntimeConversion). "is_signal" is a predicate on HepMC::GenParticle const * telling which particles are the roots of the signal decay tree (it is not called with the "full" and "stable-only" policies)
+// Returns the number of stored particles
+template<typename Config, typename SignalPredicate>
+std::size_t convert_event_with(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena, Config const & config, SignalPredicate is_signal) {
+	auto const policy = config.policy();
+	bool const full = policy == PersistencePolicy::Full;
+	bool const keep_stable = policy == PersistencePolicy::SignalTreeAndStable || policy == PersistencePolicy::StableOnly;
+	bool const keep_signal_tree = policy == PersistencePolicy::SignalTreeAndStable || policy == PersistencePolicy::SignalTreeOnly;
+
+	// selecting particles to store
+	ArenaUnorderedSet<HepMC::GenParticle const *> keep(arena);
+	if(!full) {
+		std::vector<HepMC::GenParticle const *, ArenaAllocator<HepMC::GenParticle const *>> stack(arena); // particles whose descendants are still to be visited
+
+		for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+			if(keep_stable && (*ip)->status() == 1) {
+				keep.insert(*ip);
+			}
+			if(keep_signal_tree && is_signal(*ip) && keep.insert(*ip).second) {
+				stack.push_back(*ip);
+			}
+		}
+
+		// walking down the decay trees of the signal particles
+		while(!stack.empty()) {
+			auto ptc = stack.back();
+			stack.pop_back();
+
+			auto endvtx = ptc->end_vertex();
+			if(endvtx) {
+				for(auto idaugh = endvtx->particles_out_const_begin(), endd = endvtx->particles_out_const_end(); idaugh != endd; ++idaugh) {
+					if(keep.insert(*idaugh).second) { // particles already in the set are either visited or stable (and have no descendants)
+						stack.push_back(*idaugh);
+					}
+				}
+			}
+		}
+	}
+
+	// filling vertices
+	ArenaUnorderedMap<HepMC::GenVertex const *, fcc::GenVertex> vtx_map(arena);
+	vtx_map.reserve(static_cast<std::size_t>(hepmcevt->vertices_size()));
+	for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
+		if(!full) {
+			// the vertex is needed only if it is the production or the decay vertex of a stored particle
+			bool needed = false;
+			for(auto ip = (*iv)->particles_in_const_begin(), endp = (*iv)->particles_in_const_end(); ip != endp && !needed; ++ip) {
+				needed = keep.find(*ip) != keep.end();
+			}
+			for(auto ip = (*iv)->particles_out_const_begin(), endp = (*iv)->particles_out_const_end(); ip != endp && !needed; ++ip) {
+				needed = keep.find(*ip) != keep.end();
+			}
+			if(!needed) {
+				continue;
+			}
+		}
+
+		auto vtx = fcc::GenVertex();
+		vtx.Position().X = config.position((*iv)->position().x());
+		vtx.Position().Y = config.position((*iv)->position().y());
+		vtx.Position().Z = config.position((*iv)->position().z());
+		vtx.Ctau(static_cast<float>(config.position((*iv)->position().t())));
+		vtx_map.emplace(*iv, vtx);
+
+		vcoll.push_back(vtx);
+	}
+
+	// filling particles
+	std::size_t stored = 0;
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		if(!full && keep.find(*ip) == keep.end()) {
+			continue;
+		}
+
+		auto ptc = fcc::MCParticle();
+		auto & core = ptc.Core();
+		core.Type = (*ip)->pdg_id();
+		core.Status = (*ip)->status();
+
+		core.Charge = particles.charge(core.Type);
+		core.P4.Mass = config.momentum((*ip)->momentum().m());
+		core.P4.Px = config.momentum((*ip)->momentum().px());
+		core.P4.Py = config.momentum((*ip)->momentum().py());
+		core.P4.Pz = config.momentum((*ip)->momentum().pz());
+
+		auto prodvtx = vtx_map.find((*ip)->production_vertex());
+		if(prodvtx != vtx_map.end()) {
+			ptc.StartVertex(prodvtx->second);
+		}
+		auto endvtx = vtx_map.find((*ip)->end_vertex());
+		if(endvtx != vtx_map.end()) {
+			ptc.EndVertex(endvtx->second);
+		}
+
+		pcoll.push_back(ptc);
+		++stored;
+	}
+
+	return stored;
+}
+
+// the conversion compiled for one persistence policy and storage precision. Precision must be the precision of the quantizer
+template<PersistencePolicy Policy, StoragePrecision Precision, typename SignalPredicate>
+std::size_t specialized_convert_event(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena, Quantizer const & quantizer, SignalPredicate is_signal) {
+	return convert_event_with(hepmcevt, particles, pcoll, vcoll, arena, StaticConversion<Policy, Precision>{quantizer}, is_signal);
+}
+
+// the same conversion checking the persistence policy and storage precision at run time. Only used as the baseline of the benchmark
+template<typename SignalPredicate>
+std::size_t generic_convert_event(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena, PersistencePolicy policy, Quantizer const & quantizer, SignalPredicate is_signal) {
+	return convert_event_with(hepmcevt, particles, pcoll, vcoll, arena, RuntimeConversion{policy, quantizer}, is_signal);
+}
+
+// conversion with the persistence policy and storage precision fixed at construction
+template<typename SignalPredicate>
+class EventConverter {
+public:
+	EventConverter(PersistencePolicy policy, Quantizer const & quantizer, SignalPredicate is_signal) : m_function(select(policy, quantizer.precision())), m_quantizer(quantizer), m_is_signal(is_signal) {}
+
+	std::size_t operator()(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena) const {
+		return m_function(hepmcevt, particles, pcoll, vcoll, arena, m_quantizer, m_is_signal);
+	}
+
+private:
+	typedef std::size_t (*Function)(HepMC::GenEvent const *, ParticleTable const &, fcc::MCParticleCollection &, fcc::GenVertexCollection &, EventArena &, Quantizer const &, SignalPredicate);
+
+	template<PersistencePolicy Policy>
+	static Function select(StoragePrecision precision) {
+		switch(precision) {
+			case StoragePrecision::Full: return &specialized_convert_event<Policy, StoragePrecision::Full, SignalPredicate>;
+			case StoragePrecision::Fixed: return &specialized_convert_event<Policy, StoragePrecision::Fixed, SignalPredicate>;
+		}
+
+		throw std::invalid_argument("Unknown storage precision");
+	}
+
+	static Function select(PersistencePolicy policy, StoragePrecision precision) {
+		switch(policy) {
+			case PersistencePolicy::Full: return select<PersistencePolicy::Full>(precision);
+			case PersistencePolicy::SignalTreeAndStable: return select<PersistencePolicy::SignalTreeAndStable>(precision);
+			case PersistencePolicy::StableOnly: return select<PersistencePolicy::StableOnly>(precision);
+			case PersistencePolicy::SignalTreeOnly: return select<PersistencePolicy::SignalTreeOnly>(precision);
+		}
+
+		throw std::invalid_argument("Unknown persistence policy");
+	}
+
+	Function m_function;
+	Quantizer m_quantizer;
+	SignalPredicate m_is_signal;
+};
+
+template<typename SignalPredicate>
+EventConverter<SignalPredicate> make_event_converter(PersistencePolicy policy, Quantizer const & quantizer, SignalPredicate is_signal) {
+	return EventConverter<SignalPredicate>(policy, quantizer, is_signal);
+}
+
+// one-off conversion with the configuration chosen at run time
+template<typename SignalPredicate>
+std::size_t convert_event(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena, PersistencePolicy policy, Quantizer const & quantizer, SignalPredicate is_signal) {
+	return make_event_converter(policy, quantizer, is_signal)(hepmcevt, particles, pcoll, vcoll, arena);
+}
+
+// overload for executables that have no notion of a signal particle
+inline std::size_t convert_event(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll, EventArena & arena, PersistencePolicy policy = PersistencePolicy::Full) {
+	return convert_event(hepmcevt, particles, pcoll, vcoll, arena, policy, Quantizer(), [](HepMC::GenParticle const *) {return false;});
+}
+
+#endif // GENERATOR_HEPMCCONVERTER_H
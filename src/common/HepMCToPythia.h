@@ -0,0 +1,83 @@
+/// Conversion of a HepMC event back into the PYTHIA event record
+/// Used to feed events produced by the generate-only mode (hadronized, but with the particles EvtGen takes care of left undecayed) to EvtGenDecays, which works on Pythia8::Event only
+/// HepMC keeps the HepMC status codes only, so the PYTHIA status codes are not recovered: final particles get status 1, beams -12 and all the other particles minus their HepMC status. This is all EvtGenDecays and Pythia8ToHepMC look at
+/// Mother and daughter indices are stored as the (lowest, highest) index range, which is how PYTHIA stores them for events written by Pythia8ToHepMC (barcodes are the original event record indices)
+
+#ifndef GENERATOR_HEPMCTOPYTHIA_H
+#define GENERATOR_HEPMCTOPYTHIA_H
+
+// Common utilities
+#include "EventArena.h"
+
+// PYTHIA and HepMC
+#include "Pythia8/Pythia.h"
+#include "HepMC/GenEvent.h"
+
+// STL
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+
+// returns the (lowest, highest) event record indices of the particles in the range, (0, 0) if it is empty
+template<typename Iterator>
+std::pair<int, int> index_range(Iterator begin, Iterator end, ArenaUnorderedMap<HepMC::GenParticle const *, int> const & index) {
+	int low = 0, high = 0;
+	for(auto ip = begin; ip != end; ++ip) {
+		auto i = index.at(*ip);
+		low = low == 0 ? i : std::min(low, i);
+		high = std::max(high, i);
+	}
+
+	return std::make_pair(low, high);
+}
+
+// fills the PYTHIA event record from the HepMC event. Momenta are expected in GeV and positions in mm
+inline void fill_pythia_event(HepMC::GenEvent const * hepmcevt, Pythia8::Event & event, EventArena & arena) {
+	event.reset();
+
+	// event record indices of HepMC particles. HepMC iterates over particles in barcode order, so the original order is kept
+	ArenaUnorderedMap<HepMC::GenParticle const *, int> index(arena);
+	index.reserve(static_cast<std::size_t>(hepmcevt->particles_size()));
+	int next_index = 1; // entry 0 is the system
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		index.emplace(*ip, next_index++);
+	}
+
+	// system entry: the sum of final particles
+	Pythia8::Vec4 total;
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		if((*ip)->status() == 1) {
+			auto const & p4 = (*ip)->momentum();
+			total += Pythia8::Vec4(p4.px(), p4.py(), p4.pz(), p4.e());
+		}
+	}
+	event.append(90, -11, 0, 0, 1, next_index - 1, 0, 0, total, total.mCalc());
+
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		auto status = (*ip)->status();
+		status = status == 1 ? 1 : (status == 4 ? -12 : -status);
+
+		std::pair<int, int> mothers(0, 0), daughters(0, 0);
+		auto prodvtx = (*ip)->production_vertex();
+		if(prodvtx) {
+			mothers = index_range(prodvtx->particles_in_const_begin(), prodvtx->particles_in_const_end(), index);
+			if(mothers.first == mothers.second) {
+				mothers.second = 0; // single mother
+			}
+		}
+		auto endvtx = (*ip)->end_vertex();
+		if(endvtx) {
+			daughters = index_range(endvtx->particles_out_const_begin(), endvtx->particles_out_const_end(), index);
+		}
+
+		auto const & p4 = (*ip)->momentum();
+		auto i = event.append((*ip)->pdg_id(), status, mothers.first, mothers.second, daughters.first, daughters.second, 0, 0, Pythia8::Vec4(p4.px(), p4.py(), p4.pz(), p4.e()), (*ip)->generated_mass());
+
+		if(prodvtx) {
+			auto const & pos = prodvtx->position();
+			event[i].vProd(Pythia8::Vec4(pos.x(), pos.y(), pos.z(), pos.t()));
+		}
+	}
+}
+
+#endif // GENERATOR_HEPMCTOPYTHIA_H
@@ -0,0 +1,170 @@
+/// Fixed binning histograms filled during generation
+/// Used by the analysis mode, where distributions are accumulated event by event instead of storing the events and studying them afterwards. A histogram keeps the sum of weights and the sum of squared weights of every bin plus the underflow and overflow, so weighted (biased or enhanced) samples give the right shapes and errors
+/// Histograms of the same binning are merged by adding them up. Every worker process fills its own histograms, writes them to a text file at the end of its run and the parent adds the files up, so nothing is shared or locked while generating
+
+#ifndef GENERATOR_HISTOGRAM_H
+#define GENERATOR_HISTOGRAM_H
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+
+class Histogram {
+public:
+	Histogram() : Histogram("", 1, 0., 1.) {}
+
+	Histogram(std::string const & name, std::size_t nbins, double low, double high) : m_name(name), m_low(low), m_high(high), m_sumw(nbins + 2, 0.), m_sumw2(nbins + 2, 0.), m_entries(0), m_sumwx(0.), m_sumwx2(0.) {
+		if(nbins == 0 || !(high > low)) {
+			throw std::invalid_argument("Invalid binning of histogram \"" + name + "\"");
+		}
+	}
+
+	void fill(double x, double weight = 1.) {
+		auto const bin = find_bin(x);
+		m_sumw[bin] += weight;
+		m_sumw2[bin] += weight * weight;
+		++m_entries;
+		m_sumwx += weight * x;
+		m_sumwx2 += weight * x * x;
+	}
+
+	// adds the content of the other histogram. Both must have the same binning
+	void merge(Histogram const & other) {
+		if(other.nbins() != nbins() || other.m_low < m_low || other.m_low > m_low || other.m_high < m_high || other.m_high > m_high) {
+			throw std::invalid_argument("Histogram \"" + m_name + "\" can't be merged with a histogram of another binning");
+		}
+
+		for(std::size_t i = 0; i < m_sumw.size(); ++i) {
+			m_sumw[i] += other.m_sumw[i];
+			m_sumw2[i] += other.m_sumw2[i];
+		}
+		m_entries += other.m_entries;
+		m_sumwx += other.m_sumwx;
+		m_sumwx2 += other.m_sumwx2;
+	}
+
+	std::string const & name() const {return m_name;}
+	std::size_t nbins() const {return m_sumw.size() - 2;}
+	double low() const {return m_low;}
+	double high() const {return m_high;}
+	double bin_low(std::size_t i) const {return m_low + (m_high - m_low) * static_cast<double>(i) / static_cast<double>(nbins());} // lower edge of bin i (0 based)
+	double content(std::size_t i) const {return m_sumw[i + 1];}
+	double error(std::size_t i) const {return std::sqrt(m_sumw2[i + 1]);}
+	double underflow() const {return m_sumw.front();}
+	double overflow() const {return m_sumw.back();}
+	std::size_t entries() const {return m_entries;}
+
+	// sum of weights, including underflow and overflow
+	double sum_weights() const {
+		double sum = 0.;
+		for(auto w : m_sumw) {
+			sum += w;
+		}
+
+		return sum;
+	}
+
+	// mean and rms of the filled values, not of the binned ones
+	double mean() const {
+		auto const sumw = sum_weights();
+		return sumw > 0. ? m_sumwx / sumw : 0.;
+	}
+
+	double rms() const {
+		auto const sumw = sum_weights();
+		auto const average = mean();
+		return sumw > 0. ? std::sqrt(std::max(m_sumwx2 / sumw - average * average, 0.)) : 0.;
+	}
+
+	// human readable summary. The non empty bins are listed if "bins" is set
+	void print(std::ostream & os, bool bins = true) const {
+		os << m_name << ": " << m_entries << " entries, sum of weights " << sum_weights() << ", mean " << mean() << ", rms " << rms() << ", underflow " << underflow() << ", overflow " << overflow() << std::endl;
+		if(!bins) {
+			return;
+		}
+
+		for(std::size_t i = 0; i < nbins(); ++i) {
+			if(m_sumw2[i + 1] > 0.) {
+				os << "\t[" << std::setw(10) << bin_low(i) << ", " << std::setw(10) << bin_low(i + 1) << ") " << std::setw(12) << content(i) << " +- " << error(i) << std::endl;
+			}
+		}
+	}
+
+	// text format read back by read():
+	// histogram NAME NBINS LOW HIGH ENTRIES SUMWX SUMWX2
+	// sums of weights of the underflow, the NBINS bins and the overflow
+	// sums of squared weights, same layout
+	void write(std::ostream & os) const {
+		auto const precision = os.precision(17);
+		os << "histogram " << m_name << ' ' << nbins() << ' ' << m_low << ' ' << m_high << ' ' << m_entries << ' ' << m_sumwx << ' ' << m_sumwx2 << '\n';
+		write_values(os, m_sumw);
+		write_values(os, m_sumw2);
+		os.precision(precision);
+	}
+
+	// reads the next histogram written by write(). Returns false at the end of the input
+	bool read(std::istream & is) {
+		std::string keyword;
+		if(!(is >> keyword)) {
+			return false;
+		}
+
+		std::size_t nbins = 0;
+		if(keyword != "histogram" || !(is >> m_name >> nbins >> m_low >> m_high >> m_entries >> m_sumwx >> m_sumwx2) || nbins == 0) {
+			throw std::runtime_error("Malformed histogram file");
+		}
+
+		m_sumw.assign(nbins + 2, 0.);
+		m_sumw2.assign(nbins + 2, 0.);
+		for(auto & w : m_sumw) {
+			is >> w;
+		}
+		for(auto & w2 : m_sumw2) {
+			is >> w2;
+		}
+		if(!is) {
+			throw std::runtime_error("Malformed histogram \"" + m_name + "\"");
+		}
+
+		return true;
+	}
+
+private:
+	// 0 is the underflow, nbins + 1 the overflow
+	std::size_t find_bin(double x) const {
+		if(x < m_low) {
+			return 0;
+		}
+		if(!(x < m_high)) {
+			return m_sumw.size() - 1; // NaN goes to the overflow as well
+		}
+
+		auto const bin = static_cast<std::size_t>((x - m_low) / (m_high - m_low) * static_cast<double>(nbins()));
+		return std::min(bin, nbins() - 1) + 1; // rounding can give nbins for values just below the upper edge
+	}
+
+	static void write_values(std::ostream & os, std::vector<double> const & values) {
+		for(std::size_t i = 0; i < values.size(); ++i) {
+			os << (i > 0 ? " " : "") << values[i];
+		}
+		os << '\n';
+	}
+
+	std::string m_name;
+	double m_low;
+	double m_high;
+	std::vector<double> m_sumw;
+	std::vector<double> m_sumw2;
+	std::size_t m_entries;
+	double m_sumwx;
+	double m_sumwx2;
+};
+
+#endif // GENERATOR_HISTOGRAM_H
@@ -0,0 +1,176 @@
+/// Sizing of generation jobs from a pilot run
+/// The pilot measures the fraction of generated events that are stored (events with the key particle after all selections), the number of key particles per stored event, the wall time per generated event, the initialization time, the peak memory and the output size per stored event. The efficiency gets a Wilson score interval and the time per event a normal interval on its mean
+/// The plan splits the target number of key particles into chunks that fit the wall time limit of a batch job even if the efficiency is at the lower end and the time per event at the upper end of their intervals, with a safety margin on top. Chunk seeds are mixed from the pilot seed like the per-event seeds (event_seed), from indices the events never use, and are kept at least chunk_seed_spacing apart from the pilot seed and from each other, so that neither the chunks nor the workers of a chunk (seed + worker index) repeat the pilot or each other
+
+#ifndef GENERATOR_JOBPLANNER_H
+#define GENERATOR_JOBPLANNER_H
+
+// Common utilities
+#include "EventCost.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdint>
+#include <cstdlib>
+
+struct Interval {
+	double value;
+	double low;
+	double high;
+};
+
+// Wilson score interval of a binomial proportion with k successes out of n. z = 1.96 gives 95% coverage
+inline Interval wilson_interval(std::size_t k, std::size_t n, double z = 1.96) {
+	if(n == 0) {
+		return Interval{0., 0., 1.};
+	}
+
+	auto const nn = static_cast<double>(n);
+	auto const p = static_cast<double>(k) / nn;
+	auto const denominator = 1. + z * z / nn;
+	auto const centre = (p + z * z / (2. * nn)) / denominator;
+	auto const half_width = z * std::sqrt(p * (1. - p) / nn + z * z / (4. * nn * nn)) / denominator;
+
+	return Interval{p, std::max(centre - half_width, 0.), std::min(centre + half_width, 1.)};
+}
+
+// mean and spread of a sample, accumulated value by value
+class RunningStats {
+public:
+	RunningStats() : m_n(0), m_mean(0.), m_m2(0.) {}
+
+	// Welford's update, stable for long runs
+	void add(double x) {
+		++m_n;
+		auto const delta = x - m_mean;
+		m_mean += delta / static_cast<double>(m_n);
+		m_m2 += delta * (x - m_mean);
+	}
+
+	std::size_t size() const {return m_n;}
+	double mean() const {return m_mean;}
+	double sd() const {return m_n > 1 ? std::sqrt(m_m2 / static_cast<double>(m_n - 1)) : 0.;}
+
+	// normal interval of the mean
+	Interval mean_interval(double z = 1.96) const {
+		auto const half_width = m_n > 0 ? z * sd() / std::sqrt(static_cast<double>(m_n)) : 0.;
+		return Interval{m_mean, std::max(m_mean - half_width, 0.), m_mean + half_width};
+	}
+
+private:
+	std::size_t m_n;
+	double m_mean;
+	double m_m2;
+};
+
+struct PilotResult {
+	std::size_t generated = 0; // generated events
+	std::size_t stored = 0; // stored events
+	std::size_t key_particles = 0; // key particles in the stored events
+	RunningStats event_seconds; // wall time per generated event
+	double init_seconds = 0.; // setup before the first event (PYTHIA and EvtGen initialization, ...)
+	std::size_t peak_rss = 0; // bytes
+	std::size_t output_bytes = 0; // size of the pilot output, 0 if nothing was written
+};
+
+struct JobChunk {
+	std::size_t nevents; // key particles to generate (the -n of the chunk)
+	int seed;
+	double expected_seconds; // central estimate of the wall time
+	double max_seconds; // pessimistic estimate of the wall time
+};
+
+class JobPlan {
+public:
+	// "target" key particles in jobs of at most "wall_limit" seconds, of which the fraction "safety" is planned for
+	JobPlan(PilotResult const & pilot, std::size_t target, double wall_limit, double safety, int base_seed) : m_pilot(pilot), m_target(target), m_wall_limit(wall_limit), m_safety(safety) {
+		if(target == 0) {
+			throw std::invalid_argument("The planned number of events must be positive");
+		}
+		if(!(wall_limit > 0.) || !(safety > 0.) || safety > 1.) {
+			throw std::invalid_argument("The wall time limit must be positive and the safety factor between 0 and 1");
+		}
+		if(pilot.stored == 0) {
+			throw std::runtime_error("No event was stored in the pilot of " + std::to_string(pilot.generated) + " events, the efficiency is below " + std::to_string(wilson_interval(0, pilot.generated).high) + ". Run a longer pilot");
+		}
+
+		m_efficiency = wilson_interval(pilot.stored, pilot.generated);
+		m_keys_per_event = static_cast<double>(pilot.key_particles) / static_cast<double>(pilot.stored);
+		m_event_seconds = pilot.event_seconds.mean_interval();
+
+		// seconds per key particle: central and pessimistic
+		m_key_seconds = Interval{m_event_seconds.value / (m_efficiency.value * m_keys_per_event), m_event_seconds.low / (m_efficiency.high * m_keys_per_event), m_event_seconds.high / (m_efficiency.low * m_keys_per_event)};
+
+		auto const budget = wall_limit * safety - pilot.init_seconds;
+		if(!(m_efficiency.low > 0.) || !(budget > m_key_seconds.high)) {
+			throw std::runtime_error("A job of " + std::to_string(wall_limit) + " s can't be expected to produce a single event. Run a longer pilot or raise the wall time limit");
+		}
+
+		auto const per_chunk = static_cast<std::size_t>(budget / m_key_seconds.high);
+		auto const nchunks = (target + per_chunk - 1) / per_chunk;
+		std::uint64_t seed_index = 0;
+		for(std::size_t i = 0; i < nchunks; ++i) {
+			auto const n = target / nchunks + (i < target % nchunks ? 1 : 0); // spread evenly
+			auto const seed = next_chunk_seed(base_seed, seed_index);
+			m_chunks.push_back(JobChunk{n, seed, pilot.init_seconds + static_cast<double>(n) * m_key_seconds.value, pilot.init_seconds + static_cast<double>(n) * m_key_seconds.high});
+		}
+	}
+
+	static int const chunk_seed_spacing = 1024; // room for the worker seeds of a chunk (seed + worker index)
+
+	std::vector<JobChunk> const & chunks() const {return m_chunks;}
+
+	void print(std::ostream & os) const {
+		auto const cpu_hours = [this](double seconds_per_key) {return (static_cast<double>(m_chunks.size()) * m_pilot.init_seconds + static_cast<double>(m_target) * seconds_per_key) / 3600.;};
+
+		os << "Pilot: " << m_pilot.stored << " of " << m_pilot.generated << " events stored, " << m_pilot.key_particles << " key particles, initialization " << m_pilot.init_seconds << " s" << std::endl;
+		os << "Efficiency: " << m_efficiency.value << " (95% CL " << m_efficiency.low << " - " << m_efficiency.high << "), " << m_keys_per_event << " key particles per stored event" << std::endl;
+		os << "Time per generated event: " << m_event_seconds.value << " s (95% CL " << m_event_seconds.low << " - " << m_event_seconds.high << "), per key particle: " << m_key_seconds.value << " s (" << m_key_seconds.low << " - " << m_key_seconds.high << ")" << std::endl;
+		os << "Plan for " << m_target << " key particles in jobs of at most " << m_wall_limit << " s (" << m_safety * 100. << "% planned): " << m_chunks.size() << " chunks" << std::endl;
+		os << "\t" << std::setw(6) << "chunk" << std::setw(12) << "-n" << std::setw(12) << "--seed" << std::setw(14) << "expected s" << std::setw(14) << "max s" << std::endl;
+		for(std::size_t i = 0; i < m_chunks.size(); ++i) {
+			auto const & chunk = m_chunks[i];
+			os << "\t" << std::setw(6) << i << std::setw(12) << chunk.nevents << std::setw(12) << chunk.seed << std::setw(14) << chunk.expected_seconds << std::setw(14) << chunk.max_seconds << std::endl;
+		}
+		os << "Expected resources: " << cpu_hours(m_key_seconds.value) << " CPU hours (at most " << cpu_hours(m_key_seconds.high) << "), " << static_cast<double>(m_pilot.peak_rss) / (1024. * 1024.) << " MB of memory per job";
+		if(m_pilot.output_bytes > 0) {
+			os << ", " << static_cast<double>(m_pilot.output_bytes) / static_cast<double>(m_pilot.stored) * static_cast<double>(m_target) / m_keys_per_event / (1024. * 1024. * 1024.) << " GB of output";
+		}
+		os << std::endl;
+	}
+
+private:
+	// next seed mixed from the pilot seed that is far enough from the pilot seed and the seeds of the chunks so far. "seed_index" counts the candidates. The top bit keeps the indices apart from the event indices of the per-event seeds
+	int next_chunk_seed(int base_seed, std::uint64_t & seed_index) const {
+		auto const too_close = [](int a, int b) {return std::abs(a - b) < chunk_seed_spacing;};
+		while(true) {
+			auto const seed = event_seed(base_seed, (static_cast<std::uint64_t>(1) << 63) | seed_index++);
+			bool free = !too_close(seed, base_seed) && seed <= 900000000 - chunk_seed_spacing; // the worker seeds must stay in PYTHIA's range without wrapping to 0
+			for(auto const & chunk : m_chunks) {
+				free = free && !too_close(seed, chunk.seed);
+			}
+			if(free) {
+				return seed;
+			}
+		}
+	}
+
+	PilotResult m_pilot;
+	std::size_t m_target;
+	double m_wall_limit;
+	double m_safety;
+	Interval m_efficiency; // stored events per generated event
+	double m_keys_per_event; // key particles per stored event
+	Interval m_event_seconds; // wall time per generated event
+	Interval m_key_seconds; // wall time per key particle
+	std::vector<JobChunk> m_chunks;
+};
+
+#endif // GENERATOR_JOBPLANNER_H
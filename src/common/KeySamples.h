@@ -0,0 +1,156 @@
+/// Samples of several key particle species filled from one generated stream
+/// Every species is given as PDG[:QUOTA[:OUTPUT]]: the PDG ID of the key particle, the number of key particles to collect (the number of events to generate by default) and the output file of the sample (the output file with the PDG ID inserted before the extension by default, output.root -> output.531.root). A single species without an output of its own writes to the output file as is, so a plain "-k 511" behaves as before
+/// An event goes to every sample it has a key particle for whose quota isn't filled yet, so the same Z -> b bbar event can end up in the B^0 and the B_s samples. The run ends when every quota is filled
+
+#ifndef GENERATOR_KEYSAMPLES_H
+#define GENERATOR_KEYSAMPLES_H
+
+// STL
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+struct KeySample {
+	int pdg = 0; // key particles are counted regardless of the sign
+	std::size_t quota = 0; // key particles to collect
+	std::string output_filename;
+	std::size_t keys = 0; // key particles collected so far
+	std::size_t events = 0; // events stored so far
+	std::size_t stored_particles = 0; // particles written to the sample so far
+
+	bool filled() const {return keys >= quota;}
+};
+
+// output file of a sample: the PDG ID is inserted before the extension
+inline std::string sample_filename(std::string const & filename, int pdg) {
+	auto dot = filename.rfind('.');
+	auto slash = filename.rfind('/');
+	if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		dot = filename.size();
+	}
+
+	return filename.substr(0, dot) + "." + std::to_string(pdg) + filename.substr(dot);
+}
+
+// parses "PDG[:QUOTA[:OUTPUT]]". An empty output is left for the caller to fill in
+inline KeySample parse_key_sample(std::string const & spec, std::size_t default_quota) {
+	KeySample sample;
+	sample.quota = default_quota;
+
+	std::istringstream input(spec);
+	std::string pdg, quota;
+	std::getline(input, pdg, ':');
+	std::getline(input, quota, ':');
+	std::getline(input, sample.output_filename); // the rest, so the output may contain colons
+
+	try {
+		std::size_t end = 0;
+		sample.pdg = std::stoi(pdg, &end);
+		if(end != pdg.size()) {
+			throw std::invalid_argument(pdg);
+		}
+		if(!quota.empty()) {
+			sample.quota = std::stoull(quota, &end);
+			if(end != quota.size()) {
+				throw std::invalid_argument(quota);
+			}
+		}
+	} catch(std::logic_error const &) {
+		throw std::invalid_argument("Invalid key particle \"" + spec + "\", expected PDG[:QUOTA[:OUTPUT]]");
+	}
+	if(sample.pdg <= 0) {
+		throw std::invalid_argument("Invalid key particle \"" + spec + "\", the PDG ID must be positive (antiparticles are counted too)");
+	}
+
+	return sample;
+}
+
+class KeySamples {
+public:
+	KeySamples() {}
+
+	// "specs" are the species as given on the command line, each of them possibly a comma separated list
+	KeySamples(std::vector<std::string> const & specs, std::size_t default_quota, std::string const & output_filename) {
+		for(auto const & list : specs) {
+			std::istringstream input(list);
+			for(std::string spec; std::getline(input, spec, ',');) {
+				if(!spec.empty()) {
+					m_samples.push_back(parse_key_sample(spec, default_quota));
+				}
+			}
+		}
+		if(m_samples.empty()) {
+			throw std::invalid_argument("At least one key particle is needed");
+		}
+
+		std::set<int> pdgs;
+		std::set<std::string> outputs;
+		for(auto & sample : m_samples) {
+			if(sample.output_filename.empty()) {
+				sample.output_filename = m_samples.size() == 1 ? output_filename : sample_filename(output_filename, sample.pdg);
+			}
+			if(!pdgs.insert(sample.pdg).second) {
+				throw std::invalid_argument("Key particle " + std::to_string(sample.pdg) + " is given more than once");
+			}
+			if(!outputs.insert(sample.output_filename).second) {
+				throw std::invalid_argument("Output file \"" + sample.output_filename + "\" is given to more than one key particle");
+			}
+		}
+	}
+
+	std::size_t size() const {return m_samples.size();}
+	KeySample & operator[](std::size_t i) {return m_samples[i];}
+	KeySample const & operator[](std::size_t i) const {return m_samples[i];}
+	KeySample const & front() const {return m_samples.front();}
+
+	std::vector<KeySample>::iterator begin() {return m_samples.begin();}
+	std::vector<KeySample>::iterator end() {return m_samples.end();}
+	std::vector<KeySample>::const_iterator begin() const {return m_samples.begin();}
+	std::vector<KeySample>::const_iterator end() const {return m_samples.end();}
+
+	std::vector<int> pdgs() const {
+		std::vector<int> pdgs;
+		for(auto const & sample : m_samples) {
+			pdgs.push_back(sample.pdg);
+		}
+
+		return pdgs;
+	}
+
+	// every quota is filled
+	bool filled() const {
+		for(auto const & sample : m_samples) {
+			if(!sample.filled()) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	std::size_t quota() const {
+		std::size_t quota = 0;
+		for(auto const & sample : m_samples) {
+			quota += sample.quota;
+		}
+
+		return quota;
+	}
+
+	std::size_t events() const {
+		std::size_t events = 0;
+		for(auto const & sample : m_samples) {
+			events += sample.events;
+		}
+
+		return events;
+	}
+
+private:
+	std::vector<KeySample> m_samples;
+};
+
+#endif // GENERATOR_KEYSAMPLES_H
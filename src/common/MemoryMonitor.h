@@ -0,0 +1,129 @@
+/// Resident memory accounting with an optional budget
+/// Samples the resident set size of the process from /proc/self/statm and breaks it down into named components (store collections, writer buffers, ...) registered by the executable. Whatever is not covered by the components (PYTHIA, EvtGen, libraries) is reported as "other"
+/// When a budget is set, crossing the soft limit triggers the registered flush action (and returns freed heap memory to the OS). The RSS is sampled again right after that, so the memory the flush really gave back is measured and reported rather than assumed; if the process is still above the budget, check() reports the budget as exceeded so that the caller can finish its output cleanly instead of being OOM-killed
+
+#ifndef GENERATOR_MEMORYMONITOR_H
+#define GENERATOR_MEMORYMONITOR_H
+
+// STL
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <fstream>
+#include <ostream>
+
+// POSIX
+#include <unistd.h>
+#include <sys/resource.h>
+#include <malloc.h>
+
+std::size_t const approx_podio_object_bytes = 128; // rough footprint of one object in a podio collection (data, Obj wrapper, relation bookkeeping). Used to estimate the size of the store collections
+
+class MemoryMonitor {
+public:
+	enum class Status {
+		Ok, // below the soft limit (or no budget set)
+		Flushed, // the soft limit was crossed and the flush action brought memory back under the budget
+		Exceeded // still above the budget after flushing
+	};
+
+	// budget is given in bytes, 0 means no limit. The soft limit is the fraction of the budget at which flushing starts
+	explicit MemoryMonitor(std::size_t budget = 0, double soft_fraction = 0.9) : m_budget(budget), m_soft_limit(static_cast<std::size_t>(static_cast<double>(budget) * soft_fraction)), m_flushes(0), m_freed(0), m_last_before(0), m_last_after(0) {}
+
+	void add_component(std::string const & name, std::function<std::size_t()> const & bytes) {
+		m_components.emplace_back(name, bytes);
+	}
+
+	void set_flush_action(std::function<void()> const & flush) {
+		m_flush = flush;
+	}
+
+	// current resident set size in bytes
+	static std::size_t rss() {
+		std::ifstream statm("/proc/self/statm");
+		std::size_t total_pages = 0, resident_pages = 0;
+		statm >> total_pages >> resident_pages;
+
+		return resident_pages * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+	}
+
+	// peak resident set size in bytes
+	static std::size_t peak_rss() {
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+
+		return static_cast<std::size_t>(usage.ru_maxrss) * 1024; // Linux reports ru_maxrss in kB
+	}
+
+	Status check() {
+		auto before = rss();
+		if(m_budget == 0 || before < m_soft_limit) {
+			return Status::Ok;
+		}
+
+		// flushing buffers and giving the freed memory back to the OS
+		++m_flushes;
+		if(m_flush) {
+			m_flush();
+		}
+		malloc_trim(0);
+
+		// the pages are unmapped by the time malloc_trim returns, so a second sample shows what the flush really freed
+		auto after = rss();
+		m_last_before = before;
+		m_last_after = after;
+		m_freed += before > after ? before - after : 0;
+
+		return after < m_budget ? Status::Flushed : Status::Exceeded;
+	}
+
+	// prints the RSS and its breakdown on a single line
+	void print(std::ostream & out) const {
+		auto resident = rss();
+		std::size_t accounted = 0;
+
+		out << "Memory: RSS " << to_mb(resident) << " MB (peak " << to_mb(peak_rss()) << " MB";
+		if(m_budget > 0) {
+			out << ", budget " << to_mb(m_budget) << " MB";
+		}
+		out << ")";
+		for(auto const & component : m_components) {
+			auto bytes = component.second();
+			accounted += bytes;
+			out << ", " << component.first << ' ' << to_mb(bytes) << " MB";
+		}
+		out << ", other " << to_mb(resident > accounted ? resident - accounted : 0) << " MB" << std::endl;
+	}
+
+	std::size_t budget() const {return m_budget;}
+	std::size_t flushes() const {return m_flushes;} // number of times the soft limit was crossed
+	std::size_t freed() const {return m_freed;} // RSS given back by all flushes together, as measured
+
+	// prints how often the soft limit was crossed and how much memory the flushes gave back, if it was crossed at all
+	void print_flushes(std::ostream & out) const {
+		if(m_flushes == 0) {
+			return;
+		}
+
+		out << "Memory soft limit was reached " << m_flushes << " times, flushing gave back " << to_mb(m_freed) << " MB of RSS in total (last flush: " << to_mb(m_last_before) << " MB -> " << to_mb(m_last_after) << " MB)" << std::endl;
+		if(m_freed == 0) {
+			out << "\tThe flushes didn't lower the RSS, the memory is held outside the writer buffers. See the breakdown above" << std::endl;
+		}
+	}
+
+private:
+	static double to_mb(std::size_t bytes) {return static_cast<double>(bytes) / (1024. * 1024.);}
+
+	std::size_t m_budget;
+	std::size_t m_soft_limit;
+	std::size_t m_flushes;
+	std::size_t m_freed; // bytes
+	std::size_t m_last_before; // RSS before and after the last flush, in bytes
+	std::size_t m_last_after;
+	std::vector<std::pair<std::string, std::function<std::size_t()>>> m_components;
+	std::function<void()> m_flush;
+};
+
+#endif // GENERATOR_MEMORYMONITOR_H
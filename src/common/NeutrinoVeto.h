@@ -0,0 +1,119 @@
+/// Cut of Z -> W+ W- events on the momenta of the neutrinos of the W decays
+/// Events are kept if both W bosons decay into a neutrino below the cut, hadronic W decays are rejected. accept() applies the exact cut to the final event record, which is unbiased
+/// Early veto (opt-in): PYTHIA calls the hook right after the resonance decays of the hard process, before showers, MPI and hadronization, so a vetoed event costs little more than its hard process. PYTHIA then starts the next event on its own, so vetoed events never come out of Pythia::next()
+/// The momenta at W decay time aren't the final ones: the lepton of the W decay radiates with the neutrino as recoiler, and no useful bound limits how far the recoil moves the neutrino. The early veto therefore only rejects events with a neutrino above the cut plus a margin, but an event whose neutrino would have ended below the cut from above the margin is still lost, so the sample can be biased. That's why it is off unless asked for, and print() states the possible bias whenever it is on
+/// To judge the margin, accept() counts the accepted events whose neutrino was above the cut at W decay time (near misses), i.e. that a smaller margin would have lost, with the largest excess over the cut they needed. A run without the early veto gives the unbiased yield to compare with
+
+#ifndef GENERATOR_NEUTRINOVETO_H
+#define GENERATOR_NEUTRINOVETO_H
+
+// Common utilities
+#include "Cutflow.h"
+
+// PYTHIA
+#include "Pythia8/Pythia.h"
+
+// STL
+#include <cstddef>
+#include <ostream>
+#include <algorithm>
+
+class NeutrinoMomentumVeto : public Pythia8::UserHooks {
+public:
+	// "max_p" and "margin" in GeV. The hook vetoes at W decay time only if "early" is set, and records its decisions in the cutflow, if any
+	NeutrinoMomentumVeto(double max_p, double margin, bool early, Cutflow * cutflow = nullptr) : m_max_p(max_p), m_margin(margin), m_early(early), m_cutflow(cutflow), m_step(0), m_tested(0), m_vetoed(0), m_decay_p(0.), m_accepted(0), m_near_misses(0), m_largest_excess(0.) {
+		if(m_cutflow && m_early) {
+			m_step = m_cutflow->add("neutrinos at W decay (early veto)");
+		}
+	}
+
+	bool canVetoResonanceDecays() override {return m_early;}
+
+	// "process" is the hard process with the resonance decays. True vetoes the event
+	bool doVetoResonanceDecays(Pythia8::Event & process) override {
+		auto const start = Cutflow::Clock::now();
+		int neutrinos = 0;
+		m_decay_p = largest_neutrino_p(process, neutrinos);
+		bool const passed = neutrinos == 2 && m_decay_p < m_max_p + m_margin;
+		++m_tested;
+		if(!passed) {
+			++m_vetoed;
+		}
+		if(m_cutflow) {
+			m_cutflow->record(m_step, passed, start);
+		}
+
+		return !passed;
+	}
+
+	// exact cut on the final event record of the event the hook let through last. Counts the near misses
+	bool accept(Pythia8::Event const & event) {
+		int neutrinos = 0;
+		auto const p = largest_neutrino_p(event, neutrinos);
+		bool const passed = neutrinos == 2 && p < m_max_p;
+		if(passed) {
+			++m_accepted;
+			if(m_decay_p >= m_max_p) {
+				++m_near_misses;
+				m_largest_excess = std::max(m_largest_excess, m_decay_p - m_max_p);
+			}
+		}
+
+		return passed;
+	}
+
+	std::size_t tested() const {return m_tested;}
+	std::size_t vetoed() const {return m_vetoed;}
+	std::size_t near_misses() const {return m_near_misses;} // accepted events with a neutrino above the cut at W decay time
+	double largest_excess() const {return m_largest_excess;} // GeV
+
+	void print(std::ostream & os) const {
+		if(!m_early) {
+			os << "Neutrino momentum cut (|p| < " << m_max_p << " GeV) on the final event record only, no early veto: " << m_accepted << " events accepted" << std::endl;
+			return;
+		}
+
+		os << "Neutrino momentum veto: " << m_vetoed << " of " << m_tested << " events vetoed at W decay (|p| > " << m_max_p << " + " << m_margin << " GeV), before showers and hadronization" << std::endl;
+		os << "\tPossible bias: events vetoed at W decay whose neutrinos would have ended below " << m_max_p << " GeV after the shower are missing from the sample. Compare with a run without the early veto" << std::endl;
+		os << "Margin check: " << m_near_misses << " of " << m_accepted << " accepted events had a neutrino above " << m_max_p << " GeV at W decay, by at most " << m_largest_excess << " GeV of the " << m_margin << " GeV margin" << std::endl;
+		if(m_near_misses > 0 && m_largest_excess > 0.5 * m_margin) {
+			os << "\tThe margin is used by more than half, events vetoed at W decay may have passed the cut. Raise --veto-margin" << std::endl;
+		}
+	}
+
+private:
+	static bool is_neutrino(int id_abs) {return id_abs == 12 || id_abs == 14 || id_abs == 16;}
+
+	// largest momentum of the neutrinos of the W decays, counted in "neutrinos". Neutrinos are followed up to their first copy, whose mother is the W in the event record too
+	static double largest_neutrino_p(Pythia8::Event const & event, int & neutrinos) {
+		double largest = 0.;
+		for(int i = 0; i < event.size(); ++i) {
+			auto const & ptc = event[i];
+			if(!is_neutrino(ptc.idAbs()) || ptc.iBotCopyId() != i) {
+				continue;
+			}
+			auto const mother = event[ptc.iTopCopyId()].mother1();
+			if(mother <= 0 || event[mother].idAbs() != 24) {
+				continue;
+			}
+			largest = std::max(largest, ptc.pAbs());
+			++neutrinos;
+		}
+
+		return largest;
+	}
+
+	double m_max_p;
+	double m_margin;
+	bool m_early;
+	Cutflow * m_cutflow;
+	std::size_t m_step;
+	std::size_t m_tested;
+	std::size_t m_vetoed;
+	double m_decay_p; // largest neutrino momentum at W decay of the last event the hook tested
+	std::size_t m_accepted;
+	std::size_t m_near_misses;
+	double m_largest_excess;
+};
+
+#endif // GENERATOR_NEUTRINOVETO_H
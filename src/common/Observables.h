@@ -0,0 +1,208 @@
+/// Observables of the analysis mode
+/// Observables are declared up front as "NAME" or "NAME:NBINS:LOW:HIGH" and filled from the HepMC record of every event with the key particle, with the event weight:
+/// 	multiplicity - number of stable particles, per event
+/// 	charged-multiplicity - number of stable charged particles, per event
+/// 	key-p - momentum of the key particle in GeV, per key particle
+/// 	key-pt - transverse momentum of the key particle in GeV, per key particle
+/// 	key-decay-length - distance between the production and the decay vertex of the key particle in mm, per key particle that decays
+/// The histograms of a run are written to a text file (see Histogram.h); the files of the workers are merged into one by the parent
+
+#ifndef GENERATOR_OBSERVABLES_H
+#define GENERATOR_OBSERVABLES_H
+
+// Common utilities
+#include "Histogram.h"
+#include "ParticleTable.h"
+
+// PYTHIA and HepMC
+#include "Pythia8/Pythia.h"
+#include "HepMC/GenEvent.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <ostream>
+#include <stdexcept>
+
+class ObservableSet {
+public:
+	enum Observable {
+		Multiplicity,
+		ChargedMultiplicity,
+		KeyMomentum,
+		KeyPt,
+		KeyDecayLength
+	};
+
+	// declares the observable "NAME" with its default binning or "NAME:NBINS:LOW:HIGH"
+	void add(std::string const & spec) {
+		std::string name;
+		std::vector<std::string> fields;
+		std::istringstream input(spec);
+		std::getline(input, name, ':');
+		for(std::string field; std::getline(input, field, ':');) {
+			fields.push_back(field);
+		}
+		if(!fields.empty() && fields.size() != 3) {
+			throw std::invalid_argument("Invalid observable \"" + spec + "\". Expected NAME or NAME:NBINS:LOW:HIGH");
+		}
+
+		auto const observable = parse_observable(name);
+		Histogram histogram = default_histogram(observable);
+		if(!fields.empty()) {
+			histogram = Histogram(name, std::stoul(fields[0]), std::stod(fields[1]), std::stod(fields[2]));
+		}
+
+		for(auto const & entry : m_entries) {
+			if(entry.histogram.name() == name) {
+				throw std::invalid_argument("Observable \"" + name + "\" is declared twice");
+			}
+		}
+		m_entries.push_back(Entry{observable, histogram});
+	}
+
+	// every observable with its default binning
+	void add_all() {
+		for(auto name : {"multiplicity", "charged-multiplicity", "key-p", "key-pt", "key-decay-length"}) {
+			add(name);
+		}
+	}
+
+	bool empty() const {return m_entries.empty();}
+	std::size_t size() const {return m_entries.size();}
+	Histogram const & histogram(std::size_t i) const {return m_entries[i].histogram;}
+
+	// fills the observables from the event. "is_key" is a predicate on HepMC::GenParticle const * telling which particles are key particles
+	template<typename KeyPredicate>
+	void fill(HepMC::GenEvent const * hepmcevt, ParticleTable const & particles, KeyPredicate is_key, double weight) {
+		std::size_t stable = 0, charged = 0;
+		m_keys.clear();
+		for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+			if((*ip)->status() == 1) {
+				++stable;
+				if(particles.is_charged((*ip)->pdg_id())) {
+					++charged;
+				}
+			}
+			if(is_key(*ip)) {
+				m_keys.push_back(*ip);
+			}
+		}
+
+		for(auto & entry : m_entries) {
+			switch(entry.observable) {
+				case Multiplicity:
+					entry.histogram.fill(static_cast<double>(stable), weight);
+					break;
+				case ChargedMultiplicity:
+					entry.histogram.fill(static_cast<double>(charged), weight);
+					break;
+				case KeyMomentum:
+					for(auto ptc : m_keys) {
+						entry.histogram.fill(ptc->momentum().rho(), weight);
+					}
+					break;
+				case KeyPt:
+					for(auto ptc : m_keys) {
+						entry.histogram.fill(ptc->momentum().perp(), weight);
+					}
+					break;
+				case KeyDecayLength:
+					for(auto ptc : m_keys) {
+						auto prodvtx = ptc->production_vertex();
+						auto endvtx = ptc->end_vertex();
+						if(prodvtx && endvtx) {
+							auto const dx = endvtx->position().x() - prodvtx->position().x();
+							auto const dy = endvtx->position().y() - prodvtx->position().y();
+							auto const dz = endvtx->position().z() - prodvtx->position().z();
+							entry.histogram.fill(std::sqrt(dx * dx + dy * dy + dz * dz), weight);
+						}
+					}
+					break;
+			}
+		}
+	}
+
+	// adds the histograms of another run of the same observables
+	void merge(std::istream & is) {
+		Histogram histogram;
+		for(std::size_t i = 0; histogram.read(is); ++i) {
+			if(i >= m_entries.size() || histogram.name() != m_entries[i].histogram.name()) {
+				throw std::runtime_error("Histogram \"" + histogram.name() + "\" doesn't belong to the declared observables");
+			}
+			m_entries[i].histogram.merge(histogram);
+		}
+	}
+
+	void merge(std::string const & filename) {
+		std::ifstream file(filename);
+		if(!file) {
+			throw std::runtime_error("Unable to open histogram file \"" + filename + "\"");
+		}
+		merge(file);
+	}
+
+	void write(std::string const & filename) const {
+		std::ofstream file(filename);
+		for(auto const & entry : m_entries) {
+			entry.histogram.write(file);
+		}
+		if(!file) {
+			throw std::runtime_error("Unable to write histogram file \"" + filename + "\"");
+		}
+	}
+
+	void print(std::ostream & os, bool bins = true) const {
+		for(auto const & entry : m_entries) {
+			entry.histogram.print(os, bins);
+		}
+	}
+
+private:
+	struct Entry {
+		Observable observable;
+		Histogram histogram;
+	};
+
+	static Observable parse_observable(std::string const & name) {
+		if(name == "multiplicity") {
+			return Multiplicity;
+		}
+		if(name == "charged-multiplicity") {
+			return ChargedMultiplicity;
+		}
+		if(name == "key-p") {
+			return KeyMomentum;
+		}
+		if(name == "key-pt") {
+			return KeyPt;
+		}
+		if(name == "key-decay-length") {
+			return KeyDecayLength;
+		}
+
+		throw std::invalid_argument("Unknown observable \"" + name + "\". Possible values: multiplicity, charged-multiplicity, key-p, key-pt, key-decay-length");
+	}
+
+	// integer observables get one bin per value
+	static Histogram default_histogram(Observable observable) {
+		switch(observable) {
+			case Multiplicity: return Histogram("multiplicity", 200, -0.5, 199.5);
+			case ChargedMultiplicity: return Histogram("charged-multiplicity", 100, -0.5, 99.5);
+			case KeyMomentum: return Histogram("key-p", 100, 0., 50.);
+			case KeyPt: return Histogram("key-pt", 100, 0., 50.);
+			case KeyDecayLength: return Histogram("key-decay-length", 100, 0., 10.);
+		}
+
+		throw std::invalid_argument("Unknown observable");
+	}
+
+	std::vector<Entry> m_entries;
+	std::vector<HepMC::GenParticle const *> m_keys; // key particles of the current event. Kept to reuse its memory
+};
+
+#endif // GENERATOR_OBSERVABLES_H
@@ -0,0 +1,319 @@
+/// Structure-of-arrays view of the particles of an event and vectorized kinematics kernels working on it
+/// The batch is filled once per event (from the PYTHIA event record, the HepMC event, the stored collection or the decoded stream event) and then every derived quantity is computed for all particles in one go instead of going through the accessors of every particle
+/// The kernels are compiled twice: for AVX2 (via the GCC target attribute) and as plain scalar code. The AVX2 version is picked at run time if the CPU supports it, so the binaries stay portable across batch nodes. Apart from the invariant mass (which sums the four-momenta in a different order) both versions do the same floating point operations in the same order, so their results are identical
+/// pT, |p| and flight distance are fully vectorized, eta and phi vectorize the square roots but need scalar log / atan2 calls
+
+#ifndef GENERATOR_PARTICLEBATCH_H
+#define GENERATOR_PARTICLEBATCH_H
+
+// Data model
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+
+// Common utilities
+#include "ParticleTable.h"
+#include "EventStream.h"
+
+// PYTHIA and HepMC
+#include "Pythia8/Pythia.h"
+#include "HepMC/GenEvent.h"
+
+// STL
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <initializer_list>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define GENERATOR_AVX2_KERNELS
+	#include <immintrin.h>
+#endif
+
+struct ParticleBatch {
+	// kinematics (GeV)
+	std::vector<double> px, py, pz, e;
+	// identification
+	std::vector<int> pdg, status, charge;
+	// production and decay vertices (mm). Missing vertices are NaN
+	std::vector<double> prod_x, prod_y, prod_z, end_x, end_y, end_z;
+
+	std::size_t size() const {return px.size();}
+
+	// empties the batch keeping the memory for the next event
+	void clear() {
+		for(auto vec : {&px, &py, &pz, &e, &prod_x, &prod_y, &prod_z, &end_x, &end_y, &end_z}) {
+			vec->clear();
+		}
+		for(auto vec : {&pdg, &status, &charge}) {
+			vec->clear();
+		}
+	}
+
+	void push_back(double px_, double py_, double pz_, double e_, int pdg_, int status_, int charge_) {
+		double const nan = std::numeric_limits<double>::quiet_NaN();
+
+		px.push_back(px_);
+		py.push_back(py_);
+		pz.push_back(pz_);
+		e.push_back(e_);
+		pdg.push_back(pdg_);
+		status.push_back(status_);
+		charge.push_back(charge_);
+		for(auto vec : {&prod_x, &prod_y, &prod_z, &end_x, &end_y, &end_z}) {
+			vec->push_back(nan);
+		}
+	}
+
+	void set_production_vertex(std::size_t i, double x, double y, double z) {
+		prod_x[i] = x;
+		prod_y[i] = y;
+		prod_z[i] = z;
+	}
+
+	void set_decay_vertex(std::size_t i, double x, double y, double z) {
+		end_x[i] = x;
+		end_y[i] = y;
+		end_z[i] = z;
+	}
+};
+
+// filling the batch from the PYTHIA event record. Index i of the batch is entry i of the event (including the system entry 0). The charge is truncated to an integer as in ParticleTable and the stored collections (quarks have 0), so all the overloads agree
+inline void fill_batch(ParticleBatch & batch, Pythia8::Event const & event) {
+	batch.clear();
+	for(int i = 0; i < event.size(); ++i) {
+		auto const & ptc = event[i];
+		batch.push_back(ptc.px(), ptc.py(), ptc.pz(), ptc.e(), ptc.id(), ptc.status(), ptc.chargeType() / 3);
+		batch.set_production_vertex(static_cast<std::size_t>(i), ptc.xProd(), ptc.yProd(), ptc.zProd());
+	}
+	// decay vertices are the production vertices of the daughters
+	for(int i = 0; i < event.size(); ++i) {
+		auto daughter = event[i].daughter1();
+		if(daughter > 0 && !event[i].isFinal()) {
+			batch.set_decay_vertex(static_cast<std::size_t>(i), event[daughter].xProd(), event[daughter].yProd(), event[daughter].zProd());
+		}
+	}
+}
+
+// filling the batch from the HepMC event. Index i of the batch is the i-th particle in HepMC iteration order
+inline void fill_batch(ParticleBatch & batch, HepMC::GenEvent const * hepmcevt, ParticleTable const & particles) {
+	batch.clear();
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		auto const & p4 = (*ip)->momentum();
+		batch.push_back(p4.px(), p4.py(), p4.pz(), p4.e(), (*ip)->pdg_id(), (*ip)->status(), particles.charge((*ip)->pdg_id()));
+
+		auto i = batch.size() - 1;
+		if((*ip)->production_vertex()) {
+			auto const & pos = (*ip)->production_vertex()->position();
+			batch.set_production_vertex(i, pos.x(), pos.y(), pos.z());
+		}
+		if((*ip)->end_vertex()) {
+			auto const & pos = (*ip)->end_vertex()->position();
+			batch.set_decay_vertex(i, pos.x(), pos.y(), pos.z());
+		}
+	}
+}
+
+// filling the batch from the stored collection. Index i of the batch is element i of the collection
+inline void fill_batch(ParticleBatch & batch, fcc::MCParticleCollection const & pcoll) {
+	batch.clear();
+	for(auto const & ptc : pcoll) {
+		auto const & core = ptc.Core();
+		double const px = core.P4.Px, py = core.P4.Py, pz = core.P4.Pz, mass = core.P4.Mass;
+		batch.push_back(px, py, pz, std::sqrt(px * px + py * py + pz * pz + mass * mass), core.Type, core.Status, core.Charge);
+
+		auto i = batch.size() - 1;
+		if(ptc.StartVertex().isAvailable()) {
+			auto const & pos = ptc.StartVertex().Position();
+			batch.set_production_vertex(i, pos.X, pos.Y, pos.Z);
+		}
+		if(ptc.EndVertex().isAvailable()) {
+			auto const & pos = ptc.EndVertex().Position();
+			batch.set_decay_vertex(i, pos.X, pos.Y, pos.Z);
+		}
+	}
+}
+
+// filling the batch from the event decoded by EventStream.h. Index i of the batch is element i of its particles
+inline void fill_batch(ParticleBatch & batch, StreamEvent const & event) {
+	batch.clear();
+	auto const nvertices = event.vertices.size();
+	for(auto const & ptc : event.particles) {
+		batch.push_back(ptc.px, ptc.py, ptc.pz, std::sqrt(ptc.px * ptc.px + ptc.py * ptc.py + ptc.pz * ptc.pz + ptc.mass * ptc.mass), ptc.pdg, ptc.status, ptc.charge);
+
+		auto i = batch.size() - 1;
+		if(ptc.start_vertex >= 0 && static_cast<std::size_t>(ptc.start_vertex) < nvertices) {
+			auto const & vtx = event.vertices[static_cast<std::size_t>(ptc.start_vertex)];
+			batch.set_production_vertex(i, vtx.x, vtx.y, vtx.z);
+		}
+		if(ptc.end_vertex >= 0 && static_cast<std::size_t>(ptc.end_vertex) < nvertices) {
+			auto const & vtx = event.vertices[static_cast<std::size_t>(ptc.end_vertex)];
+			batch.set_decay_vertex(i, vtx.x, vtx.y, vtx.z);
+		}
+	}
+}
+
+// kernel implementations. Every kernel works on raw arrays of length n
+namespace batch_kernels {
+	// sqrt(a^2 + b^2) or sqrt(a^2 + b^2 + c^2) if c is given
+	inline void norm_scalar(double const * a, double const * b, double const * c, double * out, std::size_t begin, std::size_t n) {
+		for(auto i = begin; i < n; ++i) {
+			double sum = a[i] * a[i] + b[i] * b[i];
+			if(c) {
+				sum = sum + c[i] * c[i];
+			}
+			out[i] = std::sqrt(sum);
+		}
+	}
+
+	// |a - b| for 3D points given coordinate-wise
+	inline void distance_scalar(double const * ax, double const * ay, double const * az, double const * bx, double const * by, double const * bz, double * out, std::size_t begin, std::size_t n) {
+		for(auto i = begin; i < n; ++i) {
+			double const dx = bx[i] - ax[i], dy = by[i] - ay[i], dz = bz[i] - az[i];
+			out[i] = std::sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+
+	#ifdef GENERATOR_AVX2_KERNELS
+		__attribute__((target("avx2"))) inline void norm_avx2(double const * a, double const * b, double const * c, double * out, std::size_t n) {
+			std::size_t i = 0;
+			for(; i + 4 <= n; i += 4) {
+				auto va = _mm256_loadu_pd(a + i), vb = _mm256_loadu_pd(b + i);
+				auto sum = _mm256_add_pd(_mm256_mul_pd(va, va), _mm256_mul_pd(vb, vb));
+				if(c) {
+					auto vc = _mm256_loadu_pd(c + i);
+					sum = _mm256_add_pd(sum, _mm256_mul_pd(vc, vc));
+				}
+				_mm256_storeu_pd(out + i, _mm256_sqrt_pd(sum));
+			}
+			norm_scalar(a, b, c, out, i, n); // remainder
+		}
+
+		__attribute__((target("avx2"))) inline void distance_avx2(double const * ax, double const * ay, double const * az, double const * bx, double const * by, double const * bz, double * out, std::size_t n) {
+			std::size_t i = 0;
+			for(; i + 4 <= n; i += 4) {
+				auto dx = _mm256_sub_pd(_mm256_loadu_pd(bx + i), _mm256_loadu_pd(ax + i));
+				auto dy = _mm256_sub_pd(_mm256_loadu_pd(by + i), _mm256_loadu_pd(ay + i));
+				auto dz = _mm256_sub_pd(_mm256_loadu_pd(bz + i), _mm256_loadu_pd(az + i));
+				auto sum = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+				_mm256_storeu_pd(out + i, _mm256_sqrt_pd(sum));
+			}
+			distance_scalar(ax, ay, az, bx, by, bz, out, i, n); // remainder
+		}
+
+		__attribute__((target("avx2"))) inline double horizontal_sum_avx2(__m256d v) {
+			double lanes[4];
+			_mm256_storeu_pd(lanes, v);
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		}
+
+		// sums of the components over the selected particles. Indices are gathered four at a time
+		__attribute__((target("avx2"))) inline void sum_p4_avx2(double const * px, double const * py, double const * pz, double const * e, int const * indices, std::size_t n, double * sums) {
+			auto spx = _mm256_setzero_pd(), spy = _mm256_setzero_pd(), spz = _mm256_setzero_pd(), se = _mm256_setzero_pd();
+			auto const zero = _mm256_setzero_pd(), all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1)); // the masked gather with an explicit source keeps GCC from warning about the undefined source of the unmasked one
+			std::size_t i = 0;
+			for(; i + 4 <= n; i += 4) {
+				auto idx = _mm_loadu_si128(reinterpret_cast<__m128i const *>(indices + i));
+				spx = _mm256_add_pd(spx, _mm256_mask_i32gather_pd(zero, px, idx, all, 8));
+				spy = _mm256_add_pd(spy, _mm256_mask_i32gather_pd(zero, py, idx, all, 8));
+				spz = _mm256_add_pd(spz, _mm256_mask_i32gather_pd(zero, pz, idx, all, 8));
+				se = _mm256_add_pd(se, _mm256_mask_i32gather_pd(zero, e, idx, all, 8));
+			}
+
+			sums[0] = horizontal_sum_avx2(spx);
+			sums[1] = horizontal_sum_avx2(spy);
+			sums[2] = horizontal_sum_avx2(spz);
+			sums[3] = horizontal_sum_avx2(se);
+			for(; i < n; ++i) { // remainder
+				auto j = static_cast<std::size_t>(indices[i]);
+				sums[0] += px[j];
+				sums[1] += py[j];
+				sums[2] += pz[j];
+				sums[3] += e[j];
+			}
+		}
+
+		inline bool cpu_has_avx2() {
+			static bool const has_avx2 = __builtin_cpu_supports("avx2");
+			return has_avx2;
+		}
+	#else
+		inline bool cpu_has_avx2() {return false;}
+	#endif
+
+	inline void norm(double const * a, double const * b, double const * c, double * out, std::size_t n) {
+		#ifdef GENERATOR_AVX2_KERNELS
+			if(cpu_has_avx2()) {
+				norm_avx2(a, b, c, out, n);
+				return;
+			}
+		#endif
+		norm_scalar(a, b, c, out, 0, n);
+	}
+}
+
+// transverse momenta
+inline void compute_pt(ParticleBatch const & batch, std::vector<double> & out) {
+	out.resize(batch.size());
+	batch_kernels::norm(batch.px.data(), batch.py.data(), nullptr, out.data(), batch.size());
+}
+
+// absolute values of momenta
+inline void compute_p(ParticleBatch const & batch, std::vector<double> & out) {
+	out.resize(batch.size());
+	batch_kernels::norm(batch.px.data(), batch.py.data(), batch.pz.data(), out.data(), batch.size());
+}
+
+// pseudorapidities. Particles along the beam axis get +-infinity, particles at rest 0 (as in HepMC, instead of the NaN of 0 / 0)
+inline void compute_eta(ParticleBatch const & batch, std::vector<double> & out) {
+	compute_p(batch, out);
+	for(std::size_t i = 0, n = batch.size(); i < n; ++i) {
+		out[i] = out[i] > 0. ? 0.5 * std::log((out[i] + batch.pz[i]) / (out[i] - batch.pz[i])) : 0.;
+	}
+}
+
+// azimuthal angles
+inline void compute_phi(ParticleBatch const & batch, std::vector<double> & out) {
+	out.resize(batch.size());
+	for(std::size_t i = 0, n = batch.size(); i < n; ++i) {
+		out[i] = std::atan2(batch.py[i], batch.px[i]);
+	}
+}
+
+// distances between production and decay vertices. NaN if either vertex is missing
+inline void compute_flight_distance(ParticleBatch const & batch, std::vector<double> & out) {
+	out.resize(batch.size());
+	auto n = batch.size();
+	#ifdef GENERATOR_AVX2_KERNELS
+		if(batch_kernels::cpu_has_avx2()) {
+			batch_kernels::distance_avx2(batch.prod_x.data(), batch.prod_y.data(), batch.prod_z.data(), batch.end_x.data(), batch.end_y.data(), batch.end_z.data(), out.data(), n);
+			return;
+		}
+	#endif
+	batch_kernels::distance_scalar(batch.prod_x.data(), batch.prod_y.data(), batch.prod_z.data(), batch.end_x.data(), batch.end_y.data(), batch.end_z.data(), out.data(), 0, n);
+}
+
+// invariant mass of the set of particles with the given batch indices
+inline double invariant_mass(ParticleBatch const & batch, std::vector<int> const & indices) {
+	double sums[4] = {0., 0., 0., 0.}; // px, py, pz, e
+	#ifdef GENERATOR_AVX2_KERNELS
+		if(batch_kernels::cpu_has_avx2()) {
+			batch_kernels::sum_p4_avx2(batch.px.data(), batch.py.data(), batch.pz.data(), batch.e.data(), indices.data(), indices.size(), sums);
+		} else
+	#endif
+	{
+		for(auto index : indices) {
+			auto j = static_cast<std::size_t>(index);
+			sums[0] += batch.px[j];
+			sums[1] += batch.py[j];
+			sums[2] += batch.pz[j];
+			sums[3] += batch.e[j];
+		}
+	}
+
+	double const m2 = sums[3] * sums[3] - (sums[0] * sums[0] + sums[1] * sums[1] + sums[2] * sums[2]);
+	return m2 > 0. ? std::sqrt(m2) : 0.;
+}
+
+#endif // GENERATOR_PARTICLEBATCH_H
@@ -0,0 +1,123 @@
+/// Dense table of particle properties by PDG ID
+/// Built once at startup from PYTHIA's particle data (which EvtGen has updated by then), so that the per-particle lookups of the conversion and selection loops are a single array load instead of a search through PYTHIA's particle map
+/// PDG IDs between -dense_size and dense_size (quarks, leptons, bosons and the ground state hadrons) index the arrays directly, antiparticles included, so no sign has to be handled. The rare others (excited states, nuclei, ...) are looked up by binary search in a sorted list
+/// Properties:
+/// 	charge - integer charge, truncated like the double charge of PYTHIA converted to int (so quarks have 0)
+/// 	charged - the charge isn't 0 (fractional charges included)
+/// 	charged track - pions, kaons, protons, electrons and muons, the particles counted as charged tracks by the selections
+/// 	stable - no decay channels or c tau above 1 m
+/// 	tau0 - nominal c tau in mm
+/// 	name - PYTHIA's name, used for printing only and kept in a hash map
+/// A default constructed table has the properties that follow from the PDG ID alone (charged track) and nothing else. It is meant for tools without PYTHIA, like the skim
+
+#ifndef GENERATOR_PARTICLETABLE_H
+#define GENERATOR_PARTICLETABLE_H
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <initializer_list>
+
+class ParticleTable {
+public:
+	static constexpr int dense_size = 10000;
+	static constexpr double stable_ctau = 1000.; // mm
+
+	enum Flag : std::uint8_t {
+		Known = 1 << 0,
+		Charged = 1 << 1,
+		ChargedTrack = 1 << 2,
+		Stable = 1 << 3
+	};
+
+	ParticleTable() : m_charge(2 * dense_size, 0), m_flags(2 * dense_size, 0), m_tau0(2 * dense_size, 0.f) {
+		for(int id : {211, 321, 2212, 11, 13}) { // pions, kaons, protons, electrons and muons
+			m_flags[dense_index(id)] |= ChargedTrack;
+			m_flags[dense_index(-id)] |= ChargedTrack;
+		}
+	}
+
+	// "data" is PYTHIA's particle data (Pythia8::ParticleData), taken as a template parameter so that tools without PYTHIA can include the header
+	template<typename ParticleData>
+	explicit ParticleTable(ParticleData & data) : ParticleTable() {
+		for(int id = data.nextId(0); id != 0; id = data.nextId(id)) {
+			add(data, id);
+			if(data.hasAnti(id)) {
+				add(data, -id);
+			}
+		}
+		std::sort(m_sparse.begin(), m_sparse.end(), [](Entry const & a, Entry const & b) {return a.pdg < b.pdg;});
+	}
+
+	int charge(int pdg) const {return is_dense(pdg) ? m_charge[dense_index(pdg)] : sparse(pdg).charge;}
+	bool is_known(int pdg) const {return (flags(pdg) & Known) != 0;}
+	bool is_charged(int pdg) const {return (flags(pdg) & Charged) != 0;}
+	bool is_charged_track(int pdg) const {return (flags(pdg) & ChargedTrack) != 0;}
+	bool is_stable(int pdg) const {return (flags(pdg) & Stable) != 0;}
+	double tau0(int pdg) const {return is_dense(pdg) ? m_tau0[dense_index(pdg)] : sparse(pdg).tau0;}
+
+	std::uint8_t flags(int pdg) const {return is_dense(pdg) ? m_flags[dense_index(pdg)] : sparse(pdg).flags;}
+
+	// PYTHIA's name, or the PDG ID if the particle is unknown
+	std::string name(int pdg) const {
+		auto entry = m_names.find(pdg);
+		return entry != m_names.end() ? entry->second : std::to_string(pdg);
+	}
+
+	std::size_t size() const {return m_names.size();}
+
+private:
+	struct Entry {
+		int pdg;
+		std::int8_t charge;
+		std::uint8_t flags;
+		float tau0;
+	};
+
+	static bool is_dense(int pdg) {return pdg > -dense_size && pdg < dense_size;}
+	static std::size_t dense_index(int pdg) {return static_cast<std::size_t>(pdg + dense_size);}
+
+	Entry sparse(int pdg) const {
+		auto entry = std::lower_bound(m_sparse.begin(), m_sparse.end(), pdg, [](Entry const & e, int id) {return e.pdg < id;});
+		return entry != m_sparse.end() && entry->pdg == pdg ? *entry : Entry{pdg, 0, 0, 0.f};
+	}
+
+	template<typename ParticleData>
+	void add(ParticleData & data, int pdg) {
+		auto const charge_type = data.chargeType(pdg); // three times the charge
+		auto const tau0 = data.tau0(pdg);
+
+		std::uint8_t bits = Known;
+		if(charge_type != 0) {
+			bits |= Charged;
+		}
+		if(!data.canDecay(pdg) || tau0 > stable_ctau) {
+			bits |= Stable;
+		}
+
+		if(is_dense(pdg)) {
+			auto const i = dense_index(pdg);
+			m_charge[i] = static_cast<std::int8_t>(charge_type / 3);
+			m_flags[i] |= bits;
+			m_tau0[i] = static_cast<float>(tau0);
+		} else {
+			m_sparse.push_back(Entry{pdg, static_cast<std::int8_t>(charge_type / 3), bits, static_cast<float>(tau0)});
+		}
+		m_names[pdg] = data.name(pdg);
+	}
+
+	// dense part, indexed by PDG ID + dense_size
+	std::vector<std::int8_t> m_charge;
+	std::vector<std::uint8_t> m_flags;
+	std::vector<float> m_tau0;
+
+	std::vector<Entry> m_sparse; // sorted by PDG ID
+	std::unordered_map<int, std::string> m_names;
+};
+
+#endif // GENERATOR_PARTICLETABLE_H
@@ -0,0 +1,108 @@
+/// Reduced precision storage of particle kinematics and vertex positions
+/// The values are rounded in the existing data model fields rather than written to a companion collection of a smaller type: a new collection type would need a change of the fcc-edm data model. The fields are single precision already, so there is no separate "float" precision, and the saving comes from ROOT compressing the zeroed low mantissa bits:
+/// 	full - values are stored as they come from the generator (rounded to single precision by the data model)
+/// 	fixed - values are rounded to a fixed grid before the data model rounds them. The grid step is the largest power of 2 not exceeding the requested step, so |q(x) - x| <= step / 2 for any |x| below DBL_MAX * step. Momentum components and masses use the momentum step (GeV), positions and ctau use the position step (mm)
+/// The guarantee is checked by the validation (validate, "make validation") over random values and edge cases
+
+#ifndef GENERATOR_QUANTIZATION_H
+#define GENERATOR_QUANTIZATION_H
+
+// STL
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+enum class StoragePrecision {
+	Full,
+	Fixed
+};
+
+inline StoragePrecision parse_storage_precision(std::string const & name) {
+	if(name == "full") {
+		return StoragePrecision::Full;
+	}
+	if(name == "fixed") {
+		return StoragePrecision::Fixed;
+	}
+
+	throw std::invalid_argument("Unknown storage precision \"" + name + "\". Possible values: full, fixed (the data model stores single precision values, so full is float precision already)");
+}
+
+inline std::string to_string(StoragePrecision precision) {
+	switch(precision) {
+		case StoragePrecision::Full: return "full";
+		case StoragePrecision::Fixed: return "fixed";
+	}
+
+	return "unknown";
+}
+
+class Quantizer {
+public:
+	// full precision
+	Quantizer() : m_precision(StoragePrecision::Full), m_momentum_exponent(0), m_position_exponent(0) {}
+
+	// steps are only used with the fixed precision
+	Quantizer(StoragePrecision precision, double momentum_step, double position_step) : m_precision(precision), m_momentum_exponent(grid_exponent(momentum_step)), m_position_exponent(grid_exponent(position_step)) {}
+
+	double momentum(double value) const {return quantize(value, m_momentum_exponent);} // momentum component or mass in GeV
+	double position(double value) const {return quantize(value, m_position_exponent);} // position or ctau in mm
+
+	// same with the precision fixed at compile time, for loops specialized on it. Precision must be the precision of the quantizer
+	template<StoragePrecision Precision> double momentum(double value) const {return quantize<Precision>(value, m_momentum_exponent);}
+	template<StoragePrecision Precision> double position(double value) const {return quantize<Precision>(value, m_position_exponent);}
+
+	StoragePrecision precision() const {return m_precision;}
+	double momentum_step() const {return std::ldexp(1., m_momentum_exponent);} // effective grid step of the fixed precision
+	double position_step() const {return std::ldexp(1., m_position_exponent);}
+
+	// human readable precision guarantee
+	std::string describe() const {
+		switch(m_precision) {
+			case StoragePrecision::Full: return "full";
+			case StoragePrecision::Fixed: {
+				std::ostringstream description;
+				description << "fixed (momentum error <= " << momentum_step() / 2. << " GeV, position error <= " << position_step() / 2. << " mm)";
+				return description.str();
+			}
+		}
+
+		return "unknown";
+	}
+
+private:
+	// exponent of the largest power of 2 not exceeding step
+	static int grid_exponent(double step) {
+		if(!(step > 0.)) {
+			throw std::invalid_argument("Quantization step must be positive");
+		}
+
+		return static_cast<int>(std::floor(std::log2(step)));
+	}
+
+	double quantize(double value, int exponent) const {
+		switch(m_precision) {
+			case StoragePrecision::Full: return quantize<StoragePrecision::Full>(value, exponent);
+			case StoragePrecision::Fixed: return quantize<StoragePrecision::Fixed>(value, exponent);
+		}
+
+		return value;
+	}
+
+	template<StoragePrecision Precision>
+	static double quantize(double value, int exponent) {
+		switch(Precision) {
+			case StoragePrecision::Full: return value;
+			case StoragePrecision::Fixed: return std::ldexp(std::round(std::ldexp(value, -exponent)), exponent); // scaling by a power of 2 is exact, so rounding is the only source of error
+		}
+
+		return value;
+	}
+
+	StoragePrecision m_precision;
+	int m_momentum_exponent; // the fixed grid step is 2^exponent
+	int m_position_exponent;
+};
+
+#endif // GENERATOR_QUANTIZATION_H
@@ -0,0 +1,159 @@
+/// podio::ROOTWriter that rolls over to a new output file once the current one holds a given number of events or bytes
+/// Shards are named after the output file with a four digit index inserted before the extension (output.root -> output.0000.root, output.0001.root, ...). If no limit is set the output file name is used as is, so the behaviour is the same as with a plain podio::ROOTWriter
+/// A manifest (output.manifest) listing every closed shard with its number of entries, event number range and size is rewritten whenever a shard is closed, so it stays valid even if the job crashes later on
+
+#ifndef GENERATOR_SHARDEDWRITER_H
+#define GENERATOR_SHARDEDWRITER_H
+
+// PODIO
+#include "podio/EventStore.h"
+#include "podio/ROOTWriter.h"
+
+// STL
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+
+// POSIX
+#include <sys/stat.h>
+
+class ShardedWriter {
+public:
+	// max_events and max_bytes equal to 0 mean no limit
+	ShardedWriter(std::string const & filename, podio::EventStore * store, std::size_t max_events = 0, std::size_t max_bytes = 0) : m_filename(filename), m_store(store), m_max_events(max_events), m_max_bytes(max_bytes) {
+		auto dot = m_filename.rfind('.');
+		auto slash = m_filename.rfind('/');
+		if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			dot = m_filename.size();
+		}
+		m_stem = m_filename.substr(0, dot);
+		m_extension = m_filename.substr(dot);
+
+		open_shard();
+	}
+
+	ShardedWriter(ShardedWriter const &) = delete;
+	ShardedWriter & operator=(ShardedWriter const &) = delete;
+
+	// registers the collection in the current shard and remembers to do the same for all the following ones
+	template<typename T>
+	void registerForWrite(std::string const & name) {
+		m_registrations.push_back([name](podio::ROOTWriter & writer) {writer.registerForWrite<T>(name);});
+		if(m_writer) {
+			m_registrations.back()(*m_writer);
+		}
+	}
+
+	// writes the current content of the store. "number" is the event number stored in EventInfo, it is only used for the manifest
+	void writeEvent(int number) {
+		if(!m_writer) {
+			open_shard();
+		}
+
+		m_writer->writeEvent();
+
+		auto & shard = m_shards.back();
+		if(shard.entries == 0) {
+			shard.first_event = number;
+		}
+		shard.last_event = number;
+		++shard.entries;
+
+		if(is_sharded() && ((m_max_events > 0 && shard.entries >= m_max_events) || (m_max_bytes > 0 && file_size(shard.filename) >= m_max_bytes))) {
+			close_shard(); // the next shard is opened lazily so that no empty file is left behind at the end of the run
+		}
+	}
+
+	void finish() {
+		if(m_writer) {
+			close_shard();
+		}
+	}
+
+	bool is_sharded() const {return m_max_events > 0 || m_max_bytes > 0;}
+	std::string const & current_filename() const {return m_shards.back().filename;} // the file being written to (or the last one written)
+	std::size_t shards() const {return m_shards.size();}
+	std::size_t next_shard() const {return m_writer ? m_shards.size() - 1 : m_shards.size();} // index of the shard the next event goes to
+	std::size_t next_entry() const {return m_writer ? m_shards.back().entries : 0;} // entry number of the next event in its shard
+	std::string manifest_filename() const {return m_stem + ".manifest";}
+
+	// bytes on disk of the closed shards, i.e. of the whole output after finish()
+	std::size_t bytes() const {
+		std::size_t total = 0;
+		for(auto const & shard : m_shards) {
+			total += shard.bytes;
+		}
+
+		return total;
+	}
+
+private:
+	struct Shard {
+		std::string filename;
+		std::size_t entries;
+		int first_event;
+		int last_event;
+		std::size_t bytes;
+	};
+
+	// bytes already on disk. ROOT writes baskets in clusters, so a shard can overshoot the size limit by up to one cluster
+	static std::size_t file_size(std::string const & filename) {
+		struct stat info;
+		return stat(filename.c_str(), &info) == 0 ? static_cast<std::size_t>(info.st_size) : 0;
+	}
+
+	void open_shard() {
+		std::string filename = m_filename;
+		if(is_sharded()) {
+			std::ostringstream name;
+			name << m_stem << '.' << std::setw(4) << std::setfill('0') << m_shards.size() << m_extension;
+			filename = name.str();
+		}
+
+		m_shards.push_back(Shard{filename, 0, 0, 0, 0});
+		m_writer.reset(new podio::ROOTWriter(filename, m_store));
+		for(auto const & registration : m_registrations) {
+			registration(*m_writer);
+		}
+	}
+
+	void close_shard() {
+		m_writer->finish();
+		m_writer.reset();
+
+		m_shards.back().bytes = file_size(m_shards.back().filename);
+		if(is_sharded()) {
+			write_manifest();
+		}
+	}
+
+	void write_manifest() const {
+		std::ofstream manifest(manifest_filename());
+		if(!manifest) {
+			throw std::runtime_error("Unable to write shard manifest " + manifest_filename());
+		}
+
+		manifest << "# shard entries first_event last_event bytes" << std::endl;
+		for(auto const & shard : m_shards) { // the manifest is only written right after closing a shard, so every shard in the list is closed
+			manifest << shard.filename << ' ' << shard.entries << ' ' << shard.first_event << ' ' << shard.last_event << ' ' << shard.bytes << std::endl;
+		}
+	}
+
+	std::string m_filename; // output file name as given by the user
+	std::string m_stem; // output file name without extension
+	std::string m_extension; // output file extension (including the dot)
+	podio::EventStore * m_store;
+	std::size_t m_max_events;
+	std::size_t m_max_bytes;
+	std::unique_ptr<podio::ROOTWriter> m_writer; // null between closing a shard and writing the first event of the next one
+	std::vector<Shard> m_shards;
+	std::vector<std::function<void(podio::ROOTWriter &)>> m_registrations;
+};
+
+#endif // GENERATOR_SHARDEDWRITER_H
@@ -0,0 +1,144 @@
+/// Particles decayed by EvtGen in the signal-only mode
+/// EvtGen takes over every particle its decay file has decays for, though only the decay chains redefined in the user decay file need its models. In the signal-only mode every other particle of the decay file is excluded from EvtGen (EvtGenDecays::exclude), so PYTHIA decays it with its own, faster, tables
+/// The signal particles are the ones the user decay file defines decays for (Decay, CDecay and CopyDecay, aliases resolved to the particles they stand for) and the key particles with their antiparticles. An alias can't be decayed apart from the particle it stands for, so every such particle goes through EvtGen, not only the ones in the signal chain
+/// Names are mapped to PDG IDs with the EvtGen PDL file
+/// EvtGenDecays switches PYTHIA's own decays off for the particles it takes over when it is constructed, and exclude() only takes a particle off EvtGen's list afterwards, so decay_with_pythia switches PYTHIA's decays on again explicitly, for both charges. The validation checks that no B hadron is left undecayed in the signal-only mode
+
+#ifndef GENERATOR_SIGNALDECAYS_H
+#define GENERATOR_SIGNALDECAYS_H
+
+// PYTHIA and EvtGen
+#include "Pythia8/Pythia.h"
+#include "Pythia8Plugins/EvtGen.h"
+
+// STL
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <ostream>
+#include <stdexcept>
+
+// PDG IDs of the particles of an EvtGen PDL file by name. Particle lines read "add p Particle NAME ID MASS ..."
+inline std::map<std::string, int> read_pdl_ids(std::string const & filename) {
+	std::ifstream file(filename);
+	if(!file) {
+		throw std::runtime_error("Unable to open EvtGen PDL file \"" + filename + "\"");
+	}
+
+	std::map<std::string, int> ids;
+	for(std::string line; std::getline(file, line);) {
+		std::istringstream input(line);
+		std::string add, type, particle, name;
+		int id = 0;
+		if(input >> add >> type >> particle >> name >> id && add == "add" && particle == "Particle") {
+			ids[name] = id;
+		}
+	}
+
+	return ids;
+}
+
+// names of the particles an EvtGen decay file defines decays for, aliases resolved
+inline std::set<std::string> read_decayed_particles(std::string const & filename) {
+	std::ifstream file(filename);
+	if(!file) {
+		throw std::runtime_error("Unable to open EvtGen decay file \"" + filename + "\"");
+	}
+
+	std::map<std::string, std::string> aliases;
+	auto const resolve = [&aliases](std::string const & name) {
+		auto alias = aliases.find(name);
+		return alias != aliases.end() ? alias->second : name;
+	};
+
+	std::set<std::string> decayed;
+	bool in_decay = false; // decay channels are skipped, their daughters aren't decayed by the block
+	for(std::string line; std::getline(file, line);) {
+		std::istringstream input(line.substr(0, line.find('#')));
+		std::string keyword, name, other;
+		if(!(input >> keyword)) {
+			continue;
+		}
+
+		if(in_decay) {
+			in_decay = keyword != "Enddecay";
+		} else if(keyword == "Alias" && input >> name >> other) {
+			aliases[name] = other;
+		} else if((keyword == "Decay" || keyword == "CDecay" || keyword == "CopyDecay") && input >> name) {
+			decayed.insert(resolve(name));
+			in_decay = keyword == "Decay";
+		}
+	}
+
+	return decayed;
+}
+
+// makes PYTHIA (not EvtGen) decay the particle and its antiparticle
+inline void decay_with_pythia(EvtGenDecays & evtgen, Pythia8::ParticleData & particle_data, int pdg) {
+	evtgen.exclude(pdg);
+	evtgen.exclude(-pdg);
+	particle_data.mayDecay(pdg, true);
+	particle_data.mayDecay(-pdg, true);
+}
+
+class SignalDecays {
+public:
+	// "decfile" is the main decay file, whose particles EvtGen would decay otherwise
+	SignalDecays(std::string const & user_decfile, std::string const & decfile, std::string const & pdlfile, std::vector<int> const & keyptcs) : m_ids(read_pdl_ids(pdlfile)) {
+		for(auto const & name : read_decayed_particles(user_decfile)) {
+			m_signal.insert(id(name, user_decfile));
+		}
+		for(auto keyptc : keyptcs) {
+			m_signal.insert(keyptc);
+			m_signal.insert(-keyptc);
+		}
+
+		for(auto const & name : read_decayed_particles(decfile)) {
+			auto const pdg = id(name, decfile);
+			if(m_signal.find(pdg) == m_signal.end()) {
+				m_excluded.push_back(pdg);
+			}
+		}
+	}
+
+	std::set<int> const & signal() const {return m_signal;} // decayed by EvtGen
+	std::vector<int> const & excluded() const {return m_excluded;} // left to PYTHIA
+
+	// name in the PDL file
+	std::string name(int pdg) const {
+		for(auto const & entry : m_ids) {
+			if(entry.second == pdg) {
+				return entry.first;
+			}
+		}
+
+		return std::to_string(pdg);
+	}
+
+	void print(std::ostream & os) const {
+		os << "EvtGen decays " << m_signal.size() << " particles:";
+		for(auto pdg : m_signal) {
+			os << " " << name(pdg) << " (" << pdg << ")";
+		}
+		os << std::endl << m_excluded.size() << " particles of the EvtGen decay file are left to PYTHIA" << std::endl;
+	}
+
+private:
+	int id(std::string const & name, std::string const & filename) const {
+		auto entry = m_ids.find(name);
+		if(entry == m_ids.end()) {
+			throw std::runtime_error("Particle \"" + name + "\" of EvtGen decay file \"" + filename + "\" is not in the PDL file");
+		}
+
+		return entry->second;
+	}
+
+	std::map<std::string, int> m_ids;
+	std::set<int> m_signal;
+	std::vector<int> m_excluded;
+};
+
+#endif // GENERATOR_SIGNALDECAYS_H
@@ -0,0 +1,329 @@
+/// Live status of a running job
+/// The event loop updates the counters of a JobStatus (generated and stored events, time spent in every stage, time of the last event) with relaxed atomic stores, which cost next to nothing. A StatusReporter thread samples them periodically and publishes them in the Prometheus text format:
+/// 	status file - rewritten every interval through a temporary file and rename(), so a reader never sees a partial file
+/// 	Unix domain socket - every connection gets the current metrics and is closed. A client that starts with an HTTP GET request (e.g. curl --unix-socket) gets an HTTP response
+/// Rates are computed over the last interval, the ETA from the recent rate of stored events. The age of the last generated event makes a stalled job visible at the next poll
+/// Only the resident memory of the process is read by the reporter thread: the other memory components belong to ROOT objects that must not be touched from another thread
+
+#ifndef GENERATOR_STATUSREPORTER_H
+#define GENERATOR_STATUSREPORTER_H
+
+// Common utilities
+#include "MemoryMonitor.h"
+
+// STL
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+// POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// counters of the job, written by the event loop and read by the reporter
+class JobStatus {
+public:
+	enum Stage {
+		Generate, // PYTHIA generation and hadronization, or reading the input file
+		Decay, // EvtGen
+		Convert, // acceptance filter, conversion to HepMC and to the data model, observables
+		Write, // output file, stream, index
+		nstages
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	JobStatus() : generated(0), stored(0), target(0), m_last_event(Clock::now().time_since_epoch().count()) {
+		for(auto & ns : m_stage_ns) {
+			ns.store(0, std::memory_order_relaxed);
+		}
+	}
+
+	// adds the time since "start" to the stage and returns the current time, so that consecutive stages can be chained
+	Clock::time_point add_time(Stage stage, Clock::time_point start) {
+		auto const now = Clock::now();
+		m_stage_ns[stage].fetch_add(static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count()), std::memory_order_relaxed);
+		return now;
+	}
+
+	void event_generated(std::size_t total) {
+		generated.store(total, std::memory_order_relaxed);
+		m_last_event.store(Clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+	}
+
+	double stage_seconds(Stage stage) const {return static_cast<double>(m_stage_ns[stage].load(std::memory_order_relaxed)) * 1e-9;}
+	Clock::time_point last_event() const {return Clock::time_point(Clock::duration(m_last_event.load(std::memory_order_relaxed)));}
+
+	static char const * stage_name(Stage stage) {
+		switch(stage) {
+			case Generate: return "generate";
+			case Decay: return "decay";
+			case Convert: return "convert";
+			case Write: return "write";
+			case nstages: break;
+		}
+
+		return "unknown";
+	}
+
+	std::atomic<std::size_t> generated; // events generated so far
+	std::atomic<std::size_t> stored; // events with the key particle so far
+	std::atomic<std::size_t> target; // events with the key particle to generate
+
+private:
+	std::atomic<std::uint64_t> m_stage_ns[nstages];
+	std::atomic<Clock::rep> m_last_event; // time of the last generated event
+};
+
+class StatusReporter {
+public:
+	// "labels" are added to every metric, e.g. worker="3". Either the file or the socket may be empty
+	StatusReporter(JobStatus const & status, std::string const & filename, std::string const & socket_path, double interval, std::string const & labels = "") : m_status(status), m_filename(filename), m_socket_path(socket_path), m_interval(interval), m_labels(labels), m_listen_fd(-1), m_start(JobStatus::Clock::now()), m_finished(false) {
+		if(!(interval > 0.)) {
+			throw std::invalid_argument("The status interval must be positive");
+		}
+
+		if(pipe(m_wake_fds) != 0) {
+			throw std::runtime_error(std::string("Unable to create the status reporter pipe: ") + std::strerror(errno));
+		}
+		if(!m_socket_path.empty()) {
+			try {
+				m_listen_fd = listen_socket(m_socket_path);
+			} catch(...) {
+				close(m_wake_fds[0]);
+				close(m_wake_fds[1]);
+				throw;
+			}
+		}
+
+		m_previous = Sample{m_start, 0, 0};
+		m_current = m_previous;
+		write_file();
+
+		m_thread = std::thread(&StatusReporter::run, this);
+	}
+
+	StatusReporter(StatusReporter const &) = delete;
+	StatusReporter & operator=(StatusReporter const &) = delete;
+
+	~StatusReporter() {
+		stop();
+	}
+
+	// writes the final status (running 0) and stops the thread
+	void stop() {
+		if(!m_thread.joinable()) {
+			return;
+		}
+
+		char const byte = 0;
+		while(write(m_wake_fds[1], &byte, 1) < 0 && errno == EINTR) {}
+		m_thread.join();
+
+		close(m_wake_fds[0]);
+		close(m_wake_fds[1]);
+		if(m_listen_fd >= 0) {
+			close(m_listen_fd);
+			unlink(m_socket_path.c_str());
+		}
+	}
+
+private:
+	struct Sample {
+		JobStatus::Clock::time_point time;
+		std::size_t generated;
+		std::size_t stored;
+	};
+
+	static int listen_socket(std::string const & path) {
+		sockaddr_un address;
+		std::memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(address.sun_path)) {
+			throw std::invalid_argument("Socket path \"" + path + "\" is too long");
+		}
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fd < 0) {
+			throw std::runtime_error(std::string("Unable to create the status socket: ") + std::strerror(errno));
+		}
+		unlink(path.c_str()); // a socket left behind by a previous run
+		if(bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) < 0 || listen(fd, 8) < 0) {
+			close(fd);
+			throw std::runtime_error("Unable to listen on status socket \"" + path + "\": " + std::strerror(errno));
+		}
+
+		return fd;
+	}
+
+	void run() {
+		auto const interval = std::chrono::duration_cast<JobStatus::Clock::duration>(std::chrono::duration<double>(m_interval));
+		auto next_update = m_start + interval;
+
+		while(true) {
+			auto const wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_update - JobStatus::Clock::now()).count();
+
+			pollfd fds[2] = {{m_wake_fds[0], POLLIN, 0}, {m_listen_fd, POLLIN, 0}};
+			auto const ready = poll(fds, m_listen_fd >= 0 ? 2 : 1, static_cast<int>(std::max<long long>(wait, 0)));
+			if(ready < 0 && errno != EINTR) {
+				break;
+			}
+			if(ready > 0 && (fds[0].revents & POLLIN)) {
+				break; // stop() was called
+			}
+			if(ready > 0 && (fds[1].revents & POLLIN)) {
+				serve();
+			}
+
+			if(JobStatus::Clock::now() >= next_update) {
+				sample();
+				write_file();
+				next_update += interval;
+				if(next_update < JobStatus::Clock::now()) {
+					next_update = JobStatus::Clock::now() + interval; // a slow file system doesn't make the updates pile up
+				}
+			}
+		}
+
+		m_finished = true;
+		sample();
+		write_file();
+	}
+
+	void sample() {
+		m_previous = m_current;
+		m_current = Sample{JobStatus::Clock::now(), m_status.generated.load(std::memory_order_relaxed), m_status.stored.load(std::memory_order_relaxed)};
+	}
+
+	// answers one client of the socket. The request, if any, is only looked at to decide whether to answer in HTTP
+	void serve() {
+		int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if(fd < 0) {
+			return;
+		}
+
+		char request[16] = {};
+		pollfd client = {fd, POLLIN, 0};
+		if(poll(&client, 1, 100) > 0) {
+			auto n = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+			if(n < 0) {
+				n = 0;
+			}
+			request[n] = '\0';
+		}
+
+		auto response = metrics();
+		if(std::strncmp(request, "GET ", 4) == 0) {
+			response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(response.size()) + "\r\n\r\n" + response;
+		}
+
+		std::size_t sent = 0;
+		while(sent < response.size()) {
+			auto n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			if(n <= 0) {
+				break;
+			}
+			sent += static_cast<std::size_t>(n);
+		}
+		close(fd);
+	}
+
+	void write_file() const {
+		if(m_filename.empty()) {
+			return;
+		}
+
+		auto const temporary = m_filename + ".tmp";
+		{
+			std::ofstream file(temporary);
+			file << metrics();
+			if(!file) {
+				return; // the job goes on, the status is only informative
+			}
+		}
+		std::rename(temporary.c_str(), m_filename.c_str());
+	}
+
+	std::string metrics() const {
+		auto const elapsed = std::chrono::duration<double>(m_current.time - m_start).count();
+		auto const window = std::chrono::duration<double>(m_current.time - m_previous.time).count();
+		auto const generated_rate = window > 0. ? static_cast<double>(m_current.generated - m_previous.generated) / window : 0.;
+		auto const stored_rate = window > 0. ? static_cast<double>(m_current.stored - m_previous.stored) / window : 0.;
+		auto const mean_rate = elapsed > 0. ? static_cast<double>(m_current.stored) / elapsed : 0.;
+		auto const target = m_status.target.load(std::memory_order_relaxed);
+		auto const remaining = target > m_current.stored ? static_cast<double>(target - m_current.stored) : 0.;
+		auto const eta_rate = stored_rate > 0. ? stored_rate : mean_rate;
+		auto const eta = remaining > 0. ? (eta_rate > 0. ? remaining / eta_rate : std::numeric_limits<double>::quiet_NaN()) : 0.;
+
+		std::ostringstream out;
+		metric(out, "generator_running", "gauge", "1 while the job is generating, 0 once it has finished", m_finished ? 0. : 1.);
+		metric(out, "generator_events_generated_total", "counter", "Events generated", static_cast<double>(m_current.generated));
+		metric(out, "generator_events_stored_total", "counter", "Events with the key particle", static_cast<double>(m_current.stored));
+		metric(out, "generator_events_target", "gauge", "Events with the key particle to generate", static_cast<double>(target));
+		metric(out, "generator_generated_rate", "gauge", "Generated events per second over the last interval", generated_rate);
+		metric(out, "generator_stored_rate", "gauge", "Events with the key particle per second over the last interval", stored_rate);
+		metric(out, "generator_stored_mean_rate", "gauge", "Events with the key particle per second since the start", mean_rate);
+		metric(out, "generator_eta_seconds", "gauge", "Estimated time to completion (NaN if nothing has been stored yet)", eta);
+		metric(out, "generator_uptime_seconds", "gauge", "Time since the start of the job", elapsed);
+		metric(out, "generator_seconds_since_last_event", "gauge", "Time since the last generated event", std::chrono::duration<double>(m_current.time - m_status.last_event()).count());
+
+		out << "# HELP generator_stage_seconds_total Wall time spent in each stage of the event loop\n# TYPE generator_stage_seconds_total counter\n";
+		for(int stage = 0; stage < JobStatus::nstages; ++stage) {
+			out << "generator_stage_seconds_total{" << m_labels << (m_labels.empty() ? "" : ",") << "stage=\"" << JobStatus::stage_name(static_cast<JobStatus::Stage>(stage)) << "\"} " << m_status.stage_seconds(static_cast<JobStatus::Stage>(stage)) << '\n';
+		}
+
+		metric(out, "generator_memory_rss_bytes", "gauge", "Resident set size", static_cast<double>(MemoryMonitor::rss()));
+		metric(out, "generator_memory_peak_rss_bytes", "gauge", "Peak resident set size", static_cast<double>(MemoryMonitor::peak_rss()));
+
+		return out.str();
+	}
+
+	void metric(std::ostream & out, char const * name, char const * type, char const * help, double value) const {
+		out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n' << name;
+		if(!m_labels.empty()) {
+			out << '{' << m_labels << '}';
+		}
+		out << ' ';
+		if(std::isnan(value)) {
+			out << "NaN"; // the spelling of the text format
+		} else {
+			out.precision(15);
+			out << value;
+		}
+		out << '\n';
+	}
+
+	JobStatus const & m_status;
+	std::string m_filename;
+	std::string m_socket_path;
+	double m_interval; // seconds between file updates
+	std::string m_labels;
+	int m_listen_fd;
+	int m_wake_fds[2]; // stop() writes to the pipe to wake the thread up
+	JobStatus::Clock::time_point m_start;
+	Sample m_previous; // second to last sample, rates are computed between the two
+	Sample m_current;
+	bool m_finished; // written and read by the reporter thread only
+	std::thread m_thread;
+};
+
+#endif // GENERATOR_STATUSREPORTER_H
@@ -0,0 +1,261 @@
+/// CPU topology and placement of worker processes
+/// The topology is read from sysfs: the NUMA node of every CPU (/sys/devices/system/node/nodeN/cpulist) and its package and core (/sys/devices/system/cpu/cpuN/topology). Only the CPUs the process is allowed to run on are considered. Without NUMA information everything is on node 0
+/// Placement modes:
+/// 	none - workers are left to the scheduler
+/// 	compact - workers fill the physical cores of the first node, then their second hardware threads, then the next node, so that a few workers share one socket
+/// 	scatter - workers go round robin over the nodes (each node filled in compact order), so that every socket's memory bandwidth is used
+/// 	list - workers are pinned to the CPUs given by the user, in order
+/// If there are more workers than CPUs the placement wraps around
+/// A pinned process also switches to the local memory policy, so that everything it allocates afterwards (PYTHIA and HepMC event records, the event arena, podio collections, ROOT output buffers) lands on its own node whatever the default policy of the system is
+
+#ifndef GENERATOR_WORKERPLACEMENT_H
+#define GENERATOR_WORKERPLACEMENT_H
+
+// STL
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <tuple>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+// POSIX and Linux
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+enum class AffinityMode {
+	None,
+	Compact,
+	Scatter,
+	List
+};
+
+inline AffinityMode parse_affinity_mode(std::string const & name) {
+	if(name == "none") {
+		return AffinityMode::None;
+	}
+	if(name == "compact") {
+		return AffinityMode::Compact;
+	}
+	if(name == "scatter") {
+		return AffinityMode::Scatter;
+	}
+	if(name == "list") {
+		return AffinityMode::List;
+	}
+
+	throw std::invalid_argument("Unknown affinity mode \"" + name + "\". Possible values: none, compact, scatter, list");
+}
+
+inline std::string to_string(AffinityMode mode) {
+	switch(mode) {
+		case AffinityMode::None: return "none";
+		case AffinityMode::Compact: return "compact";
+		case AffinityMode::Scatter: return "scatter";
+		case AffinityMode::List: return "list";
+	}
+
+	return "unknown";
+}
+
+// CPU list in the kernel format, e.g. "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(std::string const & list) {
+	std::vector<int> cpus;
+
+	std::istringstream input(list);
+	std::string range;
+	while(std::getline(input, range, ',')) {
+		if(range.find_first_not_of(" \n") == std::string::npos) {
+			continue;
+		}
+
+		auto dash = range.find('-');
+		auto first = std::stoi(range.substr(0, dash));
+		auto last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+		if(first < 0 || last < first) {
+			throw std::invalid_argument("Invalid CPU range \"" + range + "\"");
+		}
+		for(auto cpu = first; cpu <= last; ++cpu) {
+			cpus.push_back(cpu);
+		}
+	}
+
+	return cpus;
+}
+
+struct CpuInfo {
+	int cpu;
+	int node;
+	int package;
+	int core;
+	int thread; // index of the CPU among the hardware threads of its core
+};
+
+class CpuTopology {
+public:
+	CpuTopology() {
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+			throw std::runtime_error("Unable to get the CPU affinity of the process");
+		}
+
+		auto node_of = read_nodes();
+		for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if(!CPU_ISSET(cpu, &allowed)) {
+				continue;
+			}
+
+			auto node = node_of.find(cpu);
+			auto const path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+			m_cpus.push_back(CpuInfo{cpu, node != node_of.end() ? node->second : 0, read_int(path + "physical_package_id", 0), read_int(path + "core_id", cpu), 0});
+		}
+
+		// numbering the hardware threads of every core
+		std::map<std::pair<int, int>, int> threads;
+		for(auto & info : m_cpus) {
+			info.thread = threads[std::make_pair(info.package, info.core)]++;
+		}
+
+		for(auto const & info : m_cpus) {
+			m_nodes = std::max(m_nodes, static_cast<std::size_t>(info.node) + 1);
+		}
+	}
+
+	std::vector<CpuInfo> const & cpus() const {return m_cpus;}
+	std::size_t nodes() const {return m_nodes;}
+
+	// node of the CPU, 0 if it is unknown
+	int node(int cpu) const {
+		for(auto const & info : m_cpus) {
+			if(info.cpu == cpu) {
+				return info.node;
+			}
+		}
+
+		return 0;
+	}
+
+private:
+	static int read_int(std::string const & path, int fallback) {
+		std::ifstream file(path);
+		int value = fallback;
+		if(!(file >> value)) {
+			return fallback;
+		}
+
+		return value;
+	}
+
+	// CPU -> node from /sys/devices/system/node/node*/cpulist
+	static std::map<int, int> read_nodes() {
+		std::map<int, int> node_of;
+
+		auto dir = opendir("/sys/devices/system/node");
+		if(!dir) {
+			return node_of;
+		}
+		while(auto entry = readdir(dir)) {
+			std::string const name = entry->d_name;
+			if(name.size() <= 4 || name.compare(0, 4, "node") != 0 || name.find_first_not_of("0123456789", 4) != std::string::npos) {
+				continue;
+			}
+
+			std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+			std::string list;
+			std::getline(file, list);
+			for(auto cpu : parse_cpu_list(list)) {
+				node_of[cpu] = std::stoi(name.substr(4));
+			}
+		}
+		closedir(dir);
+
+		return node_of;
+	}
+
+	std::vector<CpuInfo> m_cpus;
+	std::size_t m_nodes = 1;
+};
+
+struct WorkerSlot {
+	int cpu; // -1 if the worker is not pinned
+	int node;
+};
+
+// CPUs and nodes of the workers
+inline std::vector<WorkerSlot> plan_placement(CpuTopology const & topology, std::size_t nworkers, AffinityMode mode, std::vector<int> const & cpu_list) {
+	std::vector<WorkerSlot> slots;
+	if(mode == AffinityMode::None || topology.cpus().empty()) {
+		slots.assign(nworkers, WorkerSlot{-1, 0});
+		return slots;
+	}
+
+	std::vector<int> order; // CPUs in the order they are handed out
+	if(mode == AffinityMode::List) {
+		if(cpu_list.empty()) {
+			throw std::invalid_argument("The list affinity mode needs a CPU list");
+		}
+		for(auto cpu : cpu_list) {
+			if(std::none_of(topology.cpus().begin(), topology.cpus().end(), [cpu](CpuInfo const & info) {return info.cpu == cpu;})) {
+				throw std::invalid_argument("CPU " + std::to_string(cpu) + " is not available to the process");
+			}
+		}
+		order = cpu_list;
+	} else {
+		// compact order: node, then physical cores before their second hardware threads
+		auto cpus = topology.cpus();
+		std::sort(cpus.begin(), cpus.end(), [](CpuInfo const & a, CpuInfo const & b) {
+			return std::make_tuple(a.node, a.thread, a.package, a.core, a.cpu) < std::make_tuple(b.node, b.thread, b.package, b.core, b.cpu);
+		});
+
+		if(mode == AffinityMode::Compact) {
+			for(auto const & info : cpus) {
+				order.push_back(info.cpu);
+			}
+		} else {
+			std::vector<std::vector<int>> per_node(topology.nodes());
+			for(auto const & info : cpus) {
+				per_node[static_cast<std::size_t>(info.node)].push_back(info.cpu);
+			}
+			for(std::size_t i = 0; order.size() < cpus.size(); ++i) {
+				for(auto const & node : per_node) {
+					if(i < node.size()) {
+						order.push_back(node[i]);
+					}
+				}
+			}
+		}
+	}
+
+	for(std::size_t i = 0; i < nworkers; ++i) {
+		auto const cpu = order[i % order.size()];
+		slots.push_back(WorkerSlot{cpu, topology.node(cpu)});
+	}
+
+	return slots;
+}
+
+// pins the calling process to the CPU of the slot and makes its memory allocations node local. Returns false if the memory policy couldn't be set (e.g. the kernel has no NUMA support); the process is pinned anyway
+inline bool apply_placement(WorkerSlot const & slot) {
+	if(slot.cpu < 0) {
+		return true;
+	}
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(slot.cpu, &cpus);
+	if(sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+		throw std::runtime_error("Unable to pin the process to CPU " + std::to_string(slot.cpu));
+	}
+
+	int const mpol_local = 4; // MPOL_LOCAL from linux/mempolicy.h. Called through syscall() so that libnuma isn't needed
+	return syscall(SYS_set_mempolicy, mpol_local, nullptr, 0) == 0;
+}
+
+#endif // GENERATOR_WORKERPLACEMENT_H
@@ -0,0 +1,219 @@
+/// Worker processes of the parallel generation mode
+/// The parent forks one process per worker slot (see WorkerPlacement.h) and waits for them. PYTHIA, EvtGen and the ROOT writer are not thread safe, so every worker is a full generator process with its own seed, its own share of the events and its own output file (output.w03.root, sharded as usual). A worker pins itself to its slot before anything else is allocated, so its event records and output buffers live on its own node
+/// At the end of its run a worker sends a one line report (events with the key particle, generated events, elapsed time) to the parent through a pipe. The parent prints the throughput of every worker and of every NUMA node
+
+#ifndef GENERATOR_WORKERPOOL_H
+#define GENERATOR_WORKERPOOL_H
+
+// Common utilities
+#include "WorkerPlacement.h"
+
+// STL
+#include <cstddef>
+#include <cstdio>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+
+// POSIX
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+class WorkerPool {
+public:
+	explicit WorkerPool(std::vector<WorkerSlot> const & slots) : m_index(-1), m_report_fd(-1) {
+		for(auto const & slot : slots) {
+			m_workers.push_back(Worker{slot, -1, -1, false, -1, 0, 0, 0.});
+		}
+	}
+
+	WorkerPool(WorkerPool const &) = delete;
+	WorkerPool & operator=(WorkerPool const &) = delete;
+
+	// forks the workers. Returns the index of the worker in the worker processes, and -1 in the parent once all workers have exited
+	int run() {
+		std::cout.flush(); // buffered output would be printed by every worker otherwise
+		std::cerr.flush();
+
+		for(std::size_t i = 0; i < m_workers.size(); ++i) {
+			int fds[2];
+			if(pipe(fds) != 0) {
+				throw std::runtime_error("Unable to create the report pipe of worker " + std::to_string(i));
+			}
+
+			auto pid = fork();
+			if(pid < 0) {
+				throw std::runtime_error("Unable to start worker " + std::to_string(i));
+			}
+			if(pid == 0) {
+				// worker: only its own report pipe is kept
+				for(std::size_t j = 0; j < i; ++j) {
+					close(m_workers[j].fd);
+				}
+				close(fds[0]);
+
+				m_index = static_cast<int>(i);
+				m_report_fd = fds[1];
+				m_memory_local = apply_placement(m_workers[i].slot);
+				return m_index;
+			}
+
+			close(fds[1]);
+			m_workers[i].pid = pid;
+			m_workers[i].fd = fds[0];
+		}
+
+		// parent: collecting the reports. A worker that dies leaves an empty report behind
+		for(auto & worker : m_workers) {
+			std::string report;
+			char buffer[256];
+			ssize_t n;
+			while((n = read(worker.fd, buffer, sizeof(buffer))) != 0) {
+				if(n < 0) {
+					if(errno == EINTR) {
+						continue;
+					}
+					break;
+				}
+				report.append(buffer, static_cast<std::size_t>(n));
+			}
+			close(worker.fd);
+
+			std::istringstream input(report);
+			worker.reported = static_cast<bool>(input >> worker.events >> worker.generated >> worker.seconds);
+
+			while(waitpid(worker.pid, &worker.status, 0) < 0 && errno == EINTR) {}
+		}
+
+		return -1;
+	}
+
+	int index() const {return m_index;} // index of the current worker, -1 in the parent
+	WorkerSlot const & slot() const {return m_workers[static_cast<std::size_t>(m_index)].slot;} // slot of the current worker
+	bool memory_local() const {return m_memory_local;} // the local memory policy is in effect in the current worker
+	std::size_t size() const {return m_workers.size();}
+
+	// share of the events of the current worker
+	std::size_t share(std::size_t nevents) const {
+		auto const n = m_workers.size();
+		auto const i = static_cast<std::size_t>(m_index);
+		return nevents / n + (i < nevents % n ? 1 : 0);
+	}
+
+	// output file of the current worker: the worker index is inserted before the extension
+	std::string worker_filename(std::string const & filename) const {
+		return worker_filename(filename, m_index);
+	}
+
+	// output file of worker "index", used by the parent to collect what the workers wrote
+	static std::string worker_filename(std::string const & filename, int index) {
+		auto dot = filename.rfind('.');
+		auto slash = filename.rfind('/');
+		if(dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+			dot = filename.size();
+		}
+
+		char suffix[16];
+		std::snprintf(suffix, sizeof(suffix), ".w%02d", index);
+		return filename.substr(0, dot) + suffix + filename.substr(dot);
+	}
+
+	// called by the worker at the end of its run
+	void report(std::size_t events, std::size_t generated, double seconds) {
+		if(m_report_fd < 0) {
+			return;
+		}
+
+		std::ostringstream output;
+		output.precision(17);
+		output << events << ' ' << generated << ' ' << seconds << std::endl;
+		auto const line = output.str();
+		std::size_t written = 0;
+		while(written < line.size()) {
+			auto n = write(m_report_fd, line.data() + written, line.size() - written);
+			if(n < 0 && errno == EINTR) {
+				continue;
+			}
+			if(n <= 0) {
+				break;
+			}
+			written += static_cast<std::size_t>(n);
+		}
+		close(m_report_fd);
+		m_report_fd = -1;
+	}
+
+	// every worker has reported and exited successfully
+	bool succeeded() const {
+		for(auto const & worker : m_workers) {
+			if(!worker.reported || !WIFEXITED(worker.status) || WEXITSTATUS(worker.status) != 0) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	// throughput per worker and per node
+	void print(std::ostream & os) const {
+		struct Node {
+			std::size_t workers, events, generated;
+			double rate;
+		};
+		std::map<int, Node> nodes;
+		std::size_t events = 0, generated = 0;
+		double rate = 0.;
+
+		for(std::size_t i = 0; i < m_workers.size(); ++i) {
+			auto const & worker = m_workers[i];
+			os << "Worker " << i << " (" << (worker.slot.cpu >= 0 ? "CPU " + std::to_string(worker.slot.cpu) + ", node " + std::to_string(worker.slot.node) : "not pinned") << "): ";
+			if(!worker.reported) {
+				os << "failed" << (WIFSIGNALED(worker.status) ? " (signal " + std::to_string(WTERMSIG(worker.status)) + ")" : "") << std::endl;
+				continue;
+			}
+
+			auto const worker_rate = worker.seconds > 0. ? static_cast<double>(worker.events) / worker.seconds : 0.;
+			os << worker.events << " events (" << worker.generated << " total) in " << worker.seconds << " s, " << worker_rate << " ev / s" << std::endl;
+
+			auto & node = nodes[worker.slot.node];
+			++node.workers;
+			node.events += worker.events;
+			node.generated += worker.generated;
+			node.rate += worker_rate;
+			events += worker.events;
+			generated += worker.generated;
+			rate += worker_rate;
+		}
+
+		if(nodes.size() > 1) {
+			for(auto const & node : nodes) {
+				os << "Node " << node.first << ": " << node.second.workers << " workers, " << node.second.events << " events (" << node.second.generated << " total), " << node.second.rate << " ev / s (" << node.second.rate / static_cast<double>(node.second.workers) << " per worker)" << std::endl;
+			}
+		}
+		os << "All workers: " << events << " events (" << generated << " total), " << rate << " ev / s" << std::endl;
+	}
+
+private:
+	struct Worker {
+		WorkerSlot slot;
+		pid_t pid;
+		int fd; // read end of the report pipe
+		bool reported;
+		int status; // wait status
+		std::size_t events; // events with the key particle
+		std::size_t generated;
+		double seconds;
+	};
+
+	std::vector<Worker> m_workers;
+	int m_index;
+	int m_report_fd; // write end of the report pipe of the current worker
+	bool m_memory_local = false;
+};
+
+#endif // GENERATOR_WORKERPOOL_H
@@ -0,0 +1,54 @@
+/// Access to the TTree behind a podio::ROOTWriter
+/// podio does not expose the tree it writes to, but it lives in the output TFile under the name "events", so it can be looked up by the output file name. Used for memory accounting and for flushing the writer buffers
+
+#ifndef GENERATOR_WRITERTREE_H
+#define GENERATOR_WRITERTREE_H
+
+// STL
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+
+// ROOT
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+#include "TBranch.h"
+#include "TLeaf.h"
+#include "TObjArray.h"
+
+// returns the tree podio::ROOTWriter writes to file "filename" or nullptr if the file is not open
+inline TTree * find_writer_tree(std::string const & filename) {
+	auto file = dynamic_cast<TFile *>(gROOT->GetListOfFiles()->FindObject(filename.c_str()));
+
+	return file ? dynamic_cast<TTree *>(file->Get("events")) : nullptr;
+}
+
+// estimate of the memory held by the basket buffers of the tree
+inline std::size_t tree_buffer_bytes(TTree * tree) {
+	if(!tree) {
+		return 0;
+	}
+
+	std::size_t bytes = 0;
+	std::unordered_set<TBranch *> seen; // several leaves may share a branch
+	auto leaves = tree->GetListOfLeaves();
+	for(int i = 0, n = leaves->GetEntriesFast(); i < n; ++i) {
+		auto branch = static_cast<TLeaf *>(leaves->UncheckedAt(i))->GetBranch();
+		if(seen.insert(branch).second) {
+			bytes += static_cast<std::size_t>(branch->GetBasketSize());
+		}
+	}
+
+	return bytes;
+}
+
+// writes the pending baskets of the tree to the file and deletes them. FlushBaskets alone keeps the basket buffers allocated for the next entries, so nothing would be freed; the dropped baskets are allocated again, at their nominal size, by the next Fill
+inline void flush_writer_tree(TTree * tree) {
+	if(tree) {
+		tree->FlushBaskets();
+		tree->DropBaskets();
+	}
+}
+
+#endif // GENERATOR_WRITERTREE_H
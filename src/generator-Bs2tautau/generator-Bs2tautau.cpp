@@ -6,6 +6,11 @@
 // Configuration
 #include "GeneratorConfig.h"
 
+// Common utilities
+#include "EventArena.h"
+#include "HepMCConverter.h"
+#include "Cutflow.h"
+
 // PODIO
 #include "podio/EventStore.h"
 #include "podio/ROOTWriter.h"
@@ -23,7 +28,6 @@
 #include <string>
 #include <cstdlib>
 #include <stdexcept>
-#include <unordered_map>
 #include <cmath>
 #include <chrono>
 #include <algorithm>
@@ -52,9 +56,12 @@ int main(int argc, char * argv[]){
 	std::string evtgen_user_decfile = "B2tautau.dec"; // user defined decays
 	std::string output_filename = "output.root"; // name of the output file
 	std::size_t verbosity = 0; // verbosity level
+	PersistencePolicy persistence_policy = PersistencePolicy::Full; // which particles of the event are stored
 
 	#ifdef USE_BOOST
 		try {
+			std::string persistence_policy_name; // persistence policy as given on the command line
+
 			boost::program_options::options_description desc("Usage");
 
 			// defining command line options. See boost::program_options documentation for more details
@@ -66,6 +73,7 @@ int main(int argc, char * argv[]){
 							("evtgendec", boost::program_options::value<std::string>(&evtgen_decfile)->default_value(evtgen_root + "/share/DECAY_2010.DEC"), "EvtGen decay file")
 							("evtgenpdl", boost::program_options::value<std::string>(&evtgen_pdlfile)->default_value(evtgen_root + "/share/evt.pdl"), "EvtGen PDL file")
 							("outfile,o", boost::program_options::value<std::string>(&output_filename)->default_value("output.root"), "Output file")
+							("persist", boost::program_options::value<std::string>(&persistence_policy_name)->default_value("full"), "Which particles to store: full, signal-tree+stable, stable-only, signal-tree-only. The signal tree is the decay tree of the B_s")
 							("verbosity,v", boost::program_options::value<std::size_t>(&verbosity)->implicit_value(1), "Set verbosity level (0, 1, 2)")
 			;
 			boost::program_options::variables_map vm;
@@ -82,6 +90,8 @@ int main(int argc, char * argv[]){
 			if(vm.find("verbosity") != vm.end()) {
 				verbosity = vm.at("verbosity").as<size_t>();
 			}
+
+			persistence_policy = parse_persistence_policy(persistence_policy_name);
 		} catch(std::exception const & e) {
 			std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
 
@@ -158,15 +168,22 @@ int main(int argc, char * argv[]){
 		return EXIT_FAILURE;
 	}
 
+	ParticleTable const particle_table(pythia.particleData); // particle properties of the conversion, after EvtGen has updated the particle data
+
 	// interface for conversion from Pythia8::Event to HepMC event.
 	HepMC::Pythia8ToHepMC ToHepMC;
 
+	EventArena arena; // memory for per-event scratch containers. Rewound after every event
+
 	auto generation_start_time = std::chrono::system_clock::now(); // time of beginning of the generation
 	auto last_timestamp = generation_start_time; // time of last time check
 
 	std::size_t counter = 0; // number of events containing "key" particle generated so far
 	std::size_t total = 0; // total number of events generated so far
 
+	Cutflow cutflow("the B^0_s selection");
+	auto const key_step = cutflow.add("one B^0_s at production");
+
 	while(counter < nevents) {
 		if(pythia.next()) {
 			++total;
@@ -179,7 +196,8 @@ int main(int argc, char * argv[]){
 			// converting generated event to HepMC format
 			ToHepMC.fill_next_event(pythia, hepmcevt);
 
-			if(std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), [](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == 531 && isBAtProduction(ptc_ptr);}) == 1) {
+			auto const selected = cutflow.apply(key_step, [hepmcevt]() {return std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), [](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == 531 && isBAtProduction(ptc_ptr);}) == 1;});
+			if(selected) {
 				++counter;
 
 				if(verbosity >= 2) {
@@ -203,42 +221,11 @@ int main(int argc, char * argv[]){
 				evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
 				evinfocoll.push_back(evinfo);
 
-				// filling vertices
-				std::unordered_map<HepMC::GenVertex *, fcc::GenVertex> vtx_map;
-				for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
-					auto vtx = fcc::GenVertex();
-					vtx.Position().X = (*iv)->position().x();
-					vtx.Position().Y = (*iv)->position().y();
-					vtx.Position().Z = (*iv)->position().z();
-					vtx.Ctau((*iv)->position().t());
-					vtx_map.emplace(*iv, vtx);
-
-					vcoll.push_back(vtx);
-				}
-
-				// filling particles
-				for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
-					auto ptc = fcc::MCParticle();
-					auto & core = ptc.Core();
-					core.Type = (*ip)->pdg_id();
-					core.Status = (*ip)->status();
-
-					core.Charge = pythia.particleData.charge(core.Type); // PYTHIA returns charge as a double value (in case it's quark), so here's a narrowing conversion (double to int), but here it's safe
-					core.P4.Mass = (*ip)->momentum().m();
-					core.P4.Px = (*ip)->momentum().px();
-					core.P4.Py = (*ip)->momentum().py();
-					core.P4.Pz = (*ip)->momentum().pz();
-
-					auto prodvtx = vtx_map.find((*ip)->production_vertex());
-					if(prodvtx != vtx_map.end()) {
-						ptc.StartVertex(prodvtx->second);
-					}
-					auto endvtx = vtx_map.find((*ip)->end_vertex());
-					if(endvtx != vtx_map.end()) {
-						ptc.EndVertex(endvtx->second);
-					}
+				// filling vertices and particles
+				convert_event(hepmcevt, particle_table, pcoll, vcoll, arena, persistence_policy, Quantizer(), [](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == 531 && isBAtProduction(ptc_ptr);});
 
-					if(verbosity >= 2) {
+				if(verbosity >= 2) {
+					for(auto const & ptc : pcoll) {
 						auto const & pdg_id = ptc.Core().Type;
 						std::cout << "Stored particle: " << pdg_id << std::endl;
 
@@ -264,9 +251,7 @@ int main(int argc, char * argv[]){
 
 							std::cout << "\tFlight distance: " << std::sqrt((evtx.X - svtx.X) * (evtx.X - svtx.X) + (evtx.Y - svtx.Y) * (evtx.Y - svtx.Y) + (evtx.Z - svtx.Z) * (evtx.Z - svtx.Z)) << "mm" << std::endl;
 						}
-
 					}
-					pcoll.push_back(ptc);
 				}
 
 				writer.writeEvent();
@@ -278,6 +263,7 @@ int main(int argc, char * argv[]){
 				delete hepmcevt;
 				hepmcevt = nullptr;
 			}
+			arena.reset();
 		}
 	}
 
@@ -292,6 +278,7 @@ int main(int argc, char * argv[]){
 	}
 
 	std::cout << counter << " events with production of B^0_s have been generated (" << total << " total)." << std::endl;
+	cutflow.print(std::cout);
 	std::cout << "Elapsed time: " << elapsed_time << " s. Mean rate: " << static_cast<long double>(counter) / static_cast<long double>(elapsed_time) << " ev / s." << std::endl;
 
 	return EXIT_SUCCESS;
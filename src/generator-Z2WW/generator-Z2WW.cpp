@@ -1,12 +1,20 @@
 /// Generator of Z -> W+ (-> l+ nu_l) W- (-> l- nu_l) decays
 /// Uses PYTHIA to generate initial collision and to decay produced particles
-/// Stores only events both neutrino's momenta less than 1 GeV
+/// Stores only events with both neutrino's momenta less than 1 GeV (see NeutrinoVeto.h), cut on the final event record. With --early-veto events are vetoed at W decay time already, before showering and hadronization, which is faster but can bias the sample
 /// Uses FCC-ee data model and HepMC event model as intermediate layer to transfer data from PYTHIA to PODIO (that takes care of storing data)
 /// Stores data in a ROOT file
 
 // Configuration
 #include "GeneratorConfig.h"
 
+// Common utilities
+#include "EventArena.h"
+#include "HepMCConverter.h"
+#include "MemoryMonitor.h"
+#include "WriterTree.h"
+#include "Cutflow.h"
+#include "NeutrinoVeto.h"
+
 // PODIO
 #include "podio/EventStore.h"
 #include "podio/ROOTWriter.h"
@@ -26,8 +34,6 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <chrono>
-#include <map>
-#include <unordered_map>
 #include <algorithm>
 
 // PYTHIA and HepMC
@@ -39,17 +45,17 @@
 	#include "boost/program_options.hpp"
 #endif
 
-// // utility function to determine whether a particle leaves a charged track
-// inline bool is_charged_track(HepMC::GenParticle const * const ptc_ptr) {
-// 	return std::abs(ptc_ptr->pdg_id()) == 211 /* pions */ || std::abs(ptc_ptr->pdg_id()) == 321 /* kaons */ || std::abs(ptc_ptr->pdg_id()) == 2212 /* protons */ || std::abs(ptc_ptr->pdg_id()) == 11 /* electrons */ || std::abs(ptc_ptr->pdg_id()) == 13 /* muons */;
-// }
-
 int main(int argc, char * argv[]){
 	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the number of events to generate; other variables will use the values set below
 	std::size_t nevents = 0; // number of events to generate
 	std::string pythia_cfgfile = "Z2WW.cmnd"; // name of PYTHIA cofiguration file
 	std::string output_filename = "Z2WW.root"; // name of the output file
 	bool verbose = false; // increased verbosity switch
+	std::size_t memory_budget = 0; // memory budget in MB, 0 means no limit
+	std::size_t memory_check_interval = 1000; // memory usage is checked every memory_check_interval generated events
+	double max_neutrino_p = 1.; // events are stored only if both neutrinos of the W decays are below this momentum (GeV)
+	bool early_veto = false; // veto events at W decay time already. Faster, but can bias the sample
+	double veto_margin = 0.5; // the early veto uses the cut plus this margin (GeV), as the momenta still change in the shower
 
 	#ifdef USE_BOOST
 		try {
@@ -62,6 +68,11 @@ int main(int argc, char * argv[]){
 							("pythiacfg,P", boost::program_options::value<std::string>(&pythia_cfgfile)->default_value("Z2WW.cmnd"), "PYTHIA config file")
 							("outfile,o", boost::program_options::value<std::string>(&output_filename)->default_value("Z2WW.root"), "Output file")
 							("verbose,v", boost::program_options::bool_switch()->default_value(false), "Run with increased verbosity")
+							("memory-budget", boost::program_options::value<std::size_t>(&memory_budget)->default_value(0), "Memory budget in MB. Buffers are flushed when RSS approaches it and generation stops cleanly if it is exceeded (0 means no limit)")
+							("memory-check", boost::program_options::value<std::size_t>(&memory_check_interval)->default_value(1000), "Check memory usage every N generated events (0 disables the checks)")
+							("max-nu-p", boost::program_options::value<double>(&max_neutrino_p)->default_value(1.), "Store only events with both neutrinos of the W decays below this momentum in GeV")
+							("early-veto", boost::program_options::bool_switch(&early_veto), "Veto events at W decay time already, before showering and hadronization, with --max-nu-p plus --veto-margin. Much faster, but events the shower would have brought below the cut from above the margin are lost, so the sample can be biased. The end of run summary states this and reports how much of the margin the accepted events needed")
+							("veto-margin", boost::program_options::value<double>(&veto_margin)->default_value(0.5), "Margin in GeV added to --max-nu-p by --early-veto, since the shower still changes the neutrino momenta")
 			;
 			boost::program_options::variables_map vm;
 			boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
@@ -124,104 +135,104 @@ int main(int argc, char * argv[]){
 	Pythia8::Pythia pythia; // creating PYTHIA generator object
 	pythia.readFile(pythia_cfgfile); // reading settings from file
 
+	// with the early veto events are vetoed right after the W decays, so the rejected ones are neither showered nor hadronized
+	Cutflow cutflow("the Z -> W W selection");
+	NeutrinoMomentumVeto neutrino_veto(max_neutrino_p, veto_margin, early_veto, &cutflow);
+	auto const neutrino_step = cutflow.add("neutrino momenta");
+	pythia.setUserHooksPtr(&neutrino_veto);
+
 	pythia.init(); // initializing PYTHIA generator
 
+	ParticleTable const particle_table(pythia.particleData); // particle properties of the conversion
+
 	// Interface for conversion from Pythia8::Event to HepMC event.
 	HepMC::Pythia8ToHepMC ToHepMC;
 
+	EventArena arena; // memory for per-event scratch containers. Rewound after every event
+
 	std::size_t counter = 0; // number of "interesting" (that satisfy all the requirements) events generated so far
 	std::size_t total = 0; // total number of events generated so far
 
+	// setting up memory accounting
+	MemoryMonitor memory_monitor(memory_budget * 1024 * 1024);
+	std::size_t last_event_entries = 0; // number of entries in the store collections of the last stored event
+	memory_monitor.add_component("store collections", [&last_event_entries]() {return last_event_entries * approx_podio_object_bytes;});
+	memory_monitor.add_component("writer buffers", [&output_filename]() {return tree_buffer_bytes(find_writer_tree(output_filename));});
+	memory_monitor.set_flush_action([&output_filename]() {flush_writer_tree(find_writer_tree(output_filename));});
+	bool memory_exhausted = false; // set if the memory budget is exceeded. Generation is stopped then
+
 	if(verbose) {
 		std::cout << "Starting to generate events" << std::endl;
 	}
 
-	// std::map<std::size_t, std::size_t> stable_ptcs_count;
-
 	while(counter < nevents) {
 		if(pythia.next()) {
 			++total;
-			++counter;
 
-			// creating HepMC event storage
-			HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+			// exact cut on the final momenta. The events vetoed at W decay time don't get here
+			if(cutflow.apply(neutrino_step, [&neutrino_veto, &pythia]() {return neutrino_veto.accept(pythia.event);})) {
+				++counter;
 
-			// converting generated event to HepMC format
-			ToHepMC.fill_next_event(pythia, hepmcevt);
+				// creating HepMC event storage
+				HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
 
-			hepmcevt->print();
+				// converting generated event to HepMC format
+				ToHepMC.fill_next_event(pythia, hepmcevt);
 
-			// auto nstable = std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), [](HepMC::GenParticle const * const ptc_ptr) {return ptc_ptr->status() == 1;});
+				if(verbose) {
+					hepmcevt->print();
+				}
 
-			// if(nstable <= 7) {
-			// 	stable_ptcs_count[nstable]++;
-			// 	++counter;
+				if(verbose && counter % 100 == 0) {
+					std::cout << counter << " events with both neutrinos below " << max_neutrino_p << " GeV have been generated (" << total << " total). " << std::chrono::duration<double>(std::chrono::system_clock::now() - last_timestamp).count() / 100 << "events / sec" << std::endl;
+					last_timestamp = std::chrono::system_clock::now();
+				}
 
-			if(verbose && counter % 100 == 0) {
-				std::cout << counter << " events with with 7 or less particles in the final state have been generated (" << total << " total). " << std::chrono::duration<double>(std::chrono::system_clock::now() - last_timestamp).count() / 100 << "events / sec" << std::endl;
-				last_timestamp = std::chrono::system_clock::now();
-			}
+				// filling event info
+				auto evinfo = fcc::EventInfo();
+				evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
+				evinfocoll.push_back(evinfo);
 
-			// filling event info
-			auto evinfo = fcc::EventInfo();
-			evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
-			evinfocoll.push_back(evinfo);
-
-			// filling vertices
-			std::unordered_map<HepMC::GenVertex *, fcc::GenVertex> vtx_map;
-			for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
-				auto vtx = fcc::GenVertex();
-				vtx.Position().X = (*iv)->position().x();
-				vtx.Position().Y = (*iv)->position().y();
-				vtx.Position().Z = (*iv)->position().z();
-				vtx.Ctau((*iv)->position().t());
-				vtx_map.emplace(*iv, vtx);
-
-				vcoll.push_back(vtx);
-			}
+				// filling vertices and particles
+				convert_event(hepmcevt, particle_table, pcoll, vcoll, arena);
 
-			// filling particles
-			for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
-				auto ptc = fcc::MCParticle();
-				auto & core = ptc.Core();
-				core.Type = (*ip)->pdg_id();
-				core.Status = (*ip)->status();
-
-				core.Charge = pythia.particleData.charge(core.Type); // PYTHIA returns charge as a double value (in case it's quark), so here's a narrowing conversion (double to int), but here it's safe
-				core.P4.Mass = (*ip)->momentum().m();
-				core.P4.Px = (*ip)->momentum().px();
-				core.P4.Py = (*ip)->momentum().py();
-				core.P4.Pz = (*ip)->momentum().pz();
-
-				auto prodvtx = vtx_map.find((*ip)->production_vertex());
-				if(prodvtx != vtx_map.end()) {
-					ptc.StartVertex(prodvtx->second);
-				}
-				auto endvtx = vtx_map.find((*ip)->end_vertex());
-				if(endvtx != vtx_map.end()) {
-					ptc.EndVertex(endvtx->second);
-				}
+				last_event_entries = evinfocoll.size() + pcoll.size() + vcoll.size();
 
-				pcoll.push_back(ptc);
+				writer.writeEvent();
+				store.clearCollections();
+
+				// freeing resources
+				if(hepmcevt) {
+					delete hepmcevt;
+					hepmcevt = nullptr;
+				}
+				arena.reset();
 			}
 
-			writer.writeEvent();
-			store.clearCollections();
-			// }
+			// keeping an eye on memory usage
+			if(memory_check_interval > 0 && total % memory_check_interval == 0) {
+				if(verbose) {
+					memory_monitor.print(std::cout);
+				}
 
-			// freeing resources
-			if(hepmcevt) {
-				delete hepmcevt;
-				hepmcevt = nullptr;
+				if(memory_monitor.check() == MemoryMonitor::Status::Exceeded) {
+					std::cerr << "Memory budget of " << memory_budget << " MB exceeded even after flushing. Stopping generation" << std::endl;
+					memory_exhausted = true;
+					break;
+				}
 			}
 		}
 	}
 
 	writer.finish();
 
-	std::cout << counter << " events have been generated (" << total << " total)." << std::endl;
+	std::cout << counter << " events with both neutrinos below " << max_neutrino_p << " GeV have been generated (" << total << (early_veto ? " total after the early veto" : " total") << ")." << std::endl;
+	neutrino_veto.print(std::cout);
+	cutflow.print(std::cout);
 	auto elapsed_seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - start_time).count();
 	std::cout << "Elapsed time: " << elapsed_seconds << " s (" << static_cast<long double>(counter) / static_cast<long double>(elapsed_seconds) << " events / s)" << std::endl;
+	memory_monitor.print(std::cout);
+	memory_monitor.print_flushes(std::cout);
 
-	return EXIT_SUCCESS;
+	return memory_exhausted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -1,12 +1,20 @@
 /// Generator of Z -> u ubar decays
 /// Uses PYTHIA to generate initial collision and to decay produced particles
-/// Stores only events with less than 7 particles in the final state
+/// Stores only events with 7 or less particles in the final state. The multiplicity is checked on the PYTHIA event record, before the hadron decays and again after them, so rejected events are neither decayed nor converted
 /// Uses FCC-ee data model and HepMC event model as intermediate layer to transfer data from PYTHIA to PODIO (that takes care of storing data)
 /// Stores data in a ROOT file
 
 // Configuration
 #include "GeneratorConfig.h"
 
+// Common utilities
+#include "EventArena.h"
+#include "HepMCConverter.h"
+#include "MemoryMonitor.h"
+#include "WriterTree.h"
+#include "Histogram.h"
+#include "Cutflow.h"
+
 // PODIO
 #include "podio/EventStore.h"
 #include "podio/ROOTWriter.h"
@@ -26,8 +34,8 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <chrono>
-#include <map>
-#include <unordered_map>
+#include <fstream>
+#include <memory>
 #include <algorithm>
 
 // PYTHIA and HepMC
@@ -39,17 +47,15 @@
 	#include "boost/program_options.hpp"
 #endif
 
-// utility function to determine whether a particle leaves a charged track
-inline bool is_charged_track(HepMC::GenParticle const * const ptc_ptr) {
-	return std::abs(ptc_ptr->pdg_id()) == 211 /* pions */ || std::abs(ptc_ptr->pdg_id()) == 321 /* kaons */ || std::abs(ptc_ptr->pdg_id()) == 2212 /* protons */ || std::abs(ptc_ptr->pdg_id()) == 11 /* electrons */ || std::abs(ptc_ptr->pdg_id()) == 13 /* muons */;
-}
-
 int main(int argc, char * argv[]){
 	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the number of events to generate; other variables will use the values set below
 	std::size_t nevents = 0; // number of events to generate
 	std::string pythia_cfgfile = "Z2uubar.cmnd"; // name of PYTHIA cofiguration file
 	std::string output_filename = "Z2uubar.root"; // name of the output file
+	std::string analysis_filename; // analysis mode: the multiplicity histogram is written to this file and no events are stored
 	bool verbose = false; // increased verbosity switch
+	std::size_t memory_budget = 0; // memory budget in MB, 0 means no limit
+	std::size_t memory_check_interval = 1000; // memory usage is checked every memory_check_interval generated events
 
 	#ifdef USE_BOOST
 		try {
@@ -61,7 +67,10 @@ int main(int argc, char * argv[]){
 							("nevents,n", boost::program_options::value<std::size_t>(&nevents), "number of events to generate")
 							("pythiacfg,P", boost::program_options::value<std::string>(&pythia_cfgfile)->default_value("Z2uubar.cmnd"), "PYTHIA config file")
 							("outfile,o", boost::program_options::value<std::string>(&output_filename)->default_value("Z2uubar.root"), "Output file")
+							("analysis", boost::program_options::value<std::string>(&analysis_filename), "Analysis mode: only fill the histogram of the number of stable particles and write it to this file instead of storing the events")
 							("verbose,v", boost::program_options::bool_switch()->default_value(false), "Run with increased verbosity")
+							("memory-budget", boost::program_options::value<std::size_t>(&memory_budget)->default_value(0), "Memory budget in MB. Buffers are flushed when RSS approaches it and generation stops cleanly if it is exceeded (0 means no limit)")
+							("memory-check", boost::program_options::value<std::size_t>(&memory_check_interval)->default_value(1000), "Check memory usage every N generated events (0 disables the checks)")
 			;
 			boost::program_options::variables_map vm;
 			boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
@@ -103,18 +112,23 @@ int main(int argc, char * argv[]){
 		std::cout << "Prepairing data store" << std::endl;
 	}
 
-	// prepairing event store
+	// prepairing event store. No output file is created in the analysis mode
 	podio::EventStore store;
-	podio::ROOTWriter writer(output_filename, &store);
+	std::unique_ptr<podio::ROOTWriter> writer;
+	if(analysis_filename.empty()) {
+		writer.reset(new podio::ROOTWriter(output_filename, &store));
+	}
 
 	// registering collections
 	auto & evinfocoll = store.create<fcc::EventInfoCollection>("EventInfo");
 	auto & pcoll = store.create<fcc::MCParticleCollection>("GenParticle");
 	auto & vcoll = store.create<fcc::GenVertexCollection>("GenVertex");
 
-	writer.registerForWrite<fcc::EventInfoCollection>("EventInfo");
-	writer.registerForWrite<fcc::MCParticleCollection>("GenParticle");
-	writer.registerForWrite<fcc::GenVertexCollection>("GenVertex");
+	if(writer) {
+		writer->registerForWrite<fcc::EventInfoCollection>("EventInfo");
+		writer->registerForWrite<fcc::MCParticleCollection>("GenParticle");
+		writer->registerForWrite<fcc::GenVertexCollection>("GenVertex");
+	}
 
 	if(verbose) {
 		std::cout << "Initializing PYTHIA" << std::endl;
@@ -124,34 +138,67 @@ int main(int argc, char * argv[]){
 	Pythia8::Pythia pythia; // creating PYTHIA generator object
 	pythia.readFile(pythia_cfgfile); // reading settings from file
 
+	// the hadrons are decayed only after the multiplicity pre-check. A decay never reduces the number of final particles, so events above the cut before the decays stay above it
+	bool const late_decays = pythia.flag("HadronLevel:Decay");
+	if(late_decays) {
+		pythia.readString("HadronLevel:Decay = off");
+	}
+
 	pythia.init(); // initializing PYTHIA generator
 
+	ParticleTable const particle_table(pythia.particleData); // particle properties of the conversion
+
 	// Interface for conversion from Pythia8::Event to HepMC event.
 	HepMC::Pythia8ToHepMC ToHepMC;
 
+	EventArena arena; // memory for per-event scratch containers. Rewound after every event
+
 	std::size_t counter = 0; // number of "interesting" (that satisfy all the requirements) events generated so far
 	std::size_t total = 0; // total number of events generated so far
 
+	// setting up memory accounting
+	MemoryMonitor memory_monitor(memory_budget * 1024 * 1024);
+	std::size_t last_event_entries = 0; // number of entries in the store collections of the last stored event
+	memory_monitor.add_component("store collections", [&last_event_entries]() {return last_event_entries * approx_podio_object_bytes;});
+	memory_monitor.add_component("writer buffers", [&output_filename]() {return tree_buffer_bytes(find_writer_tree(output_filename));});
+	memory_monitor.set_flush_action([&output_filename]() {flush_writer_tree(find_writer_tree(output_filename));});
+	bool memory_exhausted = false; // set if the memory budget is exceeded. Generation is stopped then
+
 	if(verbose) {
 		std::cout << "Starting to generate events" << std::endl;
 	}
 
-	std::map<std::size_t, std::size_t> stable_ptcs_count;
+	Histogram stable_ptcs_count("multiplicity", 8, -0.5, 7.5); // number of stable particles of the selected events, one bin per value
+	Cutflow cutflow("the Z -> u ubar selection");
+	auto const precheck_step = late_decays ? cutflow.add("<= 7 particles before decays") : 0;
+	auto const decay_step = late_decays ? cutflow.add("hadron decays") : 0;
+	auto const multiplicity_step = cutflow.add("<= 7 stable particles");
+	auto const final_multiplicity = [&pythia]() {
+		long n = 0;
+		for(int i = 0; i < pythia.event.size(); ++i) {
+			if(pythia.event[i].isFinal()) {
+				++n;
+			}
+		}
+		return n;
+	};
 
 	while(counter < nevents) {
 		if(pythia.next()) {
 			++total;
 
-			// creating HepMC event storage
-			HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
-
-			// converting generated event to HepMC format
-			ToHepMC.fill_next_event(pythia, hepmcevt);
+			// events already above the cut skip the decays
+			bool const decayed = !late_decays || (cutflow.apply(precheck_step, [&final_multiplicity]() {return final_multiplicity() <= 7;}) && cutflow.apply(decay_step, [&pythia]() {return pythia.moreDecays();}));
 
-			auto nstable = std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), [](HepMC::GenParticle const * const ptc_ptr) {return ptc_ptr->status() == 1;});
+			// the final particles of the PYTHIA event are the status 1 particles of the HepMC event, which is only made for the stored events
+			auto const multiplicity_start = Cutflow::Clock::now();
+			auto const nstable = decayed ? final_multiplicity() : 0;
+			if(decayed) {
+				cutflow.record(multiplicity_step, nstable <= 7, multiplicity_start);
+			}
 
-			if(nstable <= 7) {
-				stable_ptcs_count[nstable]++;
+			if(decayed && nstable <= 7) {
+				stable_ptcs_count.fill(static_cast<double>(nstable));
 				++counter;
 
 				if(verbose && counter % 100 == 0) {
@@ -159,69 +206,68 @@ int main(int argc, char * argv[]){
 					last_timestamp = std::chrono::system_clock::now();
 				}
 
-				// filling event info
-				auto evinfo = fcc::EventInfo();
-				evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
-				evinfocoll.push_back(evinfo);
-
-				// filling vertices
-				std::unordered_map<HepMC::GenVertex *, fcc::GenVertex> vtx_map;
-				for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
-					auto vtx = fcc::GenVertex();
-					vtx.Position().X = (*iv)->position().x();
-					vtx.Position().Y = (*iv)->position().y();
-					vtx.Position().Z = (*iv)->position().z();
-					vtx.Ctau((*iv)->position().t());
-					vtx_map.emplace(*iv, vtx);
-
-					vcoll.push_back(vtx);
-				}
+				// the analysis mode only needs the histogram
+				if(writer) {
+					// creating HepMC event storage
+					HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
 
-				// filling particles
-				for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
-					auto ptc = fcc::MCParticle();
-					auto & core = ptc.Core();
-					core.Type = (*ip)->pdg_id();
-					core.Status = (*ip)->status();
-
-					core.Charge = pythia.particleData.charge(core.Type); // PYTHIA returns charge as a double value (in case it's quark), so here's a narrowing conversion (double to int), but here it's safe
-					core.P4.Mass = (*ip)->momentum().m();
-					core.P4.Px = (*ip)->momentum().px();
-					core.P4.Py = (*ip)->momentum().py();
-					core.P4.Pz = (*ip)->momentum().pz();
-
-					auto prodvtx = vtx_map.find((*ip)->production_vertex());
-					if(prodvtx != vtx_map.end()) {
-						ptc.StartVertex(prodvtx->second);
-					}
-					auto endvtx = vtx_map.find((*ip)->end_vertex());
-					if(endvtx != vtx_map.end()) {
-						ptc.EndVertex(endvtx->second);
-					}
-
-					pcoll.push_back(ptc);
-				}
+					// converting generated event to HepMC format
+					ToHepMC.fill_next_event(pythia, hepmcevt);
+
+					// filling event info
+					auto evinfo = fcc::EventInfo();
+					evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
+					evinfocoll.push_back(evinfo);
+
+					// filling vertices and particles
+					convert_event(hepmcevt, particle_table, pcoll, vcoll, arena);
 
-				writer.writeEvent();
-				store.clearCollections();
+					last_event_entries = evinfocoll.size() + pcoll.size() + vcoll.size();
+
+					writer->writeEvent();
+					store.clearCollections();
+
+					// freeing resources
+					delete hepmcevt;
+					arena.reset();
+				}
 			}
 
-			// freeing resources
-			if(hepmcevt) {
-				delete hepmcevt;
-				hepmcevt = nullptr;
+			// keeping an eye on memory usage
+			if(memory_check_interval > 0 && total % memory_check_interval == 0) {
+				if(verbose) {
+					memory_monitor.print(std::cout);
+				}
+
+				if(memory_monitor.check() == MemoryMonitor::Status::Exceeded) {
+					std::cerr << "Memory budget of " << memory_budget << " MB exceeded even after flushing. Stopping generation" << std::endl;
+					memory_exhausted = true;
+					break;
+				}
 			}
 		}
 	}
 
-	writer.finish();
+	if(writer) {
+		writer->finish();
+	}
 
 	std::cout << counter << " events with 7 or less particles in the final state have been generated (" << total << " total)." << std::endl;
-	for(auto const & nv : stable_ptcs_count) {
-		std::cout << std::setw(4) << std::right << nv.first << std::setw(4) << std::right << nv.second << "(" << static_cast<long double>(nv.second) * static_cast<long double>(100) / static_cast<long double>(total) << "%)" << std::endl;
+	for(std::size_t i = 0; i < stable_ptcs_count.nbins(); ++i) {
+		if(stable_ptcs_count.content(i) > 0.) {
+			std::cout << std::setw(4) << std::right << i << std::setw(4) << std::right << stable_ptcs_count.content(i) << "(" << stable_ptcs_count.content(i) * 100. / static_cast<double>(total) << "%)" << std::endl;
+		}
+	}
+	cutflow.print(std::cout);
+	if(!analysis_filename.empty()) {
+		std::ofstream analysis_file(analysis_filename);
+		stable_ptcs_count.write(analysis_file);
+		std::cout << "Histogram written to " << analysis_filename << std::endl;
 	}
 	auto elapsed_seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - start_time).count();
 	std::cout << "Elapsed time: " << elapsed_seconds << " s (" << static_cast<long double>(counter) / static_cast<long double>(elapsed_seconds) << " events / s)" << std::endl;
+	memory_monitor.print(std::cout);
+	memory_monitor.print_flushes(std::cout);
 
-	return EXIT_SUCCESS;
+	return memory_exhausted ? EXIT_FAILURE : EXIT_SUCCESS;
 }
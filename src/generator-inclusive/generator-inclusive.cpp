@@ -7,6 +7,12 @@
 // Configuration
 #include "GeneratorConfig.h"
 
+// Common utilities
+#include "EventArena.h"
+#include "AllocationCounter.h"
+#include "HepMCConverter.h"
+#include "Cutflow.h"
+
 // PODIO
 #include "podio/EventStore.h"
 #include "podio/ROOTWriter.h"
@@ -25,8 +31,7 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <chrono>
-#include <unordered_set>
-#include <unordered_map>
+#include <algorithm>
 
 // PYTHIA and HepMC
 #include "Pythia8/Pythia.h"
@@ -40,11 +45,6 @@
 bool isBAtProduction(HepMC::GenParticle const * thePart); // utility function to determine whether the particle is NOT a B oscillation. Stolen from https://lhcb-release-area.web.cern.ch/LHCb-release-area/DOC/rec/latest_doxygen/da/db4/_hep_m_c_utils_8h_source.html
 
 
-// utility function to determine whether a particle leaves a charged track
-inline bool is_charged_track(HepMC::GenParticle const * const ptc_ptr) {
-	return std::abs(ptc_ptr->pdg_id()) == 211 /* pions */ || std::abs(ptc_ptr->pdg_id()) == 321 /* kaons */ || std::abs(ptc_ptr->pdg_id()) == 2212 /* protons */ || std::abs(ptc_ptr->pdg_id()) == 11 /* electrons */ || std::abs(ptc_ptr->pdg_id()) == 13 /* muons */;
-}
-
 int main(int argc, char * argv[]){
 	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the number of events to generate; other variables will use the values set below
 	std::size_t nevents = 0; // number of events to generate
@@ -127,24 +127,37 @@ int main(int argc, char * argv[]){
 
 	pythia.init(); // initializing PYTHIA generator
 
+	ParticleTable const particle_table(pythia.particleData); // particle properties of the conversion and the selection
+
 	// Interface for conversion from Pythia8::Event to HepMC event.
 	HepMC::Pythia8ToHepMC ToHepMC;
 
+	// HepMC event storage. It is created once and cleared after every event instead of being reallocated
+	HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+
+	EventArena arena; // memory for per-event scratch containers (selection sets, vertex map). Rewound after every event
+
 	std::size_t counter = 0; // number of "interesting" (that satisfy all the requirements) events generated so far
 	std::size_t total = 0; // total number of events generated so far
 
-	std::size_t b_counter = 0, tau_counter = 0, tau2pipipi_counter = 0, charged_tracks_counter = 0; // number of events containing B0, tau, tau -> pi pi pi, and >=3 charged tracks respectively
+	// selection of the B0 candidates. The steps are applied in this order, so the costly charged track search only runs for the B0 that passed the others
+	Cutflow cutflow("B0 -> K pi tau", "B0 candidates");
+	auto const kpi_step = cutflow.add("K and pi daughters");
+	auto const tau_step = cutflow.add("tau daughter");
+	auto const tau2pipipi_step = cutflow.add("tau -> 3 pi");
+	auto const tracks_step = cutflow.add(">= 3 charged tracks");
 
 	if(verbose) {
 		std::cout << "Starting to generate events" << std::endl;
 	}
 
+	auto heap_allocations_at_start = heap_allocation_count();
+
 	while(counter < nevents) {
 		if(pythia.next()) {
 			++total;
 
-			// creating HepMC event storage
-			HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+			hepmcevt->use_units(HepMC::Units::GEV, HepMC::Units::MM); // GenEvent::clear() resets the units to HepMC defaults
 
 			// converting generated event to HepMC format
 			ToHepMC.fill_next_event(pythia, hepmcevt);
@@ -154,10 +167,10 @@ int main(int argc, char * argv[]){
 			// looping through all particles in order to find B that decays into K, pi and tau (and tau in turn decays into 3 pis) and exclude their daughters from charged tracks count
 			for(auto ib = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ib != endp; ++ib) {
 				if(std::abs((*ib)->pdg_id()) == 511 && isBAtProduction(*ib)) {
-					++b_counter;
+					auto step_start = Cutflow::Clock::now();
 
 					bool k_found = false, pi_found = false, tau_found = false, tau2pipipi = false; // flags signalazing whether k, pi, tau were found and if tau decays into 3 pions respectively
-					std::unordered_set<decltype(*ib)> exclude; // we exclude particles produced in decays of tau from charge tracks count
+					ArenaUnorderedSet<decltype(*ib)> exclude(arena); // we exclude particles produced in decays of tau from charge tracks count
 
 					// iterating through the particles looking for tau, K and pi that were produced in the B0 decay
 					for(auto idaugh = hepmcevt->particles_begin(); idaugh != endp; ++idaugh) {
@@ -165,10 +178,9 @@ int main(int argc, char * argv[]){
 						if((*idaugh)->production_vertex() != nullptr && (*idaugh)->production_vertex()->point3d() == (*ib)->end_vertex()->point3d()) {
 							// if it's a tau
 							if(std::abs((*idaugh)->pdg_id()) == 15) {
-								++tau_counter;
 								tau_found = true;
 
-								decltype(exclude) pi_daughters; // container for pions produced in the tau decay
+								decltype(exclude) pi_daughters(arena); // container for pions produced in the tau decay
 								// iterating through particles loking for pions produced in the tau decay
 								for(auto igranddaugh = hepmcevt->particles_begin(); igranddaugh != endp; ++igranddaugh) {
 									if((*igranddaugh)->production_vertex() != nullptr && (*idaugh)->end_vertex() != nullptr && (*igranddaugh)->production_vertex()->point3d() == (*idaugh)->end_vertex()->point3d() && std::abs((*igranddaugh)->pdg_id()) == 211) { // if the paricle is a daughter of tau. a check if the vertices are valid is required in order to avoid null pointer dereferencing
@@ -179,8 +191,6 @@ int main(int argc, char * argv[]){
 								if(pi_daughters.size() == 3) {
 									tau2pipipi = true;
 									exclude.insert(pi_daughters.cbegin(), pi_daughters.cend()); // exclude them from charged tarcks count
-
-									++tau2pipipi_counter;
 								}
 							}
 
@@ -198,25 +208,41 @@ int main(int argc, char * argv[]){
 						}
 					}
 
-					decltype(exclude) charged_tracks; // container for charget tracks. We can't just count charged tracks in a simple way since there is a double count possible (e.g. daughters of tau are granddaughters of B). std::set alows us to ignore duplicates
+					// K, pi and tau are found in the same scan, so the time of the scan goes to the first step
+					step_start = cutflow.record(kpi_step, k_found && pi_found, step_start);
+					if(!(k_found && pi_found)) {
+						continue;
+					}
+					step_start = cutflow.record(tau_step, tau_found, step_start);
+					if(!tau_found) {
+						continue;
+					}
+					step_start = cutflow.record(tau2pipipi_step, tau2pipipi, step_start);
+					if(!tau2pipipi) {
+						std::cout << "tau, pi and K found, but tau doesn't decay into 3 pions" << std::endl;
+						hepmcevt->print();
+						continue;
+					}
+
+					decltype(exclude) charged_tracks(arena); // container for charget tracks. We can't just count charged tracks in a simple way since there is a double count possible (e.g. daughters of tau are granddaughters of B). std::set alows us to ignore duplicates
 
 					// a new loop is required since we have to fill exclude set first
 
 					//looking for charged_tracks among daughters of B0
 					for(auto idaugh = hepmcevt->particles_begin(); idaugh != endp; ++idaugh) {
 						if((*idaugh)->production_vertex() != nullptr && (*idaugh)->production_vertex()->point3d() == (*ib)->end_vertex()->point3d() && exclude.find(*idaugh) == exclude.end()) { // a check if the production vertex is valid is required in order to avoid null pointer dereferencing
-							if(is_charged_track(*idaugh)) {
+							if(particle_table.is_charged_track((*idaugh)->pdg_id())) {
 								charged_tracks.emplace(*idaugh);
 							} else {
 								// looking for charged tracks among granddaughters of B0
 								for(auto igranddaugh = hepmcevt->particles_begin(); igranddaugh != endp; ++igranddaugh) {
 									if((*igranddaugh)->production_vertex() != nullptr && (*idaugh)->end_vertex() != nullptr && (*igranddaugh)->production_vertex()->point3d() == (*idaugh)->end_vertex()->point3d() && exclude.find(*igranddaugh) == exclude.end()) { // a check if the vertices are valid is required in order to avoid null pointer dereferencing
-										if(is_charged_track(*igranddaugh)) {
+										if(particle_table.is_charged_track((*igranddaugh)->pdg_id())) {
 											charged_tracks.emplace(*igranddaugh);
 										} else {
 											// looking for charged tracks among grandgranddaughters of B0
 											for(auto igrandgranddaugh = hepmcevt->particles_begin(); igrandgranddaugh != endp; ++igrandgranddaugh) {
-												if(is_charged_track(*igrandgranddaugh) && (*igrandgranddaugh)->production_vertex() != nullptr && (*igranddaugh)->end_vertex() != nullptr && (*igrandgranddaugh)->production_vertex()->point3d() == (*igranddaugh)->end_vertex()->point3d() && exclude.find(*igrandgranddaugh) == exclude.end()) { // a check if the vertices are valid is required in order to avoid null pointer dereferencing
+												if(particle_table.is_charged_track((*igrandgranddaugh)->pdg_id()) && (*igrandgranddaugh)->production_vertex() != nullptr && (*igranddaugh)->end_vertex() != nullptr && (*igrandgranddaugh)->production_vertex()->point3d() == (*igranddaugh)->end_vertex()->point3d() && exclude.find(*igrandgranddaugh) == exclude.end()) { // a check if the vertices are valid is required in order to avoid null pointer dereferencing
 													charged_tracks.emplace(*igrandgranddaugh);
 												}
 											}
@@ -227,27 +253,23 @@ int main(int argc, char * argv[]){
 						}
 					}
 
-					if(charged_tracks.size() >= 3) {
-						++charged_tracks_counter;
-					}
-
-					if(tau2pipipi && k_found && pi_found && charged_tracks.size() >= 3) {
+					bool const tracks_found = charged_tracks.size() >= 3;
+					cutflow.record(tracks_step, tracks_found, step_start);
+					if(tracks_found) {
 						++decays_in_event;
 
 						std::cout << "HURRAY!!! We've got a decay we've been looking for!" << std::endl;
 						hepmcevt->print();
 					} else {
-						if(k_found && pi_found && tau_found) {
-							std::cout << "tau" << (tau2pipipi ? "->pipipi" : "") << ", pi and K found and there are " << charged_tracks.size() << " charged tracks" << std::endl;
-							hepmcevt->print();
-							std::cout << "Excluded particles:" << std::endl;
-							for(auto ptc : exclude) {
-								ptc->print();
-							}
-							std::cout << "Charged tracks:" << std::endl;
-							for(auto ptc : charged_tracks) {
-								ptc->print();
-							}
+						std::cout << "tau->pipipi, pi and K found and there are " << charged_tracks.size() << " charged tracks" << std::endl;
+						hepmcevt->print();
+						std::cout << "Excluded particles:" << std::endl;
+						for(auto ptc : exclude) {
+							ptc->print();
+						}
+						std::cout << "Charged tracks:" << std::endl;
+						for(auto ptc : charged_tracks) {
+							ptc->print();
 						}
 					}
 				}
@@ -266,63 +288,35 @@ int main(int argc, char * argv[]){
 				evinfo.Number(counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
 				evinfocoll.push_back(evinfo);
 
-				// filling vertices
-				std::unordered_map<HepMC::GenVertex *, fcc::GenVertex> vtx_map;
-				for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
-					auto vtx = fcc::GenVertex();
-					vtx.Position().X = (*iv)->position().x();
-					vtx.Position().Y = (*iv)->position().y();
-					vtx.Position().Z = (*iv)->position().z();
-					vtx.Ctau((*iv)->position().t());
-					vtx_map.emplace(*iv, vtx);
-
-					vcoll.push_back(vtx);
-				}
-
-				// filling particles
-				for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
-					auto ptc = fcc::MCParticle();
-					auto & core = ptc.Core();
-					core.Type = (*ip)->pdg_id();
-					core.Status = (*ip)->status();
-
-					core.Charge = pythia.particleData.charge(core.Type); // PYTHIA returns charge as a double value (in case it's quark), so here's a narrowing conversion (double to int), but here it's safe
-					core.P4.Mass = (*ip)->momentum().m();
-					core.P4.Px = (*ip)->momentum().px();
-					core.P4.Py = (*ip)->momentum().py();
-					core.P4.Pz = (*ip)->momentum().pz();
-
-					auto prodvtx = vtx_map.find((*ip)->production_vertex());
-					if(prodvtx != vtx_map.end()) {
-						ptc.StartVertex(prodvtx->second);
-					}
-					auto endvtx = vtx_map.find((*ip)->end_vertex());
-					if(endvtx != vtx_map.end()) {
-						ptc.EndVertex(endvtx->second);
-					}
-
-					pcoll.push_back(ptc);
-				}
+				// filling vertices and particles
+				convert_event(hepmcevt, particle_table, pcoll, vcoll, arena);
 
 				writer.writeEvent();
 				store.clearCollections();
 			}
 
-			// freeing resources
-			if(hepmcevt) {
-				delete hepmcevt;
-				hepmcevt = nullptr;
-			}
+			// preparing for the next event
+			hepmcevt->clear();
+			arena.reset();
 		}
 	}
 
+	auto heap_allocations = heap_allocation_count() - heap_allocations_at_start;
+
 	writer.finish();
 
+	// freeing resources
+	if(hepmcevt) {
+		delete hepmcevt;
+		hepmcevt = nullptr;
+	}
+
 	std::cout << counter << " events with decay of B0 -> K*0 tau have been generated (" << total << " total)." << std::endl;
 	auto elapsed_seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - start_time).count();
 	std::cout << "Elapsed time: " << elapsed_seconds << " s (" << static_cast<long double>(counter) / static_cast<long double>(elapsed_seconds) << " events / s)" << std::endl;
+	std::cout << "Heap allocations: " << heap_allocations << " (" << static_cast<long double>(heap_allocations) / static_cast<long double>(std::max<std::size_t>(total, 1)) << " per generated event, " << static_cast<long double>(heap_allocations) / static_cast<long double>(elapsed_seconds) << " / s). Event arena: " << arena.capacity() << " bytes in " << arena.upstream_allocations() << " blocks" << std::endl;
 
-	std::cout << "B0: " << b_counter << std::endl << "tau: " << tau_counter << std::endl << "3 tracks: " << charged_tracks_counter << std::endl;
+	cutflow.print(std::cout);
 
 	return EXIT_SUCCESS;
 }
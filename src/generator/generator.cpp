@@ -6,6 +6,31 @@
 // Configuration
 #include "GeneratorConfig.h"
 
+// Common utilities
+#include "EventArena.h"
+#include "AllocationCounter.h"
+#include "MemoryMonitor.h"
+#include "WriterTree.h"
+#include "ShardedWriter.h"
+#include "HepMCConverter.h"
+#include "ParticleBatch.h"
+#include "AcceptanceFilter.h"
+#include "HepMCToPythia.h"
+#include "EventStream.h"
+#include "EventWeights.h"
+#include "EventIndex.h"
+#include "DecaySignature.h"
+#include "WorkerPool.h"
+#include "Observables.h"
+#include "StatusReporter.h"
+#include "EventCost.h"
+#include "JobPlanner.h"
+#include "Cutflow.h"
+#include "SignalDecays.h"
+#include "BackgroundOverlay.h"
+#include "ParticleTable.h"
+#include "KeySamples.h"
+
 // PODIO
 #include "podio/EventStore.h"
 #include "podio/ROOTWriter.h"
@@ -17,6 +42,8 @@
 #include "datamodel/MCParticleCollection.h"
 #include "datamodel/GenVertex.h"
 #include "datamodel/GenVertexCollection.h"
+#include "datamodel/FloatValue.h"
+#include "datamodel/FloatValueCollection.h"
 
 // STL
 #include <iostream>
@@ -24,68 +51,147 @@
 #include <string>
 #include <cstdlib>
 #include <stdexcept>
-#include <unordered_map>
 #include <cmath>
 #include <chrono>
 #include <algorithm>
+#include <vector>
+#include <memory>
+#include <cstdio>
 
 // PYTHIA, EvtGen and HepMC
 #include "Pythia8/Pythia.h"
 #include "Pythia8Plugins/HepMC2.h"
 #include "Pythia8Plugins/EvtGen.h"
+#include "HepMC/IO_GenEvent.h"
 
 #ifdef USE_BOOST
 	// Boost
 	#include "boost/program_options.hpp"
 #endif
 
-std::unordered_map<int, std::string> const particle_names = {{511, "B_d^0"},
-															 {-511, "Anti-B_d^0"},
-															 {531, "B_s^0"},
-															 {-531, "Anti-B_s^0"},
-															 {313, "K^*0"},
-															 {313, "Anti-K^*0"},
-															 {15, "tau-"},
-															 {-15, "tau+"},
-															 {321, "K^+"},
-															 {-321, "K^-"},
-															 {211, "pi^+"},
-															 {-211, "pi^-"},
-															 {16, "nu_tau"},
-															 {-16, "Anti-nu_tau"},
-															 {431, "D_s^+"},
-															 {-431, "D_s^-"}};
-
+void print_stored_particles(fcc::MCParticleCollection const & pcoll, ParticleTable const & particles); // prints the content of the particle collection. Used at verbosity level 2
 bool isBAtProduction(HepMC::GenParticle const * thePart); // utility function to determine whether the particle is NOT a B oscillation. Stolen from https://lhcb-release-area.web.cern.ch/LHCb-release-area/DOC/rec/latest_doxygen/da/db4/_hep_m_c_utils_8h_source.html
 
 int main(int argc, char * argv[]){
+	auto const program_start_time = std::chrono::system_clock::now(); // the pilot of the plan mode measures the initialization time from here
+
 	std::string evtgen_root = std::getenv("EVTGEN_ROOT_DIR"); // path to EvtGen installation directory
 
 	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the number of events to generate; other variables will use the values set below
 	std::size_t nevents = 0; // number of events to generate
 	std::string pythia_cfgfile = "pythia.cmnd"; // name of PYTHIA cofiguration file
-	int keyptc = 511; // "key" particle
+	std::vector<std::string> key_specs = {"511"}; // "key" particles as PDG[:QUOTA[:OUTPUT]], see KeySamples.h
 	std::string evtgen_decfile = evtgen_root + "/share/DECAY_2010.DEC"; // EvtGen decay file
 	std::string evtgen_pdlfile = evtgen_root + "/share/evt.pdl"; // EvtGen PDL file
 	std::string evtgen_user_decfile = "user.dec"; // user defined decays
+	bool evtgen_signal_only = false; // EvtGen decays only the particles of the user decay file, PYTHIA the others
 	std::string output_filename = "output.root"; // name of the output file
+	std::string generate_only_filename; // generate-only mode: undecayed events are written to this HepMC file instead of being decayed and stored
+	std::string decay_only_filename; // decay-only mode: events are read from this HepMC file (written in the generate-only mode) instead of being generated
+	std::string stream_destination; // if set, stored events are streamed here ("-", "unix:PATH", file or FIFO) instead of being written to the ROOT file
+	bool write_index = false; // write the sidecar index of the stored events
 	std::size_t verbosity = 0; // verbosity level
+	PersistencePolicy persistence_policy = PersistencePolicy::Full; // which particles of the event are stored
+	StoragePrecision storage_precision = StoragePrecision::Full; // precision of stored kinematics and positions
+	double momentum_step = 1e-5; // momentum grid step in GeV for the fixed storage precision
+	double position_step = 1e-6; // position grid step in mm for the fixed storage precision
+	std::size_t max_events_per_file = 0; // a new output file is started after this many events, 0 means no limit
+	std::size_t max_bytes_per_file = 0; // a new output file is started once the current one reaches this size, 0 means no limit
+	double bias_pthat_power = 0.; // PYTHIA phase space bias power (PhaseSpace:bias2SelectionPow), 0 means no bias
+	double bias_pthat_ref = 10.; // PYTHIA phase space bias reference pT in GeV (PhaseSpace:bias2SelectionRef)
+	double enhance_pmin = 0.; // events with a key particle above this momentum (GeV) are always kept by the momentum enhancement
+	double enhance_factor = 1.; // the other events are kept with probability 1 / enhance_factor and weighted up. 1 disables the enhancement
+	AcceptanceCuts acceptance_cuts; // acceptance cuts on the stable charged descendants of the key particle. Disabled by default
+	std::size_t memory_budget = 0; // memory budget in MB, 0 means no limit
+	std::size_t memory_check_interval = 1000; // memory usage is checked every memory_check_interval generated events
+	std::size_t nworkers = 1; // number of worker processes generating in parallel
+	AffinityMode affinity_mode = AffinityMode::None; // placement of the workers on the CPUs
+	std::vector<int> affinity_cpus; // CPUs of the list affinity mode
+	std::string analysis_filename; // analysis mode: the observables are filled and written to this file instead of storing the events
+	ObservableSet observables; // observables of the analysis mode
+	std::string status_filename; // the live status of the job is periodically written to this file
+	std::string status_socket; // the live status of the job is served on this Unix domain socket
+	double status_interval = 5.; // seconds between updates of the status file
+	bool store_event_cost = false; // store the CPU time of every stage with the event
+	bool per_event_seeds = false; // every event starts from its own seed, derived from the run seed and the index of the event
+	std::string slow_events_filename; // events slower than the percentile below are logged to this file with their seeds
+	double slow_percentile = 99.; // percentile of the CPU time per event above which events are logged
+	std::vector<int> replay_seeds; // replay mode: one event is generated from each of these seeds (taken from the slow event log)
+	int seed = 0; // seed of the run, 0 means the seed of the PYTHIA config file
+	std::size_t plan_target = 0; // plan mode: number of key particles the plan is made for. A pilot is run instead of generating nevents events
+	std::size_t pilot_events = 2000; // generated events of the pilot
+	double wall_limit = 86400.; // wall time limit of a job in seconds
+	double wall_safety = 0.8; // fraction of the wall time limit a job is planned to use
+	std::string overlay_filename; // background library overlaid on the stored events
+	double overlay_mean = 1.; // mean number of overlaid background events per stored event
+	bool overlay_fixed = false; // overlay exactly the mean number of background events instead of a Poisson distributed number
+	OverlayVertexSpread overlay_spread; // luminous region the overlaid events are moved to
 
 	#ifdef USE_BOOST
 		try {
+			std::string persistence_policy_name; // persistence policy as given on the command line
+			std::string storage_precision_name; // storage precision as given on the command line
+			std::string affinity_mode_name; // affinity mode as given on the command line
+			std::string affinity_cpus_list; // CPU list as given on the command line
+			std::vector<std::string> observable_specs; // observables as given on the command line
+
 			boost::program_options::options_description desc("Usage");
 
 			// defining command line options. See boost::program_options documentation for more details
 			desc.add_options()
 							("help", "produce this help message")
 							("nevents,n", boost::program_options::value<std::size_t>(&nevents), "number of events to generate")
-							("keyparticle,k", boost::program_options::value<int>(&keyptc)->default_value(511), "PDG ID of \"key\" particle (the one the redefined decay chain starts with)")
+							("keyparticle,k", boost::program_options::value<std::vector<std::string>>(&key_specs)->composing(), "\"Key\" particle (the one the redefined decay chain starts with) as PDG[:QUOTA[:OUTPUT]], 511 by default. Can be repeated or given as a comma separated list: every species collects QUOTA key particles (--nevents by default) into its own OUTPUT file (the output file with the PDG ID before the extension by default) from the same generated events")
 							("pythiacfg,P", boost::program_options::value<std::string>(&pythia_cfgfile)->default_value("pythia.cmnd"), "PYTHIA config file")
 							("customdec,E", boost::program_options::value<std::string>(&evtgen_user_decfile)->default_value("user.dec"), "EvtGen user decay file")
 							("evtgendec", boost::program_options::value<std::string>(&evtgen_decfile)->default_value(evtgen_root + "/share/DECAY_2010.DEC"), "EvtGen decay file")
 							("evtgenpdl", boost::program_options::value<std::string>(&evtgen_pdlfile)->default_value(evtgen_root + "/share/evt.pdl"), "EvtGen PDL file")
+							("evtgen-signal-only", boost::program_options::bool_switch(&evtgen_signal_only), "Let EvtGen decay only the particles the user decay file defines decays for (and the key particle), and PYTHIA all the others")
 							("outfile,o", boost::program_options::value<std::string>(&output_filename)->default_value("output.root"), "Output file")
+							("generate-only", boost::program_options::value<std::string>(&generate_only_filename), "Generate-only mode: write the hadronized events with the key particle, leaving the particles EvtGen decays undecayed, to this HepMC file. Nothing is decayed or stored")
+							("decay-only", boost::program_options::value<std::string>(&decay_only_filename), "Decay-only mode: read the events from this HepMC file (written in the generate-only mode) instead of generating them, then decay and store them as usual")
+							("stream", boost::program_options::value<std::string>(&stream_destination), "Stream the stored events to \"-\" (standard output), \"unix:PATH\" (Unix domain socket) or a FIFO instead of writing the ROOT file")
+							("index", boost::program_options::bool_switch(&write_index), "Write a sidecar index of the stored events (key particles, decay signature, multiplicities, entry in the output) next to the output file")
+							("persist", boost::program_options::value<std::string>(&persistence_policy_name)->default_value("full"), "Which particles to store: full, signal-tree+stable, stable-only, signal-tree-only. The signal tree is the decay tree of the key particle")
+							("precision", boost::program_options::value<std::string>(&storage_precision_name)->default_value("full"), "Precision of stored momenta and positions: full (single precision, as the data model stores them) or fixed")
+							("momentum-step", boost::program_options::value<double>(&momentum_step)->default_value(1e-5), "Momentum grid step in GeV for --precision=fixed (rounded down to a power of 2)")
+							("position-step", boost::program_options::value<double>(&position_step)->default_value(1e-6), "Position grid step in mm for --precision=fixed (rounded down to a power of 2)")
+							("max-events-per-file", boost::program_options::value<std::size_t>(&max_events_per_file)->default_value(0), "Start a new numbered output file after this many events (0 means no limit)")
+							("max-bytes-per-file", boost::program_options::value<std::size_t>(&max_bytes_per_file)->default_value(0), "Start a new numbered output file once the current one reaches this size in bytes (0 means no limit)")
+							("acceptance-costheta", boost::program_options::value<double>(&acceptance_cuts.max_abs_costheta)->default_value(1.), "Keep only events where all stable charged descendants of the key particle have |cos(theta)| below this value (1 disables the cut)")
+							("acceptance-pmin", boost::program_options::value<double>(&acceptance_cuts.min_p)->default_value(0.), "Keep only events where all stable charged descendants of the key particle have momentum above this value in GeV (0 disables the cut)")
+							("acceptance-ptmin", boost::program_options::value<double>(&acceptance_cuts.min_pt)->default_value(0.), "Keep only events where all stable charged descendants of the key particle have transverse momentum above this value in GeV (0 disables the cut)")
+							("bias-pthat-power", boost::program_options::value<double>(&bias_pthat_power)->default_value(0.), "Bias the hard process selection by (pTHat / ref)^POWER with PYTHIA's PhaseSpace:bias2Selection. Events are weighted (0 disables the bias)")
+							("bias-pthat-ref", boost::program_options::value<double>(&bias_pthat_ref)->default_value(10.), "Reference pTHat in GeV of the phase space bias")
+							("enhance-pmin", boost::program_options::value<double>(&enhance_pmin)->default_value(0.), "Momentum in GeV above which events with the key particle are always kept by the momentum enhancement")
+							("enhance-factor", boost::program_options::value<double>(&enhance_factor)->default_value(1.), "Keep events without a key particle above --enhance-pmin with probability 1 / FACTOR and weight FACTOR (1 disables the enhancement)")
 							("verbosity,v", boost::program_options::value<std::size_t>(&verbosity)->implicit_value(1), "Set verbosity level (0, 1, 2)")
+							("memory-budget", boost::program_options::value<std::size_t>(&memory_budget)->default_value(0), "Memory budget in MB. Buffers are flushed when RSS approaches it and generation stops cleanly if it is exceeded (0 means no limit)")
+							("memory-check", boost::program_options::value<std::size_t>(&memory_check_interval)->default_value(1000), "Check memory usage every N generated events (0 disables the checks)")
+							("workers", boost::program_options::value<std::size_t>(&nworkers)->default_value(1), "Number of worker processes. Each one generates its share of the events with its own seed into its own output file (output.w00.root, ...)")
+							("affinity", boost::program_options::value<std::string>(&affinity_mode_name)->default_value("none"), "Placement of the workers: none, compact (fill one NUMA node after the other), scatter (round robin over the nodes) or list (the CPUs given with --cpus). Pinned workers allocate their memory on their own node")
+							("cpus", boost::program_options::value<std::string>(&affinity_cpus_list), "CPUs of the list affinity mode, e.g. 0-7,16-23")
+							("analysis", boost::program_options::value<std::string>(&analysis_filename), "Analysis mode: fill the histograms of the observables of every event with the key particle and write them to this file instead of storing the events")
+							("observe", boost::program_options::value<std::vector<std::string>>(&observable_specs)->composing(), "Observable of the analysis mode, NAME or NAME:NBINS:LOW:HIGH, can be repeated. Names: multiplicity, charged-multiplicity, key-p, key-pt, key-decay-length. All of them with default binning if none is given")
+							("status-file", boost::program_options::value<std::string>(&status_filename), "Periodically rewrite this file with the live status of the job (counters, rates, ETA, time per stage, memory) in the Prometheus text format")
+							("status-socket", boost::program_options::value<std::string>(&status_socket), "Serve the live status of the job on this Unix domain socket")
+							("status-interval", boost::program_options::value<double>(&status_interval)->default_value(5.), "Seconds between updates of the status file and of the rates")
+							("event-cost", boost::program_options::bool_switch(&store_event_cost), "Store the CPU time of the generate, decay and convert stages of every stored event in the EventCPUTime collection")
+							("event-seeds", boost::program_options::bool_switch(&per_event_seeds), "Seed every event from the run seed and its index, so that any event can be regenerated on its own")
+							("slow-events", boost::program_options::value<std::string>(&slow_events_filename), "Log the events whose CPU time is above --slow-percentile to this file, with their seeds. Implies --event-seeds")
+							("slow-percentile", boost::program_options::value<double>(&slow_percentile)->default_value(99.), "Percentile of the CPU time per event above which events are slow")
+							("replay-seed", boost::program_options::value<std::vector<int>>(&replay_seeds)->composing(), "Replay mode: generate one event from each of these seeds (e.g. from the slow event log) instead of --nevents events, and print the CPU time of its stages. Can be repeated")
+							("seed", boost::program_options::value<int>(&seed)->default_value(0), "Random seed of the run, 1 to 900000000 (0 keeps the seed of the PYTHIA config file)")
+							("plan", boost::program_options::value<std::size_t>(&plan_target)->default_value(0), "Plan mode: run a pilot of --pilot events, then print how to split the generation of this many key particles into jobs that fit --wall-limit, with their seeds and the expected resources")
+							("pilot", boost::program_options::value<std::size_t>(&pilot_events)->default_value(2000), "Generated events of the pilot of the plan mode")
+							("wall-limit", boost::program_options::value<double>(&wall_limit)->default_value(86400.), "Wall time limit of a job in seconds for the plan mode")
+							("wall-safety", boost::program_options::value<double>(&wall_safety)->default_value(0.8), "Fraction of the wall time limit a job is planned to use, even with the pessimistic estimates")
+							("overlay", boost::program_options::value<std::string>(&overlay_filename), "Overlay background events sampled from this library (a generator output or a stream file) on every stored event")
+							("overlay-mean", boost::program_options::value<double>(&overlay_mean)->default_value(1.), "Mean number of overlaid background events per stored event, Poisson distributed")
+							("overlay-fixed", boost::program_options::bool_switch(&overlay_fixed), "Overlay exactly --overlay-mean background events on every stored event")
+							("overlay-sigma-x", boost::program_options::value<double>(&overlay_spread.sigma_x)->default_value(0.), "Gaussian spread in mm of the x position of the overlaid events")
+							("overlay-sigma-y", boost::program_options::value<double>(&overlay_spread.sigma_y)->default_value(0.), "Gaussian spread in mm of the y position of the overlaid events")
+							("overlay-sigma-z", boost::program_options::value<double>(&overlay_spread.sigma_z)->default_value(0.), "Gaussian spread in mm of the z position of the overlaid events")
 			;
 			boost::program_options::variables_map vm;
 			boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
@@ -101,6 +207,66 @@ int main(int argc, char * argv[]){
 			if(vm.find("verbosity") != vm.end()) {
 				verbosity = vm.at("verbosity").as<size_t>();
 			}
+
+			if(!generate_only_filename.empty() && !decay_only_filename.empty()) {
+				throw std::invalid_argument("--generate-only and --decay-only can't be used together");
+			}
+			if(!generate_only_filename.empty() && !stream_destination.empty()) {
+				throw std::invalid_argument("--generate-only and --stream can't be used together");
+			}
+			if(!analysis_filename.empty() && (!generate_only_filename.empty() || !stream_destination.empty())) {
+				throw std::invalid_argument("--analysis can't be used with --generate-only or --stream");
+			}
+			if(analysis_filename.empty() && !observable_specs.empty()) {
+				throw std::invalid_argument("--observe needs --analysis");
+			}
+			for(auto const & spec : observable_specs) {
+				observables.add(spec);
+			}
+			if(!analysis_filename.empty() && observables.empty()) {
+				observables.add_all();
+			}
+
+			persistence_policy = parse_persistence_policy(persistence_policy_name);
+			storage_precision = parse_storage_precision(storage_precision_name);
+			affinity_mode = parse_affinity_mode(affinity_mode_name);
+			affinity_cpus = parse_cpu_list(affinity_cpus_list);
+			if(nworkers == 0) {
+				throw std::invalid_argument("At least one worker is needed");
+			}
+			if(nworkers > 1 && (!generate_only_filename.empty() || !decay_only_filename.empty() || !stream_destination.empty())) {
+				throw std::invalid_argument("--workers can't be used with --generate-only, --decay-only or --stream");
+			}
+			if(!(momentum_step > 0.) || !(position_step > 0.)) {
+				throw std::invalid_argument("Quantization steps must be positive");
+			}
+			if(!(status_interval > 0.)) {
+				throw std::invalid_argument("The status interval must be positive");
+			}
+			if(!(slow_percentile > 0.) || slow_percentile > 100.) {
+				throw std::invalid_argument("The slow event percentile must be between 0 and 100");
+			}
+			if(!replay_seeds.empty() && (!decay_only_filename.empty() || nworkers > 1)) {
+				throw std::invalid_argument("--replay-seed can't be used with --decay-only or --workers");
+			}
+			if(!slow_events_filename.empty() || !replay_seeds.empty()) {
+				per_event_seeds = true;
+			}
+			if(seed < 0 || seed > 900000000) {
+				throw std::invalid_argument("The seed must be between 1 and 900000000");
+			}
+			if(plan_target > 0 && (nworkers > 1 || !replay_seeds.empty() || !generate_only_filename.empty())) {
+				throw std::invalid_argument("--plan can't be used with --workers, --replay-seed or --generate-only");
+			}
+			if(!overlay_filename.empty() && (!generate_only_filename.empty() || !analysis_filename.empty())) {
+				throw std::invalid_argument("--overlay can't be used with --generate-only or --analysis");
+			}
+			if(!(overlay_spread.sigma_x >= 0.) || !(overlay_spread.sigma_y >= 0.) || !(overlay_spread.sigma_z >= 0.)) {
+				throw std::invalid_argument("The spreads of the overlaid events can't be negative");
+			}
+			if(plan_target > 0 && (pilot_events == 0 || !(wall_limit > 0.) || !(wall_safety > 0.) || wall_safety > 1.)) {
+				throw std::invalid_argument("The pilot needs at least one event, a positive wall time limit and a safety fraction between 0 and 1");
+			}
 		} catch(std::exception const & e) {
 			std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
 
@@ -118,31 +284,171 @@ int main(int argc, char * argv[]){
 		}
 	#endif
 
+	// samples of the key particle species, with the number of events as the default quota
+	KeySamples samples;
+	try {
+		samples = KeySamples(key_specs, nevents, output_filename);
+		if(samples.size() > 1 && (!stream_destination.empty() || !analysis_filename.empty() || plan_target > 0 || enhance_factor > 1.)) {
+			throw std::invalid_argument("Several key particles can't be used with --stream, --analysis, --plan or --enhance-factor");
+		}
+	} catch(std::exception const & e) {
+		std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	// the background library is read before the workers are forked, so that they share its memory
+	std::unique_ptr<BackgroundLibrary> overlay_library;
+	std::unique_ptr<BackgroundOverlay> overlay;
+	if(!overlay_filename.empty()) {
+		try {
+			overlay_library.reset(new BackgroundLibrary(overlay_filename));
+			overlay.reset(new BackgroundOverlay(*overlay_library, overlay_mean, overlay_fixed, overlay_spread));
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << ". Program stopped." << std::endl;
+			return EXIT_FAILURE;
+		}
+		if(verbosity >= 1) {
+			std::cout << "Background library \"" << overlay_filename << "\": " << overlay_library->events() << " events, " << overlay_library->particles() << " particles, " << overlay_library->bytes() << " bytes" << std::endl;
+		}
+	}
+
+	// parallel generation: the parent forks the workers here and only prints their summary, the workers continue below with their share of the events. A single process is pinned like a worker if an affinity mode is given
+	std::unique_ptr<WorkerPool> workers;
+	try {
+		auto const slots = plan_placement(CpuTopology(), nworkers, affinity_mode, affinity_cpus);
+		if(nworkers > 1) {
+			workers.reset(new WorkerPool(slots));
+			if(workers->run() < 0) {
+				workers->print(std::cout);
+
+				// the histograms of the workers are added up into the analysis file
+				if(!analysis_filename.empty()) {
+					for(std::size_t i = 0; i < nworkers; ++i) {
+						auto const worker_filename = WorkerPool::worker_filename(analysis_filename, static_cast<int>(i));
+						try {
+							observables.merge(worker_filename);
+							std::remove(worker_filename.c_str());
+						} catch(std::exception const & e) {
+							std::cerr << e.what() << ". Histograms of worker " << i << " are left out" << std::endl;
+						}
+					}
+					observables.write(analysis_filename);
+					observables.print(std::cout, verbosity >= 1);
+					std::cout << "Histograms written to " << analysis_filename << std::endl;
+				}
+
+				return workers->succeeded() ? EXIT_SUCCESS : EXIT_FAILURE;
+			}
+
+			nevents = workers->share(nevents);
+			output_filename = workers->worker_filename(output_filename);
+			for(auto & sample : samples) {
+				sample.quota = workers->share(sample.quota);
+				sample.output_filename = workers->worker_filename(sample.output_filename);
+			}
+			if(!analysis_filename.empty()) {
+				analysis_filename = workers->worker_filename(analysis_filename);
+			}
+			if(!status_filename.empty()) {
+				status_filename = workers->worker_filename(status_filename);
+			}
+			if(!status_socket.empty()) {
+				status_socket = workers->worker_filename(status_socket);
+			}
+			if(!slow_events_filename.empty()) {
+				slow_events_filename = workers->worker_filename(slow_events_filename);
+			}
+			if(verbosity >= 1) {
+				std::cout << "Worker " << workers->index() << ": " << nevents << " events to " << output_filename << (workers->slot().cpu >= 0 ? " on CPU " + std::to_string(workers->slot().cpu) + ", node " + std::to_string(workers->slot().node) : "") << (workers->memory_local() ? " (node local memory)" : "") << std::endl;
+			}
+		} else if(!apply_placement(slots.front()) && verbosity >= 1) {
+			std::cout << "Unable to set the local memory policy, the process is pinned only" << std::endl;
+		}
+	} catch(std::exception const & e) {
+		std::cerr << e.what() << ". Program stopped." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Quantizer const quantizer(storage_precision, momentum_step, position_step);
+
+	// "key" particles are the roots of the signal decay trees. Every sample has its own
+	auto const key_predicate = [](int pdg) {return [pdg](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == pdg && isBAtProduction(ptc_ptr);};};
+	std::vector<decltype(key_predicate(0))> is_key_particle;
+
+	// conversion specialized for the persistence policy and storage precision, per sample since the signal tree is the one of its key particle. Chosen here once for the whole run
+	std::vector<decltype(make_event_converter(persistence_policy, quantizer, key_predicate(0)))> converters;
+	for(auto const & sample : samples) {
+		is_key_particle.push_back(key_predicate(sample.pdg));
+		converters.push_back(make_event_converter(persistence_policy, quantizer, key_predicate(sample.pdg)));
+	}
+
 	if(verbosity >= 1) {
 			std::cout << "PYTHIA config file: \"" << pythia_cfgfile << "\"" << std::endl
 					<< "EvtGen user decay file: \"" << evtgen_user_decfile << "\"" << std:: endl
 					<< "EvtGen decay file: \"" << evtgen_decfile << "\"" << std:: endl
 					<< "EvtGen PDL file: \"" << evtgen_pdlfile << "\"" << std:: endl
-					<< nevents << " events will be generated." << std:: endl;
+					<< (generate_only_filename.empty() ? "" : "Generate-only mode, undecayed events are written to \"" + generate_only_filename + "\"\n")
+					<< (decay_only_filename.empty() ? "" : "Decay-only mode, events are read from \"" + decay_only_filename + "\"\n")
+					<< (stream_destination.empty() ? "" : "Events are streamed to \"" + stream_destination + "\"\n")
+					<< (analysis_filename.empty() ? "" : "Analysis mode, histograms are written to \"" + analysis_filename + "\"\n")
+					<< "Persistence policy: " << to_string(persistence_policy) << std:: endl
+					<< "Storage precision: " << quantizer.describe() << std:: endl;
+			for(auto const & sample : samples) {
+				std::cout << sample.quota << " events with key particle " << sample.pdg << " will be generated" << (generate_only_filename.empty() && analysis_filename.empty() && stream_destination.empty() ? " into \"" + sample.output_filename + "\"" : "") << std::endl;
+			}
 	}
 
 	if(verbosity >= 1) {
 		std::cout << "Prepairing data store" << std::endl;
 	}
 
-	// prepairing event store
+	// prepairing event store. Nothing is stored in the generate-only and analysis modes and the events go to the stream if one is given, so no output file is created then
 	podio::EventStore store;
-	podio::ROOTWriter writer(output_filename, &store);
+	std::vector<std::unique_ptr<ShardedWriter>> writers; // one per sample, all writing the collections of the store
+	std::unique_ptr<EventStreamWriter> stream;
+	try {
+		if(!stream_destination.empty()) {
+			stream.reset(new EventStreamWriter(stream_destination)); // waits for the consumer if the destination is a FIFO
+		} else if(generate_only_filename.empty() && analysis_filename.empty()) {
+			for(auto const & sample : samples) {
+				writers.emplace_back(new ShardedWriter(sample.output_filename, &store, max_events_per_file, max_bytes_per_file));
+			}
+		}
+	} catch(std::exception const & e) {
+		std::cerr << e.what() << ". Program stopped." << std::endl;
+		return EXIT_FAILURE;
+	}
+	bool stream_broken = false; // set if the consumer of the stream went away. Generation is stopped then
+
+	// sidecar indices of the stored events, one per sample
+	std::vector<std::unique_ptr<EventIndexWriter>> indices;
+	std::string index_signature; // decay signature of the current event. Kept outside of the loop to reuse its memory
+	if(write_index && (!writers.empty() || stream)) {
+		for(auto const & sample : samples) {
+			indices.emplace_back(new EventIndexWriter(sample.output_filename));
+		}
+	}
 
 	// creating collections
 	auto & evinfocoll = store.create<fcc::EventInfoCollection>("EventInfo");
 	auto & pcoll = store.create<fcc::MCParticleCollection>("GenParticle");
 	auto & vcoll = store.create<fcc::GenVertexCollection>("GenVertex");
+	auto & weightcoll = store.create<fcc::FloatValueCollection>("EventWeight"); // one entry per event, next to EventInfo
+	auto & xseccoll = store.create<fcc::FloatValueCollection>("CrossSection"); // running estimate of the cross section in pb, one entry per event
+	auto & costcoll = store.create<fcc::FloatValueCollection>("EventCPUTime"); // CPU time in s of the generate, decay and convert stages, three entries per event. Written with --event-cost only
 
 	// registering collections
-	writer.registerForWrite<fcc::EventInfoCollection>("EventInfo");
-	writer.registerForWrite<fcc::MCParticleCollection>("GenParticle");
-	writer.registerForWrite<fcc::GenVertexCollection>("GenVertex");
+	for(auto & writer : writers) {
+		writer->registerForWrite<fcc::EventInfoCollection>("EventInfo");
+		writer->registerForWrite<fcc::MCParticleCollection>("GenParticle");
+		writer->registerForWrite<fcc::GenVertexCollection>("GenVertex");
+		writer->registerForWrite<fcc::FloatValueCollection>("EventWeight");
+		writer->registerForWrite<fcc::FloatValueCollection>("CrossSection");
+		if(store_event_cost) {
+			writer->registerForWrite<fcc::FloatValueCollection>("EventCPUTime");
+		}
+	}
 
 	if(verbosity >= 1) {
 		std::cout << "Initializing PYTHIA" << std::endl;
@@ -151,6 +457,25 @@ int main(int argc, char * argv[]){
 	// initializing PYTHIA
 	Pythia8::Pythia pythia; // creating PYTHIA generator object
 	pythia.readFile(pythia_cfgfile); // reading settings from file
+	if(seed > 0) {
+		pythia.readString("Random:setSeed = on");
+		pythia.readString("Random:seed = " + std::to_string(seed));
+	}
+	if(workers) {
+		// workers must not generate the same events. The seed of the config file (or PYTHIA's default) is offset by the worker index
+		pythia.readString("Random:setSeed = on");
+		auto const seed = pythia.settings.mode("Random:seed") > 0 ? pythia.settings.mode("Random:seed") : 19780503; // PYTHIA's default seed
+		pythia.readString("Random:seed = " + std::to_string((seed + workers->index()) % 900000000));
+	}
+	auto const run_seed = pythia.settings.flag("Random:setSeed") && pythia.settings.mode("Random:seed") > 0 ? pythia.settings.mode("Random:seed") : 19780503; // base of the per-event seeds
+	if(!decay_only_filename.empty()) {
+		pythia.readString("ProcessLevel:all = off"); // events come from the input file, PYTHIA is only needed for particle data and random numbers of EvtGen
+	}
+	if(std::abs(bias_pthat_power) > 0.) {
+		pythia.readString("PhaseSpace:bias2Selection = on");
+		pythia.readString("PhaseSpace:bias2SelectionPow = " + std::to_string(bias_pthat_power));
+		pythia.readString("PhaseSpace:bias2SelectionRef = " + std::to_string(bias_pthat_ref));
+	}
 
 	pythia.init(); // initializing PYTHIA generator
 
@@ -172,48 +497,265 @@ int main(int argc, char * argv[]){
 
 	if (evtgen) {
 		evtgen->readDecayFile(evtgen_user_decfile.c_str()); // reading user defined decays
-		evtgen->exclude(23); // make PYTHIA itself (not EvtGen) decay Z
+		decay_with_pythia(*evtgen, pythia.particleData, 23); // make PYTHIA itself (not EvtGen) decay Z
+
+		// signal-only mode: the particles outside of the signal decay chains are decayed by PYTHIA
+		if(evtgen_signal_only) {
+			try {
+				SignalDecays const signal_decays(evtgen_user_decfile, evtgen_decfile, evtgen_pdlfile, samples.pdgs());
+				for(auto id : signal_decays.excluded()) {
+					decay_with_pythia(*evtgen, pythia.particleData, id);
+				}
+				if(!workers || workers->index() == 0) {
+					signal_decays.print(std::cout);
+				}
+			} catch(std::exception const & e) {
+				std::cerr << e.what() << ". Program stopped." << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
 	} else {
 		std::cerr << "Unable to initialize EvtGen. Program stopped." << std::endl;
 		return EXIT_FAILURE;
 	}
 
+	// particle properties of the conversion and selection loops, taken from PYTHIA's particle data after EvtGen has updated it
+	ParticleTable const particle_table(pythia.particleData);
+	std::string key_names; // names of the key particles for the printouts
+	for(auto const & sample : samples) {
+		key_names += (key_names.empty() ? "" : ", ") + particle_table.name(sample.pdg);
+	}
+
 	// interface for conversion from Pythia8::Event to HepMC event.
 	HepMC::Pythia8ToHepMC ToHepMC;
 
+	// HepMC event storage. It is created once and cleared after every event instead of being reallocated
+	HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+
+	// HepMC files of the generate-only and decay-only modes. Events are written and read one by one
+	std::unique_ptr<HepMC::IO_GenEvent> hepmc_output, hepmc_input;
+	if(!generate_only_filename.empty()) {
+		hepmc_output.reset(new HepMC::IO_GenEvent(generate_only_filename, std::ios::out));
+	}
+	if(!decay_only_filename.empty()) {
+		hepmc_input.reset(new HepMC::IO_GenEvent(decay_only_filename, std::ios::in));
+		if(hepmc_input->rdstate()) {
+			std::cerr << "Unable to open input file \"" << decay_only_filename << "\". Program stopped." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	bool input_exhausted = false; // set when the input file of the decay-only mode has no more events
+
+	std::vector<AcceptanceFilter> acceptance; // per sample, evaluated on the PYTHIA event before the conversion
+	for(auto const & sample : samples) {
+		acceptance.emplace_back(sample.pdg, acceptance_cuts);
+	}
+	MomentumEnhancement enhancement(samples.front().pdg, enhance_pmin, enhance_factor); // evaluated on the hadronized event before the decays. Only with a single key particle
+
+	// routing of the current event: the samples whose key particles are accepted and the key particles of every sample. Kept outside of the loop to reuse their memory
+	std::vector<char> sample_accepted(samples.size());
+	std::vector<std::size_t> keys_in_event(samples.size());
+
+	// selection steps of the event loop, in the order they are applied. Steps that aren't configured are left untested
+	Cutflow cutflow("the event selection");
+	auto const enhancement_step = cutflow.add("momentum enhancement");
+	auto const acceptance_step = cutflow.add("acceptance");
+	auto const key_step = cutflow.add("key particle");
+
+	WeightSummary weights; // weights of the stored events
+	double cross_section = 0., cross_section_error = 0.; // latest cross section estimate in pb, from PYTHIA or from the input file
+
+	EventArena arena; // memory for per-event scratch containers. Rewound after every event
+
+	// setting up memory accounting
+	MemoryMonitor memory_monitor(memory_budget * 1024 * 1024);
+	std::size_t last_event_entries = 0; // number of entries in the store collections of the last stored event
+	memory_monitor.add_component("store collections", [&last_event_entries]() {return last_event_entries * approx_podio_object_bytes;});
+	memory_monitor.add_component("writer buffers", [&writers]() {
+		std::size_t bytes = 0;
+		for(auto const & writer : writers) {
+			bytes += tree_buffer_bytes(find_writer_tree(writer->current_filename()));
+		}
+		return bytes;
+	});
+	memory_monitor.add_component("queued HepMC event", [&hepmcevt]() {return hepmcevt ? static_cast<std::size_t>(hepmcevt->particles_size()) * sizeof(HepMC::GenParticle) + static_cast<std::size_t>(hepmcevt->vertices_size()) * sizeof(HepMC::GenVertex) : 0;});
+	memory_monitor.add_component("event arena", [&arena]() {return arena.capacity();});
+	memory_monitor.add_component("background library", [&overlay_library]() {return overlay_library ? overlay_library->bytes() : 0;});
+	memory_monitor.set_flush_action([&writers]() {
+		for(auto const & writer : writers) {
+			flush_writer_tree(find_writer_tree(writer->current_filename()));
+		}
+	});
+	bool memory_exhausted = false; // set if the memory budget is exceeded. Generation is stopped then
+
 	auto generation_start_time = std::chrono::system_clock::now(); // time of beginning of the generation
 	auto last_timestamp = generation_start_time; // time of last time check
 
-	std::size_t keyptc_counter = 0; // number of events containing "key" particle generated so far
+	std::size_t keyptc_counter = 0; // number of "key" particles collected so far, all samples together
 	std::size_t total = 0; // total number of events generated so far
+	std::size_t stored_particles = 0, converted_particles = 0; // number of particles stored (of the largest copy of an event stored to several samples) and number of particles in the HepMC records of the stored events
+
+	// live status of the job, published by a background thread so that the event loop only updates counters
+	JobStatus status;
+	status.target = plan_target > 0 ? pilot_events : replay_seeds.empty() ? samples.quota() : replay_seeds.size();
+	std::unique_ptr<StatusReporter> status_reporter;
+	if(!status_filename.empty() || !status_socket.empty()) {
+		try {
+			status_reporter.reset(new StatusReporter(status, status_filename, status_socket, status_interval, workers ? "worker=\"" + std::to_string(workers->index()) + "\"" : ""));
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << ". Program stopped." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto heap_allocations_at_start = heap_allocation_count();
+
+	// CPU cost of the events
+	EventCost cost(status); // also passes the wall time of the stages to the status
+	LatencyHistogram latency;
+	std::unique_ptr<SlowEventLog> slow_events;
+	if(!slow_events_filename.empty()) {
+		try {
+			slow_events.reset(new SlowEventLog(slow_events_filename, slow_percentile));
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << ". Program stopped." << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+	std::size_t attempts = 0; // index of the current generation attempt, the per-event seeds are derived from it
+	int current_seed = 0; // seed of the current event with per-event seeding
+
+	// measurements of the pilot of the plan mode
+	PilotResult pilot;
+	pilot.init_seconds = std::chrono::duration<double>(std::chrono::system_clock::now() - program_start_time).count();
+
+	// stop condition: the quotas of key particles of all the samples, or the generated events of the pilot, or the seeds to replay
+	auto const more_events = [&]() {
+		if(plan_target > 0) {
+			return total < pilot_events;
+		}
+		if(!replay_seeds.empty()) {
+			return attempts < replay_seeds.size();
+		}
+		return !samples.filled();
+	};
+
+	while(more_events()) {
+		cost.start();
+		++attempts;
+		if(per_event_seeds) {
+			current_seed = replay_seeds.empty() ? event_seed(run_seed, attempts) : replay_seeds[attempts - 1];
+			pythia.rndm.init(current_seed); // EvtGen draws from PYTHIA's generator as well
+		}
+
+		// getting the next event: generating it or, in the decay-only mode, reading it from the input file
+		bool event_ready = false;
+		double event_weight = 1.; // weight of the event: PYTHIA bias weight times momentum enhancement weight, or the weight read from the input file
+		bool prescaled = false; // dropped by the momentum enhancement
+		if(hepmc_input) {
+			if(!hepmc_input->fill_next_event(hepmcevt)) {
+				input_exhausted = true;
+				break;
+			}
+
+			hepmcevt->use_units(HepMC::Units::GEV, HepMC::Units::MM); // the file may have been written in other units
+			fill_pythia_event(hepmcevt, pythia.event, arena);
+			if(!hepmcevt->weights().empty()) {
+				event_weight = hepmcevt->weights()[0];
+			}
+			if(hepmcevt->cross_section() && hepmcevt->cross_section()->is_set()) {
+				cross_section = hepmcevt->cross_section()->cross_section();
+				cross_section_error = hepmcevt->cross_section()->cross_section_error();
+			}
+			hepmcevt->clear();
+
+			event_ready = true;
+		} else {
+			event_ready = pythia.next();
+			if(event_ready) {
+				auto const enhancement_start = Cutflow::Clock::now();
+				prescaled = !enhancement.accept(pythia.event, pythia.rndm);
+				if(enhancement.enabled()) {
+					cutflow.record(enhancement_step, !prescaled, enhancement_start);
+				}
+				event_weight = pythia.info.weight() * enhancement.weight();
+				cross_section = pythia.info.sigmaGen() * 1e9; // mb to pb
+				cross_section_error = pythia.info.sigmaErr() * 1e9;
+			}
+		}
+
+		cost.lap(JobStatus::Generate);
 
-	while(keyptc_counter < nevents) {
-		if(pythia.next()) {
+		if(event_ready) {
 			++total;
+			status.event_generated(total);
 
-			evtgen->decay(); // performing user defined decays in EvtGen
+			// in the generate-only mode the decays are left for the decay-only mode
+			if(!prescaled && !hepmc_output) {
+				evtgen->decay(); // performing user defined decays in EvtGen
+				cost.lap(JobStatus::Decay);
+			}
+
+			// events with the key particles out of acceptance for every sample still collecting are not converted. The HepMC event stays empty, so no key particle is found in it below
+			bool selected = !prescaled;
+			std::fill(sample_accepted.begin(), sample_accepted.end(), 1);
+			if(selected && !hepmc_output && acceptance_cuts.enabled()) {
+				selected = cutflow.apply(acceptance_step, [&]() {
+					bool accepted = false;
+					for(std::size_t i = 0; i < samples.size(); ++i) {
+						sample_accepted[i] = !samples[i].filled() && acceptance[i].accept(pythia.event);
+						accepted = accepted || sample_accepted[i];
+					}
+					return accepted;
+				});
+			}
+			if(selected) {
+				hepmcevt->use_units(HepMC::Units::GEV, HepMC::Units::MM); // GenEvent::clear() resets the units to HepMC defaults
 
-			// creating HepMC event storage
-			HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+				// converting generated event to HepMC format
+				ToHepMC.fill_next_event(pythia, hepmcevt);
 
-			// converting generated event to HepMC format
-			ToHepMC.fill_next_event(pythia, hepmcevt);
+				// the weight written by Pythia8ToHepMC doesn't include the enhancement (and is meaningless in the decay-only mode)
+				if(hepmcevt->weights().empty()) {
+					hepmcevt->weights().push_back(event_weight);
+				} else {
+					hepmcevt->weights()[0] = event_weight;
+				}
+			}
 
-			auto keyptc_in_event = std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), [keyptc](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == keyptc && isBAtProduction(ptc_ptr);});
+			// routing: the event goes to every sample still collecting that has an accepted key particle in it
+			auto const key_start = Cutflow::Clock::now();
+			std::size_t keyptc_in_event = 0; // key particles of the samples the event goes to
+			for(std::size_t i = 0; i < samples.size(); ++i) {
+				keys_in_event[i] = samples[i].filled() || !sample_accepted[i] ? 0 : static_cast<std::size_t>(std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), is_key_particle[i]));
+				keyptc_in_event += keys_in_event[i];
+			}
+			if(selected) {
+				cutflow.record(key_step, keyptc_in_event > 0, key_start);
+			}
+			cost.lap(JobStatus::Convert);
 			if(keyptc_in_event > 0) {
 				keyptc_counter += keyptc_in_event;
+				for(std::size_t i = 0; i < samples.size(); ++i) {
+					if(keys_in_event[i] > 0) {
+						samples[i].keys += keys_in_event[i];
+						++samples[i].events;
+					}
+				}
+				++pilot.stored;
+				status.stored.store(keyptc_counter, std::memory_order_relaxed);
 
 				if(verbosity >= 2) {
 					hepmcevt->print();
 
-					std::cout << keyptc_counter << " events with " << ((particle_names.find(keyptc) != particle_names.end()) ? particle_names.at(keyptc) : std::to_string(keyptc)) << " production have been generated (" << total << " total)" << std::endl;
+					std::cout << keyptc_counter << " events with " << key_names << " production have been generated (" << total << " total)" << std::endl;
 					auto time_taken = std::chrono::duration<double>(std::chrono::system_clock::now() - last_timestamp).count();
 					std::cout << "Time taken: " << time_taken << " s. Current rate: " << 1. / time_taken << " ev / s" << std::endl;
 
 					last_timestamp = std::chrono::system_clock::now();
 				} else {
 					if(verbosity >= 1 && keyptc_counter % 100 == 0) {
-						std::cout << keyptc_counter << " events with " << ((particle_names.find(keyptc) != particle_names.end()) ? particle_names.at(keyptc) : std::to_string(keyptc)) << " production have been generated (" << total << " total)" << std::endl;
+						std::cout << keyptc_counter << " events with " << key_names << " production have been generated (" << total << " total)" << std::endl;
 						auto time_taken = std::chrono::duration<double>(std::chrono::system_clock::now() - last_timestamp).count();
 						std::cout << "Time taken: " << time_taken << " s. Current rate: " << 100. / time_taken << " ev / s" << std::endl;
 
@@ -221,103 +763,298 @@ int main(int argc, char * argv[]){
 					}
 				}
 
-				// filling event info
-				auto evinfo = fcc::EventInfo();
-				evinfo.Number(keyptc_counter); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
-				evinfocoll.push_back(evinfo);
-
-				// filling vertices
-				std::unordered_map<HepMC::GenVertex *, fcc::GenVertex> vtx_map;
-				for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
-					auto vtx = fcc::GenVertex();
-					vtx.Position().X = (*iv)->position().x();
-					vtx.Position().Y = (*iv)->position().y();
-					vtx.Position().Z = (*iv)->position().z();
-					vtx.Ctau((*iv)->position().t());
-					vtx_map.emplace(*iv, vtx);
-
-					vcoll.push_back(vtx);
-				}
-
-				// filling particles
-				for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
-					auto ptc = fcc::MCParticle();
-					auto & core = ptc.Core();
-					core.Type = (*ip)->pdg_id();
-					core.Status = (*ip)->status();
-
-					core.Charge = pythia.particleData.charge(core.Type); // PYTHIA returns charge as a double value (in case it's quark), so here's a narrowing conversion (double to int), but here it's safe
-					core.P4.Mass = (*ip)->momentum().m();
-					core.P4.Px = (*ip)->momentum().px();
-					core.P4.Py = (*ip)->momentum().py();
-					core.P4.Pz = (*ip)->momentum().pz();
-
-					auto prodvtx = vtx_map.find((*ip)->production_vertex());
-					if(prodvtx != vtx_map.end()) {
-						ptc.StartVertex(prodvtx->second);
-					}
-					auto endvtx = vtx_map.find((*ip)->end_vertex());
-					if(endvtx != vtx_map.end()) {
-						ptc.EndVertex(endvtx->second);
+				if(hepmc_output) {
+					hepmc_output->write_event(hepmcevt); // the undecayed event is all the generate-only mode keeps
+				} else if(!analysis_filename.empty()) {
+					observables.fill(hepmcevt, particle_table, is_key_particle.front(), event_weight); // the event is only histogrammed
+					weights.add(event_weight);
+					cost.lap(JobStatus::Convert);
+				} else {
+					// the event is counted once, however many samples it goes to
+					weights.add(event_weight);
+					converted_particles += static_cast<std::size_t>(hepmcevt->particles_size());
+					std::size_t most_stored = 0; // particles of the largest copy, the others are subsets of the same HepMC event
+					if(overlay) {
+						// once for all the copies, from a seed of its own so that PYTHIA's random numbers don't depend on the overlay
+						overlay->sample(event_seed(per_event_seeds ? current_seed : event_seed(run_seed, attempts), 0));
+						cost.lap(JobStatus::Convert);
 					}
+					auto const routed_convert = cost.cpu(JobStatus::Convert); // HepMC conversion, routing and overlay sampling, shared by the copies
+
+					// the event is stored once for every sample it goes to, each time with the signal tree of the key particle of the sample
+					for(std::size_t i = 0; i < samples.size(); ++i) {
+						if(keys_in_event[i] == 0) {
+							continue;
+						}
+						auto & sample = samples[i];
+						auto const copy_start = cost.cpu(JobStatus::Convert);
 
-					if(verbosity >= 2) {
-						auto const & pdg_id = ptc.Core().Type;
-						std::cout << "Stored particle: " << pdg_id << (particle_names.find(pdg_id) != particle_names.end() ? std::string(" (") + particle_names.at(pdg_id) + ")" : "") << std::endl;
+						// filling event info
+						auto evinfo = fcc::EventInfo();
+						evinfo.Number(sample.keys); // Number takes int as its parameter, so here's a narrowing conversion (std::size_t to int). Should be safe unless we get 2^32 events or more. Then undefined behaviour
+						evinfocoll.push_back(evinfo);
 
-						auto const & p4 = ptc.Core().P4;
-						std::cout << std::setprecision(12) << "\tP4: (Px = " << p4.Px << ", Py = " << p4.Py << ", Pz = " << p4.Pz << ", Mass = " << p4.Mass << ")" << std::endl;
+						// filling event weight and cross section
+						auto weight = fcc::FloatValue();
+						weight.Value(static_cast<float>(event_weight));
+						weightcoll.push_back(weight);
+						auto xsec = fcc::FloatValue();
+						xsec.Value(static_cast<float>(cross_section));
+						xseccoll.push_back(xsec);
 
-						if(ptc.StartVertex().isAvailable()) {
-							auto const & svtx = ptc.StartVertex().Position();
-							std::cout << std::setprecision(12) << "\tProduction vertex: (X = " << svtx.X << ", Y = " << svtx.Y << ", Z = " << svtx.Z << ")" << std::endl;
-						} else {
-							std::cout << "\tProduction vertex is not valid" << std::endl;
+						// filling vertices and particles
+						auto stored = converters[i](hepmcevt, particle_table, pcoll, vcoll, arena);
+						sample.stored_particles += stored;
+						most_stored = std::max(most_stored, stored);
+						if(overlay) {
+							overlay->append(pcoll, vcoll); // after the signal, so the indices of the signal particles don't change
 						}
+						cost.lap(JobStatus::Convert);
 
-						if(ptc.EndVertex().isAvailable()) {
-							auto const & evtx = ptc.EndVertex().Position();
-							std::cout << std::setprecision(12) << "\tDecay vertex: (X = " << evtx.X << ", Y = " << evtx.Y << ", Z = " << evtx.Z << ")" << std::endl;
-						} else {
-							std::cout << "\tDecay vertex is not valid" << std::endl;
+						// the write stage of the event isn't over yet, so it can't be stored. Every copy gets the shared stages and its own conversion, not the conversions of the copies before it
+						if(store_event_cost) {
+							double const stage_costs[] = {cost.cpu(JobStatus::Generate), cost.cpu(JobStatus::Decay), routed_convert + cost.cpu(JobStatus::Convert) - copy_start};
+							for(auto stage_cpu : stage_costs) {
+								auto stage_cost = fcc::FloatValue();
+								stage_cost.Value(static_cast<float>(stage_cpu));
+								costcoll.push_back(stage_cost);
+							}
 						}
 
-						if(ptc.StartVertex().isAvailable() && ptc.EndVertex().isAvailable()) {
-							auto const & svtx = ptc.StartVertex().Position(), evtx = ptc.EndVertex().Position();
+						if(verbosity >= 2) {
+							print_stored_particles(pcoll, particle_table);
+						}
+
+						last_event_entries = evinfocoll.size() + pcoll.size() + vcoll.size() + weightcoll.size() + xseccoll.size() + costcoll.size();
 
-							std::cout << std::setprecision(12) << "\tFlight distance: " << std::sqrt((evtx.X - svtx.X) * (evtx.X - svtx.X) + (evtx.Y - svtx.Y) * (evtx.Y - svtx.Y) + (evtx.Z - svtx.Z) * (evtx.Z - svtx.Z)) << "mm" << std::endl;
+						if(!indices.empty()) {
+							IndexRecord record;
+							record.event_number = evinfo.Number();
+							record.key_pdg = sample.pdg;
+							if(stream) {
+								record.shard = 0;
+								record.entry = stream->events();
+								record.bytes_before = stream->bytes();
+							} else {
+								record.shard = static_cast<std::uint32_t>(writers[i]->next_shard());
+								record.entry = writers[i]->next_entry();
+								auto tree = record.entry > 0 ? find_writer_tree(writers[i]->current_filename()) : nullptr;
+								record.bytes_before = tree ? static_cast<std::uint64_t>(tree->GetTotBytes()) : 0; // not a file position, the entry locates the event
+							}
+							fill_index_record(record, index_signature, hepmcevt, particle_table, is_key_particle[i]);
+							indices[i]->add(record, index_signature);
 						}
 
+						if(stream) {
+							try {
+								stream->write_event(evinfo.Number(), pcoll, vcoll);
+							} catch(std::exception const & e) {
+								std::cerr << e.what() << ". Stopping generation" << std::endl;
+								stream_broken = true;
+							}
+						} else {
+							writers[i]->writeEvent(evinfo.Number());
+						}
+						store.clearCollections();
+						cost.lap(JobStatus::Write);
 					}
-					pcoll.push_back(ptc);
+					stored_particles += most_stored;
 				}
+				cost.lap(JobStatus::Write);
+			}
 
-				writer.writeEvent();
-				store.clearCollections();
+			if(slow_events) {
+				slow_events->check(attempts, current_seed, cost, latency, keyptc_in_event > 0 ? keyptc_counter : 0);
+			}
+			latency.fill(cost.total());
+			pilot.event_seconds.add(cost.wall());
+			if(!replay_seeds.empty()) {
+				std::cout << "Event with seed " << current_seed << ": " << (keyptc_in_event > 0 ? "stored" : "not stored") << ", CPU time " << cost.total() << " s (generate " << cost.cpu(JobStatus::Generate) << " s, decay " << cost.cpu(JobStatus::Decay) << " s, convert " << cost.cpu(JobStatus::Convert) << " s, write " << cost.cpu(JobStatus::Write) << " s)" << std::endl;
 			}
 
-			// freeing resources
-			if(hepmcevt) {
-				delete hepmcevt;
-				hepmcevt = nullptr;
+			// keeping an eye on memory usage
+			if(memory_check_interval > 0 && total % memory_check_interval == 0) {
+				if(verbosity >= 1) {
+					memory_monitor.print(std::cout);
+				}
+
+				if(memory_monitor.check() == MemoryMonitor::Status::Exceeded) {
+					std::cerr << "Memory budget of " << memory_budget << " MB exceeded even after flushing. Stopping generation" << std::endl;
+					memory_exhausted = true;
+				}
+			}
+
+			// preparing for the next event
+			hepmcevt->clear();
+			arena.reset();
+
+			if(memory_exhausted || stream_broken) {
+				break;
 			}
 		}
 	}
 
 	auto elapsed_time = std::chrono::duration<double>(std::chrono::system_clock::now() - generation_start_time).count();
+	auto heap_allocations = heap_allocation_count() - heap_allocations_at_start;
+	if(status_reporter) {
+		status_reporter->stop(); // the final status says the job is no longer running
+	}
 
-	writer.finish();
+	for(auto & writer : writers) {
+		writer->finish();
+	}
+	if(stream) {
+		stream->close(); // the consumer sees the end of the stream
+	}
+	for(auto & index : indices) {
+		index->close();
+	}
+	hepmc_output.reset(); // closing the HepMC files
+	hepmc_input.reset();
 
 	// freeing resources
+	if(hepmcevt) {
+		delete hepmcevt;
+		hepmcevt = nullptr;
+	}
+
 	if(evtgen) {
 		delete evtgen;
 		evtgen = nullptr;
 	}
 
-	std::cout << keyptc_counter << " events with production of " << ((particle_names.find(keyptc) != particle_names.end()) ? particle_names.at(keyptc) : std::to_string(keyptc)) << " have been generated (" << total << " total)." << std::endl;
+	std::cout << keyptc_counter << " events with production of " << key_names << " have been generated (" << total << " total)." << std::endl;
+	if(samples.size() > 1) {
+		for(auto const & sample : samples) {
+			std::cout << "\t" << particle_table.name(sample.pdg) << ": " << sample.keys << " of " << sample.quota << " key particles in " << sample.events << " events" << (writers.empty() ? "" : " written to \"" + sample.output_filename + "\"") << std::endl;
+		}
+	}
+	if(acceptance_cuts.enabled()) {
+		for(std::size_t i = 0; i < samples.size(); ++i) {
+			if(samples.size() > 1) {
+				std::cout << particle_table.name(samples[i].pdg) << " ";
+			}
+			acceptance[i].print(std::cout);
+		}
+	}
+	if(enhancement.enabled()) {
+		std::cout << "Momentum enhancement dropped " << enhancement.prescaled() << " events without " << key_names << " above " << enhance_pmin << " GeV" << std::endl;
+	}
+	cutflow.print(std::cout);
+	weights.print(std::cout, cross_section * 1e-9, cross_section_error * 1e-9);
+	if(persistence_policy != PersistencePolicy::Full) {
+		std::cout << "Stored " << stored_particles << " of " << converted_particles << " particles (" << to_string(persistence_policy) << " policy)" << std::endl;
+		if(samples.size() > 1) {
+			for(auto const & sample : samples) {
+				std::cout << "\t" << particle_table.name(sample.pdg) << " sample: " << sample.stored_particles << " particles in " << sample.events << " events" << std::endl;
+			}
+		}
+	}
+	if(input_exhausted) {
+		std::cout << "Input file \"" << decay_only_filename << "\" ended after " << total << " events" << std::endl;
+	}
+	if(stream) {
+		std::cout << "Streamed " << stream->events() << " events (" << stream->bytes() << " bytes) to \"" << stream_destination << "\"" << std::endl;
+	}
+	for(auto const & index : indices) {
+		std::cout << "Index of " << index->records() << " events written to " << index->index_filename() << std::endl;
+	}
+	for(auto const & writer : writers) {
+		if(writer->is_sharded()) {
+			std::cout << "Output written to " << writer->shards() << " files, see " << writer->manifest_filename() << std::endl;
+		}
+	}
+	if(!analysis_filename.empty()) {
+		try {
+			observables.write(analysis_filename);
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+		if(!workers) {
+			observables.print(std::cout, verbosity >= 1);
+			std::cout << "Histograms written to " << analysis_filename << std::endl;
+		}
+	}
 	std::cout << "Elapsed time: " << elapsed_time << " s. Mean rate: " << static_cast<long double>(keyptc_counter) / static_cast<long double>(elapsed_time) << " ev / s." << std::endl;
+	std::cout << "Heap allocations: " << heap_allocations << " (" << static_cast<long double>(heap_allocations) / static_cast<long double>(std::max<std::size_t>(total, 1)) << " per generated event, " << static_cast<long double>(heap_allocations) / static_cast<long double>(elapsed_time) << " / s). Event arena: " << arena.capacity() << " bytes in " << arena.upstream_allocations() << " blocks" << std::endl;
+	latency.print(std::cout);
+	std::cout << "CPU time per stage:";
+	for(int stage = 0; stage < JobStatus::nstages; ++stage) {
+		std::cout << (stage > 0 ? "," : "") << " " << JobStatus::stage_name(static_cast<JobStatus::Stage>(stage)) << " " << cost.run_cpu(static_cast<JobStatus::Stage>(stage)) << " s";
+	}
+	std::cout << std::endl;
+	if(overlay) {
+		overlay->print(std::cout);
+	}
+	if(slow_events) {
+		std::cout << slow_events->events() << " events above the " << slow_percentile << "% CPU time percentile logged to " << slow_events->filename() << std::endl;
+	}
+	memory_monitor.print(std::cout);
+	memory_monitor.print_flushes(std::cout);
+
+	// plan mode: sizing the real jobs from the pilot
+	if(plan_target > 0) {
+		pilot.generated = total;
+		pilot.key_particles = keyptc_counter;
+		pilot.peak_rss = MemoryMonitor::peak_rss();
+		pilot.output_bytes = !writers.empty() ? writers.front()->bytes() : stream ? stream->bytes() : 0; // the plan mode has a single sample
+		try {
+			JobPlan(pilot, plan_target, wall_limit, wall_safety, run_seed).print(std::cout);
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(workers) {
+		workers->report(keyptc_counter, total, elapsed_time);
+	}
+
+	return (memory_exhausted || stream_broken) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// prints the content of the particle collection. Used at verbosity level 2
+void print_stored_particles(fcc::MCParticleCollection const & pcoll, ParticleTable const & particles) {
+	// structure-of-arrays view of the stored particles and derived quantities
+	ParticleBatch batch;
+	std::vector<double> batch_pt, batch_eta, batch_phi, batch_flight_distance;
 
-	return EXIT_SUCCESS;
+	fill_batch(batch, pcoll);
+	compute_pt(batch, batch_pt);
+	compute_eta(batch, batch_eta);
+	compute_phi(batch, batch_phi);
+	compute_flight_distance(batch, batch_flight_distance);
+
+	std::size_t i = 0; // index of the particle in the batch
+	for(auto const & ptc : pcoll) {
+		auto const & pdg_id = ptc.Core().Type;
+		std::cout << "Stored particle: " << pdg_id << (particles.is_known(pdg_id) ? " (" + particles.name(pdg_id) + ")" : std::string()) << std::endl;
+
+		auto const & p4 = ptc.Core().P4;
+		std::cout << std::setprecision(12) << "\tP4: (Px = " << p4.Px << ", Py = " << p4.Py << ", Pz = " << p4.Pz << ", Mass = " << p4.Mass << ")" << std::endl;
+		std::cout << std::setprecision(12) << "\tPt = " << batch_pt[i] << ", Eta = " << batch_eta[i] << ", Phi = " << batch_phi[i] << std::endl;
+
+		if(ptc.StartVertex().isAvailable()) {
+			auto const & svtx = ptc.StartVertex().Position();
+			std::cout << std::setprecision(12) << "\tProduction vertex: (X = " << svtx.X << ", Y = " << svtx.Y << ", Z = " << svtx.Z << ")" << std::endl;
+		} else {
+			std::cout << "\tProduction vertex is not valid" << std::endl;
+		}
+
+		if(ptc.EndVertex().isAvailable()) {
+			auto const & evtx = ptc.EndVertex().Position();
+			std::cout << std::setprecision(12) << "\tDecay vertex: (X = " << evtx.X << ", Y = " << evtx.Y << ", Z = " << evtx.Z << ")" << std::endl;
+		} else {
+			std::cout << "\tDecay vertex is not valid" << std::endl;
+		}
+
+		if(ptc.StartVertex().isAvailable() && ptc.EndVertex().isAvailable()) {
+			std::cout << std::setprecision(12) << "\tFlight distance: " << batch_flight_distance[i] << "mm" << std::endl;
+		}
+
+		++i;
+	}
 }
 
 // utility function to determine whether the particle is NOT a B oscillation. Stolen from https://lhcb-release-area.web.cern.ch/LHCb-release-area/DOC/rec/latest_doxygen/da/db4/_hep_m_c_utils_8h_source.html
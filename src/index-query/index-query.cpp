@@ -0,0 +1,162 @@
+/// Query tool for the sidecar event index written by the generator with --index
+/// Prints the stored events matching the requested key particle, decay signature and multiplicities without opening the event data
+/// Output: one line per matching event with the output file (taken from the shard manifest if the output is sharded), entry, event number, number of key particles, signature hash, multiplicity, charged multiplicity and bytes written before the event (see IndexRecord)
+
+// Configuration
+#include "GeneratorConfig.h"
+
+// Common utilities
+#include "EventIndex.h"
+
+// STL
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdlib>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#ifdef USE_BOOST
+	// Boost
+	#include "boost/program_options.hpp"
+#endif
+
+std::vector<std::string> read_manifest(std::string const & manifest_filename); // output file names of the shards, empty if there is no manifest
+
+int main(int argc, char * argv[]){
+	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the index file; every event is printed then
+	std::string index_filename; // index to query
+	std::string output_filename; // output file the index belongs to. Only used if there is no manifest
+	int key_pdg = 0; // required key particle, 0 means any
+	std::size_t min_keys = 0; // minimum number of key particles
+	std::string signature; // required decay signature: hash (hexadecimal with a 0x prefix) or signature text
+	std::size_t min_multiplicity = 0, max_multiplicity = std::numeric_limits<std::size_t>::max(); // stable multiplicity range
+	std::size_t min_charged = 0, max_charged = std::numeric_limits<std::size_t>::max(); // stable charged multiplicity range
+	bool list_signatures = false; // print the signatures with the number of matching events instead of the events
+	bool count_only = false; // print the number of matching events only
+
+	#ifdef USE_BOOST
+		try {
+			boost::program_options::options_description desc("Usage");
+
+			// defining command line options. See boost::program_options documentation for more details
+			desc.add_options()
+							("help", "produce this help message")
+							("index,i", boost::program_options::value<std::string>(&index_filename), "Index file (output.index)")
+							("outfile,o", boost::program_options::value<std::string>(&output_filename), "Output file the index belongs to, printed for unsharded outputs (by default the index name with .root)")
+							("key,k", boost::program_options::value<int>(&key_pdg)->default_value(0), "PDG ID of the key particle (0 means any)")
+							("min-keys", boost::program_options::value<std::size_t>(&min_keys)->default_value(0), "Minimum number of key particles")
+							("signature,s", boost::program_options::value<std::string>(&signature), "Decay signature: its hash with the 0x prefix as listed by --signatures, or the signature itself")
+							("min-multiplicity", boost::program_options::value<std::size_t>(&min_multiplicity)->default_value(0), "Minimum number of stable particles")
+							("max-multiplicity", boost::program_options::value<std::size_t>(&max_multiplicity)->default_value(std::numeric_limits<std::size_t>::max()), "Maximum number of stable particles")
+							("min-charged", boost::program_options::value<std::size_t>(&min_charged)->default_value(0), "Minimum number of stable charged particles")
+							("max-charged", boost::program_options::value<std::size_t>(&max_charged)->default_value(std::numeric_limits<std::size_t>::max()), "Maximum number of stable charged particles")
+							("signatures", boost::program_options::bool_switch(&list_signatures), "List the decay signatures of the matching events with their counts")
+							("count", boost::program_options::bool_switch(&count_only), "Print the number of matching events only")
+			;
+			boost::program_options::positional_options_description positional;
+			positional.add("index", 1);
+
+			boost::program_options::variables_map vm;
+			boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+			boost::program_options::notify(vm);
+
+			if(vm.find("help") != vm.end() || index_filename.empty()) {
+				std::cout << "Query tool for the generator event index. Version " << Generator_VERSION_MAJOR << '.' << Generator_VERSION_MINOR << std::endl;
+				std::cout << desc << std::endl;
+
+				return EXIT_SUCCESS;
+			}
+		} catch(std::exception const & e) {
+			std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	#else
+		if(argc < 2) {
+			std::cout << "Query tool for the generator event index. Version " << Generator_VERSION_MAJOR << '.' << Generator_VERSION_MINOR << std::endl;
+			std::cout << "Usage: " << argv[0] << " index, where \"index\" is the index file. All events are printed" << std::endl;
+
+			return EXIT_SUCCESS;
+		} else {
+			index_filename = argv[1];
+		}
+	#endif
+
+	std::vector<IndexRecord> records;
+	std::unordered_map<std::uint64_t, std::string> signatures;
+	try {
+		records = read_index(index_filename);
+		signatures = read_signatures(event_index::signatures_filename(index_filename));
+	} catch(std::exception const & e) {
+		std::cerr << e.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	std::uint64_t signature_required = 0;
+	if(!signature.empty()) {
+		try {
+			signature_required = parse_signature(signature);
+		} catch(std::invalid_argument const & e) {
+			std::cerr << e.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	auto shard_files = read_manifest(event_index::stem(index_filename) + ".manifest");
+	if(output_filename.empty()) {
+		output_filename = event_index::stem(index_filename) + ".root";
+	}
+
+	std::size_t matches = 0;
+	std::map<std::uint64_t, std::size_t> signature_counts; // ordered, so that the listing is stable
+	for(auto const & record : records) {
+		if((key_pdg != 0 && record.key_pdg != key_pdg) || record.key_count < min_keys || (signature_required != 0 && record.signature != signature_required) ||
+		   record.multiplicity < min_multiplicity || record.multiplicity > max_multiplicity || record.charged_multiplicity < min_charged || record.charged_multiplicity > max_charged) {
+			continue;
+		}
+
+		++matches;
+		if(list_signatures) {
+			++signature_counts[record.signature];
+		} else if(!count_only) {
+			std::cout << (record.shard < shard_files.size() ? shard_files[record.shard] : (shard_files.empty() ? output_filename : "shard " + std::to_string(record.shard))) << ' ' << record.entry << ' ' << record.event_number << ' ' << record.key_count << ' ' << format_signature_hash(record.signature) << ' ' << record.multiplicity << ' ' << record.charged_multiplicity << ' ' << record.bytes_before << std::endl;
+		}
+	}
+
+	if(list_signatures) {
+		for(auto const & count : signature_counts) {
+			auto text = signatures.find(count.first);
+			std::cout << std::setw(10) << count.second << ' ' << format_signature_hash(count.first) << ' ' << (text != signatures.end() ? text->second : (count.first == 0 ? "(no key particle)" : "(unknown)")) << std::endl;
+		}
+	}
+
+	if(count_only || list_signatures) {
+		std::cout << matches << " of " << records.size() << " events match" << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+// output file names of the shards, empty if there is no manifest
+std::vector<std::string> read_manifest(std::string const & manifest_filename) {
+	std::vector<std::string> shard_files;
+
+	std::ifstream manifest(manifest_filename);
+	std::string line;
+	while(std::getline(manifest, line)) {
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		shard_files.push_back(line.substr(0, line.find(' ')));
+	}
+
+	return shard_files;
+}
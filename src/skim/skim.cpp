@@ -0,0 +1,445 @@
+/// Offline skim of stored samples
+/// Reads the GenParticle and GenVertex collections of one or more generator outputs, applies the selection of EventSelection.h (key particle, decay signature, charged tracks, acceptance) and writes the selected events to a new output, numbered from 1
+/// A reader thread decodes the input into chunks of events, the selection of each chunk is spread over the worker threads, and the main thread writes the selected events in input order, so the output doesn't depend on the number of threads
+/// EventWeight and CrossSection are copied along if the inputs have them. The inputs are checked before the skim starts: weighted and unweighted inputs can't be combined, the unweighted events would need a weight made up for them
+
+// Configuration
+#include "GeneratorConfig.h"
+
+// Common utilities
+#include "EventSelection.h"
+#include "Cutflow.h"
+#include "ShardedWriter.h"
+
+// Data model
+#include "datamodel/EventInfo.h"
+#include "datamodel/EventInfoCollection.h"
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+#include "datamodel/GenVertexCollection.h"
+#include "datamodel/FloatValue.h"
+#include "datamodel/FloatValueCollection.h"
+
+// PODIO
+#include "podio/EventStore.h"
+#include "podio/ROOTReader.h"
+
+// ROOT
+#include "TROOT.h"
+#include "TFile.h"
+#include "TTree.h"
+
+// STL
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdint>
+
+#ifdef USE_BOOST
+	// Boost
+	#include "boost/program_options.hpp"
+#endif
+
+// stored event decoded from the collections
+struct SkimEvent {
+	StreamEvent event;
+	float weight; // 1 and 0 if the input has no event weights
+	float cross_section; // pb
+};
+
+// bounded queue of decoded chunks between the reader thread and the main thread. The bound keeps the reader from running ahead of the output by more than a few chunks
+class ChunkQueue {
+public:
+	explicit ChunkQueue(std::size_t capacity) : m_capacity(capacity), m_closed(false) {}
+
+	// false if the queue has been closed, the chunk is dropped then
+	bool push(std::vector<SkimEvent> && chunk) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_not_full.wait(lock, [this] {return m_chunks.size() < m_capacity || m_closed;});
+		if(m_closed) {
+			return false;
+		}
+
+		m_chunks.push_back(std::move(chunk));
+		m_not_empty.notify_one();
+		return true;
+	}
+
+	// false once the queue is closed and empty
+	bool pop(std::vector<SkimEvent> & chunk) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_not_empty.wait(lock, [this] {return !m_chunks.empty() || m_closed;});
+		if(m_chunks.empty()) {
+			return false;
+		}
+
+		chunk = std::move(m_chunks.front());
+		m_chunks.pop_front();
+		m_not_full.notify_one();
+		return true;
+	}
+
+	// called by the reader at the end of the input, or by the main thread to stop the reader
+	void close() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		m_not_empty.notify_all();
+		m_not_full.notify_all();
+	}
+
+private:
+	std::size_t m_capacity;
+	bool m_closed;
+	std::deque<std::vector<SkimEvent>> m_chunks;
+	std::mutex m_mutex;
+	std::condition_variable m_not_empty;
+	std::condition_variable m_not_full;
+};
+
+bool input_weighted(std::string const & filename); // the input has EventWeight and CrossSection
+void read_events(std::vector<std::string> const & input_filenames, bool weighted, std::size_t chunk_size, ChunkQueue & queue, std::exception_ptr & error); // reader thread
+void encode_event(StreamEvent const & event, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll); // plain event -> collections
+
+int main(int argc, char * argv[]){
+	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line options are the input and output files; every event with the key particle B0 is selected then
+	std::vector<std::string> input_filenames; // stored samples to skim
+	std::string output_filename = "skim.root"; // name of the output file
+	std::size_t nthreads = std::max(1u, std::thread::hardware_concurrency()); // number of selection threads
+	std::size_t chunk_size = 1000; // number of events handed over from the reader at once
+	std::size_t max_events_per_file = 0; // a new output file is started after this many events, 0 means no limit
+	std::string signature; // required decay signature: hash (hexadecimal with a 0x prefix) or signature text
+	SelectionCuts cuts; // selection. Key particle B0 by default
+	cuts.key_pdg = 511;
+	std::size_t verbosity = 0; // verbosity level
+
+	#ifdef USE_BOOST
+		try {
+			boost::program_options::options_description desc("Usage");
+
+			// defining command line options. See boost::program_options documentation for more details
+			desc.add_options()
+							("help", "produce this help message")
+							("input,i", boost::program_options::value<std::vector<std::string>>(&input_filenames), "Input files written by the generators (also accepted as positional arguments)")
+							("outfile,o", boost::program_options::value<std::string>(&output_filename)->default_value("skim.root"), "Output file")
+							("threads,j", boost::program_options::value<std::size_t>(&nthreads)->default_value(nthreads), "Number of selection threads")
+							("chunk", boost::program_options::value<std::size_t>(&chunk_size)->default_value(1000), "Number of events read ahead and selected at once")
+							("keyparticle,k", boost::program_options::value<int>(&cuts.key_pdg)->default_value(511), "PDG ID of the key particle (0 selects every event)")
+							("signature,s", boost::program_options::value<std::string>(&signature), "Required decay signature of the event: its hash with the 0x prefix as listed by index-query --signatures, or the signature itself")
+							("min-charged-tracks", boost::program_options::value<std::size_t>(&cuts.min_charged_tracks)->default_value(0), "Minimum number of charged tracks (pi, K, p, e, mu) among the stable descendants of the key particle")
+							("acceptance-costheta", boost::program_options::value<double>(&cuts.acceptance.max_abs_costheta)->default_value(1.), "Keep only events where all stable charged descendants of the key particle have |cos(theta)| below this value (1 disables the cut)")
+							("acceptance-pmin", boost::program_options::value<double>(&cuts.acceptance.min_p)->default_value(0.), "Keep only events where all stable charged descendants of the key particle have momentum above this value in GeV (0 disables the cut)")
+							("acceptance-ptmin", boost::program_options::value<double>(&cuts.acceptance.min_pt)->default_value(0.), "Keep only events where all stable charged descendants of the key particle have transverse momentum above this value in GeV (0 disables the cut)")
+							("max-events-per-file", boost::program_options::value<std::size_t>(&max_events_per_file)->default_value(0), "Start a new numbered output file after this many events (0 means no limit)")
+							("verbosity,v", boost::program_options::value<std::size_t>(&verbosity)->implicit_value(1), "Set verbosity level (0, 1)")
+			;
+			boost::program_options::positional_options_description positional;
+			positional.add("input", -1);
+
+			boost::program_options::variables_map vm;
+			boost::program_options::store(boost::program_options::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+			boost::program_options::notify(vm);
+
+			if(vm.find("help") != vm.end() || input_filenames.empty()) {
+				std::cout << "Skim of stored generator samples. Version " << Generator_VERSION_MAJOR << '.' << Generator_VERSION_MINOR << std::endl;
+				std::cout << desc << std::endl;
+
+				return EXIT_SUCCESS;
+			}
+
+			if(nthreads == 0 || chunk_size == 0) {
+				throw std::invalid_argument("The number of threads and the chunk size must be positive");
+			}
+			if(!signature.empty() && cuts.key_pdg == 0) {
+				throw std::invalid_argument("--signature requires a key particle");
+			}
+		} catch(std::exception const & e) {
+			std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	#else
+		if(argc < 3) {
+			std::cout << "Skim of stored generator samples. Version " << Generator_VERSION_MAJOR << '.' << Generator_VERSION_MINOR << std::endl;
+			std::cout << "Usage: " << argv[0] << " input output, where \"input\" is a file written by the generators and \"output\" is the output file. Events with a B0 are selected" << std::endl;
+
+			return EXIT_SUCCESS;
+		} else {
+			input_filenames.push_back(argv[1]);
+			output_filename = argv[2];
+		}
+	#endif
+
+	if(!signature.empty()) {
+		try {
+			cuts.signature = parse_signature(signature);
+		} catch(std::invalid_argument const & e) {
+			std::cerr << e.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	Cutflow cutflow("the skim selection");
+	EventSelection const selection(cuts, &cutflow); // the selection threads count in their own counters
+
+	if(verbosity >= 1) {
+		std::cout << "Skimming " << input_filenames.size() << " files with " << nthreads << " threads into " << output_filename << std::endl;
+	}
+
+	// the output has event weights if the inputs have them, so all of them must or none
+	bool weighted = false;
+	try {
+		for(std::size_t i = 0; i < input_filenames.size(); ++i) {
+			bool const input = input_weighted(input_filenames[i]);
+			if(i == 0) {
+				weighted = input;
+			} else if(input != weighted) {
+				throw std::invalid_argument(input_filenames[i] + (input ? " has" : " has no") + " event weights, unlike " + input_filenames.front() + ". Weighted and unweighted samples must be skimmed separately");
+			}
+		}
+	} catch(std::exception const & e) {
+		std::cerr << e.what() << std::endl;
+
+		return EXIT_FAILURE;
+	}
+
+	ROOT::EnableThreadSafety(); // the reader thread and the writer use ROOT at the same time
+
+	auto start_time = std::chrono::system_clock::now();
+
+	// starting the reader
+	ChunkQueue queue(4);
+	std::exception_ptr read_error;
+	std::thread reader(read_events, std::cref(input_filenames), weighted, chunk_size, std::ref(queue), std::ref(read_error));
+
+	// prepairing event store. The output is opened with the first chunk, so that nothing is written if the input can't be read
+	podio::EventStore store;
+	std::unique_ptr<ShardedWriter> writer;
+	auto & evinfocoll = store.create<fcc::EventInfoCollection>("EventInfo");
+	auto & pcoll = store.create<fcc::MCParticleCollection>("GenParticle");
+	auto & vcoll = store.create<fcc::GenVertexCollection>("GenVertex");
+	auto & weightcoll = store.create<fcc::FloatValueCollection>("EventWeight");
+	auto & xseccoll = store.create<fcc::FloatValueCollection>("CrossSection");
+
+	std::size_t nread = 0, nselected = 0;
+	std::vector<SkimEvent> chunk;
+	std::vector<char> selected; // selection flags of the chunk. Not std::vector<bool>, the threads write neighbouring flags at the same time
+	std::vector<EventTopology> topologies(nthreads); // one per thread, kept between chunks
+	std::vector<std::thread> workers;
+	bool write_failed = false;
+	while(queue.pop(chunk)) {
+		// selecting. Events are interleaved over the threads, so that a run of big events doesn't end up in one of them
+		selected.assign(chunk.size(), 0);
+		workers.clear();
+		for(std::size_t t = 0; t < nthreads; ++t) {
+			workers.emplace_back([&, t] {
+				for(std::size_t i = t; i < chunk.size(); i += nthreads) {
+					selected[i] = selection.select(chunk[i].event, topologies[t]) ? 1 : 0;
+				}
+			});
+		}
+		for(auto & worker : workers) {
+			worker.join();
+		}
+
+		// writing the selected events in input order
+		try {
+			if(!writer) {
+				writer.reset(new ShardedWriter(output_filename, &store, max_events_per_file));
+				writer->registerForWrite<fcc::EventInfoCollection>("EventInfo");
+				writer->registerForWrite<fcc::MCParticleCollection>("GenParticle");
+				writer->registerForWrite<fcc::GenVertexCollection>("GenVertex");
+				if(weighted) {
+					writer->registerForWrite<fcc::FloatValueCollection>("EventWeight");
+					writer->registerForWrite<fcc::FloatValueCollection>("CrossSection");
+				}
+			}
+
+			for(std::size_t i = 0; i < chunk.size(); ++i) {
+				if(!selected[i]) {
+					continue;
+				}
+
+				++nselected;
+				auto evinfo = fcc::EventInfo();
+				evinfo.Number(static_cast<int>(nselected)); // events are renumbered from 1
+				evinfocoll.push_back(evinfo);
+
+				if(weighted) {
+					auto weight = fcc::FloatValue();
+					weight.Value(chunk[i].weight);
+					weightcoll.push_back(weight);
+					auto xsec = fcc::FloatValue();
+					xsec.Value(chunk[i].cross_section);
+					xseccoll.push_back(xsec);
+				}
+
+				encode_event(chunk[i].event, pcoll, vcoll);
+
+				writer->writeEvent(static_cast<int>(nselected));
+				store.clearCollections();
+			}
+		} catch(std::exception const & e) {
+			std::cerr << e.what() << ". Stopping the skim" << std::endl;
+			write_failed = true;
+			queue.close(); // stops the reader
+			break;
+		}
+
+		nread += chunk.size();
+		if(verbosity >= 1) {
+			std::cout << nselected << " of " << nread << " events selected" << std::endl;
+		}
+	}
+
+	reader.join();
+	if(writer) {
+		writer->finish();
+	}
+
+	if(read_error) {
+		try {
+			std::rethrow_exception(read_error);
+		} catch(std::exception const & e) {
+			std::cerr << "Unable to read the input: " << e.what() << std::endl;
+		}
+	}
+
+	auto elapsed_time = std::chrono::duration<double>(std::chrono::system_clock::now() - start_time).count();
+
+	std::cout << nselected << " of " << nread << " events selected";
+	if(cuts.key_pdg != 0) {
+		std::cout << " (key particle " << cuts.key_pdg;
+		if(cuts.signature != 0) {
+			std::cout << ", signature " << format_signature_hash(cuts.signature);
+		}
+		if(cuts.min_charged_tracks > 0) {
+			std::cout << ", at least " << cuts.min_charged_tracks << " charged tracks";
+		}
+		if(cuts.acceptance.enabled()) {
+			std::cout << ", |cos(theta)| < " << cuts.acceptance.max_abs_costheta << ", p > " << cuts.acceptance.min_p << " GeV, pT > " << cuts.acceptance.min_pt << " GeV";
+		}
+		std::cout << ")";
+	}
+	std::cout << std::endl;
+	if(cuts.key_pdg != 0) {
+		cutflow.print(std::cout);
+	}
+	if(writer && writer->is_sharded()) {
+		std::cout << "Output written to " << writer->shards() << " files, see " << writer->manifest_filename() << std::endl;
+	}
+	std::cout << "Elapsed time: " << elapsed_time << " s. Mean rate: " << static_cast<long double>(nread) / static_cast<long double>(elapsed_time) << " ev / s read." << std::endl;
+
+	return (read_error || write_failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// the input has EventWeight and CrossSection branches in the tree podio writes the events to
+bool input_weighted(std::string const & filename) {
+	std::unique_ptr<TFile> file(TFile::Open(filename.c_str(), "READ"));
+	auto tree = file ? dynamic_cast<TTree *>(file->Get("events")) : nullptr;
+	if(!tree) {
+		throw std::runtime_error("Unable to read the events of " + filename);
+	}
+
+	return tree->GetBranch("EventWeight") && tree->GetBranch("CrossSection");
+}
+
+// reader thread: decodes the input events in chunks of chunk_size and hands them over to the main thread. "weighted" tells whether every entry has an event weight (see input_weighted). Errors are passed on through "error"; the queue is closed in any case
+void read_events(std::vector<std::string> const & input_filenames, bool weighted, std::size_t chunk_size, ChunkQueue & queue, std::exception_ptr & error) {
+	try {
+		podio::ROOTReader reader;
+		podio::EventStore store;
+		reader.openFiles(input_filenames);
+		store.setReader(&reader);
+
+		std::vector<SkimEvent> chunk;
+		chunk.reserve(chunk_size);
+		for(unsigned i = 0, nentries = reader.getEntries(); i < nentries; ++i) {
+			fcc::MCParticleCollection const * pcoll = nullptr;
+			fcc::GenVertexCollection const * vcoll = nullptr;
+			if(!store.get("GenParticle", pcoll) || !store.get("GenVertex", vcoll)) {
+				throw std::runtime_error("Entry " + std::to_string(i) + " has no GenParticle and GenVertex collections");
+			}
+
+			chunk.emplace_back();
+			auto & skim_event = chunk.back();
+			fill_stream_event(static_cast<int>(i), *pcoll, *vcoll, skim_event.event);
+
+			fcc::FloatValueCollection const * weightcoll = nullptr;
+			fcc::FloatValueCollection const * xseccoll = nullptr;
+			bool const has_weight = weighted && store.get("EventWeight", weightcoll) && store.get("CrossSection", xseccoll) && weightcoll->size() > 0 && xseccoll->size() > 0;
+			if(has_weight != weighted) {
+				throw std::runtime_error("Entry " + std::to_string(i) + " has no event weight");
+			}
+			skim_event.weight = has_weight ? (*weightcoll)[0].Value() : 1.f;
+			skim_event.cross_section = has_weight ? (*xseccoll)[0].Value() : 0.f;
+
+			store.clear();
+			reader.endOfEvent();
+
+			if(chunk.size() == chunk_size) {
+				if(!queue.push(std::move(chunk))) {
+					break;
+				}
+				chunk = std::vector<SkimEvent>();
+				chunk.reserve(chunk_size);
+			}
+		}
+
+		if(!chunk.empty()) {
+			queue.push(std::move(chunk));
+		}
+	} catch(...) {
+		error = std::current_exception();
+	}
+
+	queue.close();
+}
+
+void encode_event(StreamEvent const & event, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll) {
+	std::vector<fcc::GenVertex> vertices;
+	vertices.reserve(event.vertices.size());
+	for(auto const & v : event.vertices) {
+		auto vtx = fcc::GenVertex();
+		vtx.Position().X = v.x;
+		vtx.Position().Y = v.y;
+		vtx.Position().Z = v.z;
+		vtx.Ctau(static_cast<float>(v.ctau));
+		vertices.push_back(vtx);
+
+		vcoll.push_back(vtx);
+	}
+
+	for(auto const & p : event.particles) {
+		auto ptc = fcc::MCParticle();
+		auto & core = ptc.Core();
+		core.Type = p.pdg;
+		core.Status = p.status;
+		core.Charge = p.charge;
+		core.Bits = p.bits;
+		core.P4.Px = p.px;
+		core.P4.Py = p.py;
+		core.P4.Pz = p.pz;
+		core.P4.Mass = p.mass;
+
+		if(p.start_vertex >= 0 && static_cast<std::size_t>(p.start_vertex) < vertices.size()) {
+			ptc.StartVertex(vertices[static_cast<std::size_t>(p.start_vertex)]);
+		}
+		if(p.end_vertex >= 0 && static_cast<std::size_t>(p.end_vertex) < vertices.size()) {
+			ptc.EndVertex(vertices[static_cast<std::size_t>(p.end_vertex)]);
+		}
+
+		pcoll.push_back(ptc);
+	}
+}
@@ -0,0 +1,587 @@
+/// Differential validation of the optimized paths of the generator
+/// Generates seeded events with PYTHIA and EvtGen, stores every event with the reference conversion (the plain conversion the generator started with: every particle and vertex, full precision, charges straight from PYTHIA) and with each persistence policy and storage precision of the optimized conversion, and compares the stored EventInfo, GenParticle and GenVertex content event by event
+/// The reference is slimmed the same way as the policy under test and compared within the precision guarantee of the storage precision (exactly for the full precision)
+/// Before the events, the error bound of the fixed storage precision (Quantization.h) is checked on random values and edge cases for several grid steps
+/// The selection logic is checked too: key particles and decay signatures found in the HepMC event are compared with the ones found in the stored event (what the skim and the index rely on), and the decisions of the acceptance pre-filter on the PYTHIA event with the ones of the offline selection on the stored event
+/// Exits with a failure code if anything differs, so it can be run as the "validation" build target
+/// With --benchmark every path also times its specialized conversion against generic_convert_event of HepMCConverter.h (the same loops with the policy and precision checked at run time) on the same events, which is what the "benchmark" build target runs
+
+// Configuration
+#include "GeneratorConfig.h"
+
+// Common utilities
+#include "EventArena.h"
+#include "HepMCConverter.h"
+#include "AcceptanceFilter.h"
+#include "DecaySignature.h"
+#include "EventSelection.h"
+#include "EventComparison.h"
+#include "SignalDecays.h"
+
+// PODIO
+#include "podio/EventStore.h"
+
+// Data model
+#include "datamodel/EventInfo.h"
+#include "datamodel/EventInfoCollection.h"
+#include "datamodel/MCParticle.h"
+#include "datamodel/MCParticleCollection.h"
+#include "datamodel/GenVertex.h"
+#include "datamodel/GenVertexCollection.h"
+
+// STL
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <stdexcept>
+#include <unordered_map>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <sstream>
+
+// PYTHIA, EvtGen and HepMC
+#include "Pythia8/Pythia.h"
+#include "Pythia8Plugins/HepMC2.h"
+#include "Pythia8Plugins/EvtGen.h"
+
+#ifdef USE_BOOST
+	// Boost
+	#include "boost/program_options.hpp"
+#endif
+
+bool isBAtProduction(HepMC::GenParticle const * thePart); // utility function to determine whether the particle is NOT a B oscillation. Same as in the generator
+void reference_convert_event(HepMC::GenEvent const * hepmcevt, Pythia8::ParticleData & particle_data, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll); // the conversion the optimized ones are checked against
+void slim_event(StreamEvent const & event, std::vector<char> const & signal, PersistencePolicy policy, EventTopology & topology, StreamEvent & slimmed); // the reference event as the persistence policy should store it
+std::size_t check_quantization(double step, std::size_t max_reports, std::vector<std::string> & reports); // checks the guarantee of the fixed precision with the given grid step, returns the number of violations
+std::size_t count_undecayed_b_hadrons(Pythia8::Event const & event, std::size_t max_reports, std::vector<std::string> & reports); // B hadrons in the final state of the event, which neither PYTHIA nor EvtGen decayed
+
+int main(int argc, char * argv[]){
+	std::string evtgen_root = std::getenv("EVTGEN_ROOT_DIR"); // path to EvtGen installation directory
+
+	// declaring and initializing some variables. Most of them will be set according to command line options passed to the program after parsing of command line arguments. However, if Boost is not used, the only available command line option is the number of events to compare; other variables will use the values set below
+	std::size_t nevents = 100; // number of events with the key particle to compare
+	std::string pythia_cfgfile = "pythia.cmnd"; // name of PYTHIA cofiguration file
+	int keyptc = 511; // "key" particle
+	std::string evtgen_decfile = evtgen_root + "/share/DECAY_2010.DEC"; // EvtGen decay file
+	std::string evtgen_pdlfile = evtgen_root + "/share/evt.pdl"; // EvtGen PDL file
+	std::string evtgen_user_decfile = "user.dec"; // user defined decays
+	bool evtgen_signal_only = false; // EvtGen decays only the particles of the user decay file, PYTHIA the others, as with the option of the generator
+	int seed = 12345; // PYTHIA random seed, so that a failure can be reproduced
+	double momentum_step = 1e-5; // momentum grid step in GeV for the fixed storage precision
+	double position_step = 1e-6; // position grid step in mm for the fixed storage precision
+	AcceptanceCuts acceptance_cuts; // cuts the acceptance filter and the offline selection are compared with
+	acceptance_cuts.max_abs_costheta = 0.95;
+	acceptance_cuts.min_p = 0.1;
+	double max_ks_distance = 0.01; // largest accepted Kolmogorov-Smirnov distance of the sample distributions
+	std::size_t max_reports = 10; // number of mismatches printed per path
+	std::size_t benchmark_repeats = 0; // conversions of every event timed per path, no benchmark if 0
+	std::size_t verbosity = 0; // verbosity level
+
+	#ifdef USE_BOOST
+		try {
+			boost::program_options::options_description desc("Usage");
+
+			// defining command line options. See boost::program_options documentation for more details
+			desc.add_options()
+							("help", "produce this help message")
+							("nevents,n", boost::program_options::value<std::size_t>(&nevents)->default_value(100), "number of events with the key particle to compare")
+							("keyparticle,k", boost::program_options::value<int>(&keyptc)->default_value(511), "PDG ID of \"key\" particle (the one the redefined decay chain starts with)")
+							("pythiacfg,P", boost::program_options::value<std::string>(&pythia_cfgfile)->default_value("pythia.cmnd"), "PYTHIA config file")
+							("customdec,E", boost::program_options::value<std::string>(&evtgen_user_decfile)->default_value("user.dec"), "EvtGen user decay file")
+							("evtgendec", boost::program_options::value<std::string>(&evtgen_decfile)->default_value(evtgen_root + "/share/DECAY_2010.DEC"), "EvtGen decay file")
+							("evtgenpdl", boost::program_options::value<std::string>(&evtgen_pdlfile)->default_value(evtgen_root + "/share/evt.pdl"), "EvtGen PDL file")
+							("evtgen-signal-only", boost::program_options::bool_switch(&evtgen_signal_only), "Let EvtGen decay only the particles the user decay file defines decays for (and the key particle), and PYTHIA all the others, as the generator option does")
+							("seed", boost::program_options::value<int>(&seed)->default_value(12345), "PYTHIA random seed")
+							("momentum-step", boost::program_options::value<double>(&momentum_step)->default_value(1e-5), "Momentum grid step in GeV of the fixed storage precision")
+							("position-step", boost::program_options::value<double>(&position_step)->default_value(1e-6), "Position grid step in mm of the fixed storage precision")
+							("acceptance-costheta", boost::program_options::value<double>(&acceptance_cuts.max_abs_costheta)->default_value(0.95), "|cos(theta)| cut of the acceptance check")
+							("acceptance-pmin", boost::program_options::value<double>(&acceptance_cuts.min_p)->default_value(0.1), "Momentum cut in GeV of the acceptance check")
+							("acceptance-ptmin", boost::program_options::value<double>(&acceptance_cuts.min_pt)->default_value(0.), "Transverse momentum cut in GeV of the acceptance check")
+							("max-ks", boost::program_options::value<double>(&max_ks_distance)->default_value(0.01), "Largest accepted Kolmogorov-Smirnov distance between the reference and the optimized sample distributions")
+							("max-reports", boost::program_options::value<std::size_t>(&max_reports)->default_value(10), "Number of mismatching events printed per path")
+							("benchmark", boost::program_options::value<std::size_t>(&benchmark_repeats)->implicit_value(20), "Time the specialized conversion of every path against the generic one, converting every event the given number of times")
+							("verbosity,v", boost::program_options::value<std::size_t>(&verbosity)->implicit_value(1), "Set verbosity level (0, 1)")
+			;
+			boost::program_options::variables_map vm;
+			boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
+			boost::program_options::notify(vm);
+
+			if(vm.find("help") != vm.end()) {
+				std::cout << "Differential validation of the generator. Version " << Generator_VERSION_MAJOR << '.' << Generator_VERSION_MINOR << std::endl;
+				std::cout << desc << std::endl;
+
+				return EXIT_SUCCESS;
+			}
+		} catch(std::exception const & e) {
+			std::cerr << "Exception thrown during options parsing:" << std::endl << e.what() << std::endl;
+
+			return EXIT_FAILURE;
+		}
+	#else
+		if(argc >= 2) {
+			nevents = std::stoull(argv[1]);
+		}
+	#endif
+
+	// storage precision guarantee, independent of the events
+	std::size_t quantization_violations = 0;
+	std::vector<std::string> quantization_reports;
+	std::vector<double> const quantization_steps = {momentum_step, position_step, 1e-3, 0.3, 1., 10.};
+	for(auto step : quantization_steps) {
+		quantization_violations += check_quantization(step, max_reports, quantization_reports);
+	}
+
+	// initializing PYTHIA
+	Pythia8::Pythia pythia;
+	pythia.readFile(pythia_cfgfile);
+	pythia.readString("Random:setSeed = on");
+	pythia.readString("Random:seed = " + std::to_string(seed));
+	pythia.init();
+
+	// creating EvtGen generator. Same configuration as in the generator
+	auto evtgen = new EvtGenDecays(&pythia, evtgen_decfile.c_str(), evtgen_pdlfile.c_str(), nullptr, nullptr, 1, false, true, true, false);
+	if(evtgen) {
+		evtgen->readDecayFile(evtgen_user_decfile.c_str());
+		decay_with_pythia(*evtgen, pythia.particleData, 23); // make PYTHIA itself (not EvtGen) decay Z
+
+		if(evtgen_signal_only) {
+			try {
+				SignalDecays const signal_decays(evtgen_user_decfile, evtgen_decfile, evtgen_pdlfile, {keyptc});
+				for(auto id : signal_decays.excluded()) {
+					decay_with_pythia(*evtgen, pythia.particleData, id);
+				}
+				signal_decays.print(std::cout);
+			} catch(std::exception const & e) {
+				std::cerr << e.what() << ". Program stopped." << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+	} else {
+		std::cerr << "Unable to initialize EvtGen. Program stopped." << std::endl;
+		return EXIT_FAILURE;
+	}
+	ParticleTable const particle_table(pythia.particleData); // the reference conversion keeps asking PYTHIA
+
+	HepMC::Pythia8ToHepMC ToHepMC;
+	HepMC::GenEvent * hepmcevt = new HepMC::GenEvent(HepMC::Units::GEV, HepMC::Units::MM);
+
+	auto const is_key_particle = [keyptc](HepMC::GenParticle const * const ptc_ptr) {return std::abs(ptc_ptr->pdg_id()) == keyptc && isBAtProduction(ptc_ptr);};
+
+	// optimized paths: every persistence policy with every storage precision
+	typedef decltype(make_event_converter(PersistencePolicy::Full, Quantizer(), is_key_particle)) Converter;
+	struct Path {
+		PersistencePolicy policy;
+		Quantizer quantizer;
+		Converter convert;
+		EventComparison comparison;
+		double generic_time; // seconds spent in the benchmark
+		double specialized_time;
+	};
+	std::vector<Path> paths;
+	for(auto policy : {PersistencePolicy::Full, PersistencePolicy::SignalTreeAndStable, PersistencePolicy::StableOnly, PersistencePolicy::SignalTreeOnly}) {
+		for(auto precision : {StoragePrecision::Full, StoragePrecision::Fixed}) {
+			Quantizer const quantizer(precision, momentum_step, position_step);
+
+			// precision guarantees of Quantization.h
+			Tolerance momentum_tolerance, position_tolerance;
+			if(precision == StoragePrecision::Fixed) {
+				momentum_tolerance.absolute = quantizer.momentum_step() / 2.;
+				position_tolerance.absolute = quantizer.position_step() / 2.;
+				momentum_tolerance.relative = position_tolerance.relative = std::ldexp(1., -23); // the fields are single precision, so the reference and the grid value are both rounded once more
+			}
+
+			paths.push_back(Path{policy, quantizer, make_event_converter(policy, quantizer, is_key_particle), EventComparison(to_string(policy) + " / " + to_string(precision), momentum_tolerance, position_tolerance, max_reports), 0., 0.});
+		}
+	}
+
+	// one set of collections, refilled by every path
+	podio::EventStore store;
+	auto & evinfocoll = store.create<fcc::EventInfoCollection>("EventInfo");
+	auto & pcoll = store.create<fcc::MCParticleCollection>("GenParticle");
+	auto & vcoll = store.create<fcc::GenVertexCollection>("GenVertex");
+
+	EventArena arena;
+	AcceptanceFilter acceptance(keyptc, acceptance_cuts);
+	SelectionCuts selection_cuts;
+	selection_cuts.key_pdg = keyptc;
+	selection_cuts.acceptance = acceptance_cuts;
+	EventSelection const selection(selection_cuts);
+
+	StreamEvent reference, expected, stored;
+	std::vector<char> signal; // signal flags of the reference particles
+	EventTopology topology;
+	IndexRecord record;
+	std::string hepmc_signature;
+
+	std::size_t compared = 0, total = 0;
+	std::size_t key_mismatches = 0, signature_mismatches = 0, acceptance_mismatches = 0, accepted = 0;
+	std::size_t benchmark_mismatches = 0;
+	std::size_t undecayed_b_hadrons = 0, events_with_undecayed = 0; // B hadrons left stable by both PYTHIA and EvtGen
+	std::vector<std::string> selection_reports, decay_reports;
+	while(compared < nevents) {
+		if(!pythia.next()) {
+			continue;
+		}
+		++total;
+
+		evtgen->decay();
+		auto const undecayed = count_undecayed_b_hadrons(pythia.event, max_reports, decay_reports);
+		if(undecayed > 0) {
+			undecayed_b_hadrons += undecayed;
+			++events_with_undecayed;
+		}
+		bool const pythia_accepted = acceptance.accept(pythia.event); // before the conversion, as in the generator
+
+		hepmcevt->use_units(HepMC::Units::GEV, HepMC::Units::MM);
+		ToHepMC.fill_next_event(pythia, hepmcevt);
+
+		if(std::count_if(hepmcevt->particles_begin(), hepmcevt->particles_end(), is_key_particle) == 0) {
+			hepmcevt->clear();
+			continue;
+		}
+		++compared;
+		int const number = static_cast<int>(compared);
+
+		// reference path
+		auto evinfo = fcc::EventInfo();
+		evinfo.Number(number);
+		evinfocoll.push_back(evinfo);
+		reference_convert_event(hepmcevt, pythia.particleData, pcoll, vcoll);
+		fill_stream_event(evinfocoll[0].Number(), pcoll, vcoll, reference);
+		store.clearCollections();
+
+		signal.clear();
+		for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+			signal.push_back(is_key_particle(*ip) ? 1 : 0);
+		}
+
+		// optimized paths
+		for(auto & path : paths) {
+			auto path_evinfo = fcc::EventInfo();
+			path_evinfo.Number(number);
+			evinfocoll.push_back(path_evinfo);
+			path.convert(hepmcevt, particle_table, pcoll, vcoll, arena);
+			fill_stream_event(evinfocoll[0].Number(), pcoll, vcoll, stored);
+			store.clearCollections();
+			arena.reset();
+
+			slim_event(reference, signal, path.policy, topology, expected);
+			path.comparison.compare(expected, stored);
+		}
+
+		// benchmark: both conversions of the same event in turn, so that neither of them runs on warmer caches
+		if(benchmark_repeats > 0) {
+			for(auto & path : paths) {
+				for(std::size_t repeat = 0; repeat < benchmark_repeats; ++repeat) {
+					auto const generic_start = std::chrono::steady_clock::now();
+					auto const generic_stored = generic_convert_event(hepmcevt, particle_table, pcoll, vcoll, arena, path.policy, path.quantizer, is_key_particle);
+					store.clearCollections();
+					arena.reset();
+					auto const specialized_start = std::chrono::steady_clock::now();
+					auto const specialized_stored = path.convert(hepmcevt, particle_table, pcoll, vcoll, arena);
+					store.clearCollections();
+					arena.reset();
+					auto const end = std::chrono::steady_clock::now();
+
+					path.generic_time += std::chrono::duration<double>(specialized_start - generic_start).count();
+					path.specialized_time += std::chrono::duration<double>(end - specialized_start).count();
+					if(generic_stored != specialized_stored) {
+						++benchmark_mismatches;
+					}
+				}
+			}
+		}
+
+		// selection logic: HepMC event and PYTHIA event against the stored event
+		fill_index_record(record, hepmc_signature, hepmcevt, particle_table, is_key_particle);
+		topology.build(reference);
+		std::size_t stored_keys = 0;
+		for(std::size_t i = 0; i < reference.particles.size(); ++i) {
+			if(is_key_at_production(reference, topology, i, keyptc)) {
+				++stored_keys;
+			}
+		}
+		auto const stored_signature = event_signature(reference, topology, keyptc);
+		bool const stored_accepted = selection.select(reference, topology);
+		accepted += stored_accepted ? 1 : 0;
+
+		if(stored_keys != record.key_count) {
+			++key_mismatches;
+			if(selection_reports.size() < max_reports) {
+				selection_reports.push_back("event " + std::to_string(number) + ": " + std::to_string(stored_keys) + " key particles in the stored event, " + std::to_string(record.key_count) + " in the HepMC event");
+			}
+		}
+		if(stored_signature != hepmc_signature) {
+			++signature_mismatches;
+			if(selection_reports.size() < max_reports) {
+				selection_reports.push_back("event " + std::to_string(number) + ": signature \"" + stored_signature + "\" of the stored event, \"" + hepmc_signature + "\" of the HepMC event");
+			}
+		}
+		if(stored_accepted != pythia_accepted) {
+			++acceptance_mismatches;
+			if(selection_reports.size() < max_reports) {
+				selection_reports.push_back("event " + std::to_string(number) + ": " + (stored_accepted ? "accepted" : "rejected") + " by the offline selection, " + (pythia_accepted ? "accepted" : "rejected") + " by the acceptance filter");
+			}
+		}
+
+		if(verbosity >= 1 && compared % 100 == 0) {
+			std::cout << compared << " events compared (" << total << " generated)" << std::endl;
+		}
+
+		hepmcevt->clear();
+	}
+
+	delete hepmcevt;
+	delete evtgen;
+
+	// summary
+	bool passed = true;
+	std::cout << "Fixed storage precision: " << quantization_violations << " violations of |q(x) - x| <= step / 2 with " << quantization_steps.size() << " grid steps" << std::endl;
+	for(auto const & report : quantization_reports) {
+		std::cout << "\t" << report << std::endl;
+	}
+	if(quantization_violations > 0) {
+		std::cout << "\tFAILED" << std::endl;
+		passed = false;
+	}
+	std::cout << "Decays" << (evtgen_signal_only ? " (EvtGen signal-only mode)" : "") << ": " << undecayed_b_hadrons << " undecayed B hadrons in " << events_with_undecayed << " of " << total << " generated events" << std::endl;
+	for(auto const & report : decay_reports) {
+		std::cout << "\t" << report << std::endl;
+	}
+	if(undecayed_b_hadrons > 0) {
+		std::cout << "\tFAILED" << std::endl;
+		passed = false;
+	}
+	std::cout << compared << " events with the key particle " << keyptc << " compared (" << total << " generated, seed " << seed << ")" << std::endl;
+	for(auto & path : paths) {
+		path.comparison.print(std::cout);
+		auto const ks = path.comparison.ks_distance();
+		if(path.comparison.mismatched() > 0 || ks > max_ks_distance) {
+			std::cout << "\tFAILED" << (ks > max_ks_distance ? " (distributions differ)" : "") << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << "Selection: " << key_mismatches << " key particle count, " << signature_mismatches << " decay signature and " << acceptance_mismatches << " acceptance mismatches (" << accepted << " events accepted)" << std::endl;
+	for(auto const & report : selection_reports) {
+		std::cout << "\t" << report << std::endl;
+	}
+	if(key_mismatches > 0 || signature_mismatches > 0 || acceptance_mismatches > 0) {
+		std::cout << "\tFAILED" << std::endl;
+		passed = false;
+	}
+
+	if(benchmark_repeats > 0) {
+		std::cout << "Benchmark: every event converted " << benchmark_repeats << " times by every path. Time per event, generic -> specialized:" << std::endl;
+		auto const conversions = static_cast<double>(compared * benchmark_repeats);
+		for(auto const & path : paths) {
+			std::cout << "\t" << path.comparison.name() << ": " << 1e6 * path.generic_time / conversions << " us -> " << 1e6 * path.specialized_time / conversions << " us (" << (path.specialized_time > 0. ? path.generic_time / path.specialized_time : 0.) << "x)" << std::endl;
+		}
+		if(benchmark_mismatches > 0) {
+			std::cout << "\tFAILED: the generic and the specialized conversion stored different numbers of particles " << benchmark_mismatches << " times" << std::endl;
+			passed = false;
+		}
+	}
+
+	std::cout << (passed ? "Validation passed" : "Validation FAILED") << std::endl;
+
+	return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// utility function to determine whether the particle is NOT a B oscillation. Stolen from https://lhcb-release-area.web.cern.ch/LHCb-release-area/DOC/rec/latest_doxygen/da/db4/_hep_m_c_utils_8h_source.html
+bool isBAtProduction(HepMC::GenParticle const * thePart) {
+	if((std::abs(thePart->pdg_id()) != 511) && (std::abs(thePart->pdg_id()) != 531)) {
+		return true;
+	}
+	if(thePart->production_vertex() == nullptr) {
+		return true;
+	}
+	auto theVertex = thePart->production_vertex();
+	if(theVertex -> particles_in_size() != 1) {
+		return true;
+	}
+	HepMC::GenParticle * theMother = (*theVertex->particles_in_const_begin()) ;
+	if(theMother->pdg_id() == - thePart->pdg_id()) {
+		return false;
+	}
+
+	return true;
+}
+
+// the conversion the generator started with. Deliberately kept simple and unoptimized
+void reference_convert_event(HepMC::GenEvent const * hepmcevt, Pythia8::ParticleData & particle_data, fcc::MCParticleCollection & pcoll, fcc::GenVertexCollection & vcoll) {
+	// filling vertices
+	std::unordered_map<HepMC::GenVertex const *, fcc::GenVertex> vtx_map;
+	for(auto iv = hepmcevt->vertices_begin(), endv = hepmcevt->vertices_end(); iv != endv; ++iv) {
+		auto vtx = fcc::GenVertex();
+		vtx.Position().X = (*iv)->position().x();
+		vtx.Position().Y = (*iv)->position().y();
+		vtx.Position().Z = (*iv)->position().z();
+		vtx.Ctau(static_cast<float>((*iv)->position().t()));
+		vtx_map.emplace(*iv, vtx);
+
+		vcoll.push_back(vtx);
+	}
+
+	// filling particles
+	for(auto ip = hepmcevt->particles_begin(), endp = hepmcevt->particles_end(); ip != endp; ++ip) {
+		auto ptc = fcc::MCParticle();
+		auto & core = ptc.Core();
+		core.Type = (*ip)->pdg_id();
+		core.Status = (*ip)->status();
+
+		core.Charge = static_cast<int>(particle_data.charge(core.Type)); // PYTHIA returns charge as a double value (in case it's quark), truncated towards 0 as in ParticleTable
+		core.P4.Mass = (*ip)->momentum().m();
+		core.P4.Px = (*ip)->momentum().px();
+		core.P4.Py = (*ip)->momentum().py();
+		core.P4.Pz = (*ip)->momentum().pz();
+
+		auto prodvtx = vtx_map.find((*ip)->production_vertex());
+		if(prodvtx != vtx_map.end()) {
+			ptc.StartVertex(prodvtx->second);
+		}
+		auto endvtx = vtx_map.find((*ip)->end_vertex());
+		if(endvtx != vtx_map.end()) {
+			ptc.EndVertex(endvtx->second);
+		}
+
+		pcoll.push_back(ptc);
+	}
+}
+
+// checks the fixed precision of Quantization.h with the grid step "step" for momenta and positions: the error is at most half the effective grid step, quantized values are on the grid (quantizing them again changes nothing), the compile time and run time versions agree, and the full precision changes nothing
+// on edge cases (zero, denormals, grid points and midpoints, large magnitudes, both signs) and on random values with magnitudes between 1e-12 and 1e12, seeded so that a failure can be reproduced
+std::size_t check_quantization(double step, std::size_t max_reports, std::vector<std::string> & reports) {
+	Quantizer const fixed(StoragePrecision::Fixed, step, step);
+	Quantizer const full;
+	double const grid = fixed.momentum_step();
+
+	std::vector<double> values = {0., std::numeric_limits<double>::denorm_min(), 1e-310, std::numeric_limits<double>::min(), grid, 0.5 * grid, 1.5 * grid, 2.5 * grid, 0.5 * grid * (1. - std::ldexp(1., -52)), 1e6, 1e15, 1e300};
+	for(double k : {1., 7., 1000., 123456789.}) {
+		values.push_back((k + 0.5) * grid); // midpoints, exactly representable
+		values.push_back(k * grid);
+	}
+	std::mt19937_64 generator(12345);
+	std::uniform_real_distribution<double> exponent(-12., 12.);
+	for(int i = 0; i < 100000; ++i) {
+		values.push_back(std::pow(10., exponent(generator)));
+	}
+	auto const npositive = values.size();
+	for(std::size_t i = 0; i < npositive; ++i) {
+		values.push_back(-values[i]);
+	}
+
+	std::size_t violations = 0;
+	auto const report = [&](double value, double quantized, std::string const & what) {
+		++violations;
+		if(reports.size() < max_reports) {
+			std::ostringstream message;
+			message.precision(17);
+			message << "step " << grid << ": " << value << " -> " << quantized << " (" << what << ")";
+			reports.push_back(message.str());
+		}
+	};
+	for(auto value : values) {
+		for(auto quantized : {fixed.momentum(value), fixed.position(value)}) {
+			if(!(std::abs(quantized - value) <= grid / 2.)) {
+				report(value, quantized, "error above half the grid step");
+			} else if(!(std::abs(fixed.momentum(quantized) - quantized) <= 0.)) {
+				report(value, quantized, "not on the grid");
+			}
+		}
+		if(!(std::abs(fixed.momentum<StoragePrecision::Fixed>(value) - fixed.momentum(value)) <= 0.) || !(std::abs(fixed.position<StoragePrecision::Fixed>(value) - fixed.position(value)) <= 0.)) {
+			report(value, fixed.momentum<StoragePrecision::Fixed>(value), "compile time and run time precision differ");
+		}
+		if(!(std::abs(full.momentum(value) - value) <= 0.) || !(std::abs(full.position(value) - value) <= 0.)) {
+			report(value, full.momentum(value), "changed by the full precision");
+		}
+	}
+
+	return violations;
+}
+
+// the reference event as the persistence policy should store it: the kept particles in their original order, and only the vertices they are produced or decay in. Written from the description of the policies in HepMCConverter.h, not from its code
+void slim_event(StreamEvent const & event, std::vector<char> const & signal, PersistencePolicy policy, EventTopology & topology, StreamEvent & slimmed) {
+	slimmed.number = event.number;
+	if(policy == PersistencePolicy::Full) {
+		slimmed.vertices = event.vertices;
+		slimmed.particles = event.particles;
+		return;
+	}
+
+	bool const keep_stable = policy == PersistencePolicy::SignalTreeAndStable || policy == PersistencePolicy::StableOnly;
+	bool const keep_signal_tree = policy == PersistencePolicy::SignalTreeAndStable || policy == PersistencePolicy::SignalTreeOnly;
+
+	topology.build(event);
+	std::vector<char> keep(event.particles.size(), 0);
+	auto & stack = topology.stack();
+	stack.clear();
+	for(std::size_t i = 0; i < event.particles.size(); ++i) {
+		if(keep_stable && event.particles[i].status == 1) {
+			keep[i] = 1;
+		}
+		if(keep_signal_tree && signal[i]) {
+			stack.push_back(i);
+		}
+	}
+	while(!stack.empty()) {
+		auto i = stack.back();
+		stack.pop_back();
+		if(keep[i] == 2) {
+			continue;
+		}
+		keep[i] = 2; // kept and visited
+		auto const & daughters = topology.daughters(event.particles[i]);
+		stack.insert(stack.end(), daughters.begin(), daughters.end());
+	}
+
+	std::vector<int> vertex_index(event.vertices.size(), -1);
+	for(std::size_t i = 0; i < event.particles.size(); ++i) {
+		if(!keep[i]) {
+			continue;
+		}
+		for(auto v : {event.particles[i].start_vertex, event.particles[i].end_vertex}) {
+			if(v >= 0) {
+				vertex_index[static_cast<std::size_t>(v)] = 0;
+			}
+		}
+	}
+
+	slimmed.vertices.clear();
+	for(std::size_t v = 0; v < event.vertices.size(); ++v) {
+		if(vertex_index[v] == 0) {
+			vertex_index[v] = static_cast<int>(slimmed.vertices.size());
+			slimmed.vertices.push_back(event.vertices[v]);
+		}
+	}
+
+	slimmed.particles.clear();
+	for(std::size_t i = 0; i < event.particles.size(); ++i) {
+		if(keep[i]) {
+			auto ptc = event.particles[i];
+			ptc.start_vertex = ptc.start_vertex >= 0 ? vertex_index[static_cast<std::size_t>(ptc.start_vertex)] : -1;
+			ptc.end_vertex = ptc.end_vertex >= 0 ? vertex_index[static_cast<std::size_t>(ptc.end_vertex)] : -1;
+			slimmed.particles.push_back(ptc);
+		}
+	}
+}
+
+std::size_t count_undecayed_b_hadrons(Pythia8::Event const & event, std::size_t max_reports, std::vector<std::string> & reports) {
+	std::size_t undecayed = 0;
+	for(int i = 0; i < event.size(); ++i) {
+		auto const & ptc = event[i];
+		auto const id = ptc.idAbs();
+		if(ptc.isFinal() && ptc.isHadron() && ((id / 100) % 10 == 5 || (id / 1000) % 10 == 5)) {
+			++undecayed;
+			if(reports.size() < max_reports) {
+				reports.push_back(ptc.name() + " (" + std::to_string(ptc.id()) + ") left undecayed");
+			}
+		}
+	}
+
+	return undecayed;
+}